@@ -0,0 +1,849 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Host-side acceleration.
+ *
+ * Some drawing operations, like scrolling or clearing with a solid color, can
+ * be reproduced on the host window much more cheaply than by uploading the
+ * pixels they produce. We wrap those operations, let fb draw them as usual
+ * and record a command describing them. Right before NestedShadowUpdate
+ * uploads the damage, the commands are replayed on the host in order and the
+ * areas they cover are removed from the upload.
+ *
+ * A command is only recorded for the part of the screen whose result on
+ * the host is known to match the framebuffer. The host is up to date
+ * everywhere except in the damage not yet uploaded ("dirty"), minus what
+ * previously recorded commands will reproduce ("replayed"). Any later
+ * drawing over a replayed area takes it out of "replayed" again, so it gets
+ * uploaded as usual.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+
+#include <xorg-server.h>
+#include <fb.h>
+#include <gcstruct.h>
+#include <pixmapstr.h>
+#include <scrnintstr.h>
+#include <windowstr.h>
+#include <xf86.h>
+
+#include "compat-api.h"
+
+#include "driver.h"
+
+/* If more commands than this pile up between two updates, we give up and
+ * upload everything as pixels */
+#define NESTED_MAX_CMDS 256
+
+typedef struct NestedGCPriv {
+    const GCOps   *ops;
+    const GCFuncs *funcs;
+} NestedGCPrivRec, *NestedGCPrivPtr;
+
+static DevPrivateKeyRec NestedGCPrivateKeyRec;
+
+#define NestedGetGCPriv(pGC) \
+    ((NestedGCPrivPtr)dixLookupPrivate(&(pGC)->devPrivates, \
+                                       &NestedGCPrivateKeyRec))
+
+static const GCFuncs NestedGCFuncs;
+static const GCOps NestedGCOps;
+
+#define NESTED_GC_FUNC_PROLOGUE(pGC) \
+    NestedGCPrivPtr pGCPriv = NestedGetGCPriv(pGC); \
+    (pGC)->funcs = pGCPriv->funcs; \
+    if (pGCPriv->ops) \
+        (pGC)->ops = pGCPriv->ops
+
+#define NESTED_GC_FUNC_EPILOGUE(pGC) \
+    pGCPriv->funcs = (pGC)->funcs; \
+    (pGC)->funcs = &NestedGCFuncs; \
+    if (pGCPriv->ops) { \
+        pGCPriv->ops = (pGC)->ops; \
+        (pGC)->ops = &NestedGCOps; \
+    }
+
+#define NESTED_GC_OP_PROLOGUE(pGC) \
+    NestedGCPrivPtr pGCPriv = NestedGetGCPriv(pGC); \
+    const GCFuncs *oldFuncs = (pGC)->funcs; \
+    (pGC)->funcs = pGCPriv->funcs; \
+    (pGC)->ops = pGCPriv->ops
+
+#define NESTED_GC_OP_EPILOGUE(pGC) \
+    pGCPriv->funcs = (pGC)->funcs; \
+    (pGC)->funcs = oldFuncs; \
+    pGCPriv->ops = (pGC)->ops; \
+    (pGC)->ops = &NestedGCOps
+
+static inline NestedPrivatePtr
+NestedAccelGetPrivate(ScreenPtr pScreen) {
+    return PNESTED(xf86ScreenToScrn(pScreen));
+}
+
+static inline short
+NestedAccelClampShort(int v) {
+    return v < MINSHORT ? MINSHORT : (v > MAXSHORT ? MAXSHORT : v);
+}
+
+/* Whether drawing to pDrawable ends up in the screen pixmap, i.e. whether it
+ * is visible on the host window. */
+Bool
+NestedAccelOnScreen(DrawablePtr pDrawable) {
+    ScreenPtr pScreen = pDrawable->pScreen;
+    PixmapPtr pPixmap;
+
+    if (pDrawable->type == DRAWABLE_WINDOW)
+        pPixmap = (*pScreen->GetWindowPixmap)((WindowPtr)pDrawable);
+    else
+        pPixmap = (PixmapPtr)pDrawable;
+
+    return pPixmap == (*pScreen->GetScreenPixmap)(pScreen);
+}
+
+static Bool
+NestedAccelPlainGC(GCPtr pGC) {
+    return pGC->alu == GXcopy &&
+           (pGC->planemask & FbFullMask(pGC->depth)) == FbFullMask(pGC->depth);
+}
+
+static void
+NestedAccelFreeCmd(NestedCmdPtr pCmd) {
+    RegionUninit(&pCmd->region);
+
+    if (pCmd->type == NESTED_CMD_GLYPHS) {
+        free(pCmd->glyphs);
+        pCmd->glyphs = NULL;
+    }
+}
+
+static void
+NestedAccelDiscard(NestedPrivatePtr pNested) {
+    int i;
+
+    for (i = 0; i < pNested->numCmds; i++)
+        NestedAccelFreeCmd(&pNested->cmds[i]);
+
+    pNested->numCmds = 0;
+    RegionEmpty(&pNested->replayed);
+
+    /* No command uses the glyphs freed meanwhile anymore */
+    NestedClientReleaseGlyphs(pNested->clientData);
+}
+
+static NestedCmdPtr
+NestedAccelAllocCmd(NestedPrivatePtr pNested, NestedCmdType type) {
+    NestedCmdPtr pCmd;
+
+    if (pNested->numCmds == NESTED_MAX_CMDS) {
+        NestedAccelDiscard(pNested);
+        return NULL;
+    }
+
+    pCmd = &pNested->cmds[pNested->numCmds++];
+    pCmd->type = type;
+    RegionNull(&pCmd->region);
+    return pCmd;
+}
+
+/* Restricts pRegion to the part that is up to date on the host, once
+ * shifted by (dx, dy). Software cursor removal happens in SourceValidate, so
+ * it is triggered first on pSrc to get its damage accounted for. */
+void
+NestedAccelClipToHost(ScreenPtr pScreen, DrawablePtr pSrc,
+                      RegionPtr pRegion, int dx, int dy,
+                      unsigned int subWindowMode) {
+    NestedPrivatePtr pNested = NestedAccelGetPrivate(pScreen);
+    BoxPtr pExtents = RegionExtents(pRegion);
+    RegionRec stale;
+
+    if (!RegionNotEmpty(pRegion))
+        return;
+
+    if (pScreen->SourceValidate)
+        (*pScreen->SourceValidate)(pSrc,
+                                   pExtents->x1 + dx - pSrc->x,
+                                   pExtents->y1 + dy - pSrc->y,
+                                   pExtents->x2 - pExtents->x1,
+                                   pExtents->y2 - pExtents->y1,
+                                   subWindowMode);
+
+    RegionNull(&stale);
+    RegionSubtract(&stale, &pNested->dirty, &pNested->replayed);
+    RegionTranslate(&stale, -dx, -dy);
+    RegionSubtract(pRegion, pRegion, &stale);
+    RegionUninit(&stale);
+}
+
+/* Records a command covering pRegion, to be called once fb has drawn it.
+ * Returns NULL if nothing was recorded; otherwise the caller fills in the
+ * type specific fields. */
+NestedCmdPtr
+NestedAccelRecord(ScreenPtr pScreen, NestedCmdType type, RegionPtr pRegion) {
+    NestedPrivatePtr pNested = NestedAccelGetPrivate(pScreen);
+    NestedCmdPtr pCmd;
+
+    if (!RegionNotEmpty(pRegion))
+        return NULL;
+
+    pCmd = NestedAccelAllocCmd(pNested, type);
+    if (!pCmd)
+        return NULL;
+
+    RegionCopy(&pCmd->region, pRegion);
+    RegionUnion(&pNested->replayed, &pNested->replayed, pRegion);
+    return pCmd;
+}
+
+static void
+NestedAccelRecordCopy(ScreenPtr pScreen, RegionPtr pDst, int dx, int dy) {
+    NestedCmdPtr pCmd = NestedAccelRecord(pScreen, NESTED_CMD_COPY, pDst);
+
+    if (pCmd) {
+        pCmd->dx = dx;
+        pCmd->dy = dy;
+    }
+}
+
+void
+NestedAccelRecordFill(ScreenPtr pScreen, RegionPtr pDst, Pixel pixel) {
+    NestedPrivatePtr pNested = NestedAccelGetPrivate(pScreen);
+    NestedCmdPtr pCmd = NULL;
+
+    if (!RegionNotEmpty(pDst))
+        return;
+
+    /* Consecutive fills with the same color become a single command */
+    if (pNested->numCmds > 0) {
+        pCmd = &pNested->cmds[pNested->numCmds - 1];
+        if (pCmd->type != NESTED_CMD_FILL || pCmd->pixel != pixel)
+            pCmd = NULL;
+    }
+
+    if (!pCmd) {
+        pCmd = NestedAccelRecord(pScreen, NESTED_CMD_FILL, pDst);
+        if (pCmd)
+            pCmd->pixel = pixel;
+        return;
+    }
+
+    RegionUnion(&pCmd->region, &pCmd->region, pDst);
+    RegionUnion(&pNested->replayed, &pNested->replayed, pDst);
+}
+
+/*
+ * Damage
+ */
+
+static void
+NestedAccelDamageReport(DamagePtr pDamage, RegionPtr pRegion, void *closure) {
+    NestedPrivatePtr pNested = closure;
+
+    if (!pNested->accel)
+        return;
+
+    RegionUnion(&pNested->dirty, &pNested->dirty, pRegion);
+    RegionSubtract(&pNested->replayed, &pNested->replayed, pRegion);
+}
+
+/*
+ * Screen functions
+ */
+
+static void
+NestedCopyWindow(WindowPtr pWin, DDXPointRec ptOldOrg, RegionPtr prgnSrc) {
+    ScreenPtr pScreen = pWin->drawable.pScreen;
+    NestedPrivatePtr pNested = NestedAccelGetPrivate(pScreen);
+    int dx = ptOldOrg.x - pWin->drawable.x;
+    int dy = ptOldOrg.y - pWin->drawable.y;
+    Bool accel = pNested->accel && NestedAccelOnScreen(&pWin->drawable);
+    RegionRec rgnDst;
+
+    RegionNull(&rgnDst);
+
+    if (accel) {
+        /* Same clipping fbCopyWindow does */
+        RegionCopy(&rgnDst, prgnSrc);
+        RegionTranslate(&rgnDst, -dx, -dy);
+        RegionIntersect(&rgnDst, &rgnDst, &pWin->borderClip);
+        NestedAccelClipToHost(pScreen, &pScreen->root->drawable,
+                              &rgnDst, dx, dy, IncludeInferiors);
+    }
+
+    pScreen->CopyWindow = pNested->CopyWindow;
+    (*pScreen->CopyWindow)(pWin, ptOldOrg, prgnSrc);
+    pNested->CopyWindow = pScreen->CopyWindow;
+    pScreen->CopyWindow = NestedCopyWindow;
+
+    /* In rootless mode, a moved top-level window takes its contents along */
+    if (accel && pWin == pNested->movingWindow)
+        NestedAccelRecord(pScreen, NESTED_CMD_MOVE, &rgnDst);
+    else if (accel)
+        NestedAccelRecordCopy(pScreen, &rgnDst, dx, dy);
+
+    RegionUninit(&rgnDst);
+}
+
+static Bool
+NestedCreateGC(GCPtr pGC) {
+    ScreenPtr pScreen = pGC->pScreen;
+    NestedPrivatePtr pNested = NestedAccelGetPrivate(pScreen);
+    NestedGCPrivPtr pGCPriv = NestedGetGCPriv(pGC);
+    Bool ret;
+
+    pScreen->CreateGC = pNested->CreateGC;
+    ret = (*pScreen->CreateGC)(pGC);
+    pNested->CreateGC = pScreen->CreateGC;
+    pScreen->CreateGC = NestedCreateGC;
+
+    if (ret) {
+        pGCPriv->ops = NULL;
+        pGCPriv->funcs = pGC->funcs;
+        pGC->funcs = &NestedGCFuncs;
+    }
+
+    return ret;
+}
+
+/*
+ * GC functions
+ */
+
+static void
+NestedValidateGC(GCPtr pGC, unsigned long changes, DrawablePtr pDrawable) {
+    NESTED_GC_FUNC_PROLOGUE(pGC);
+    (*pGC->funcs->ValidateGC)(pGC, changes, pDrawable);
+    pGCPriv->ops = pGC->ops; /* just so it's not NULL */
+    NESTED_GC_FUNC_EPILOGUE(pGC);
+}
+
+static void
+NestedChangeGC(GCPtr pGC, unsigned long mask) {
+    NESTED_GC_FUNC_PROLOGUE(pGC);
+    (*pGC->funcs->ChangeGC)(pGC, mask);
+    NESTED_GC_FUNC_EPILOGUE(pGC);
+}
+
+static void
+NestedCopyGC(GCPtr pGCSrc, unsigned long mask, GCPtr pGCDst) {
+    NESTED_GC_FUNC_PROLOGUE(pGCDst);
+    (*pGCDst->funcs->CopyGC)(pGCSrc, mask, pGCDst);
+    NESTED_GC_FUNC_EPILOGUE(pGCDst);
+}
+
+static void
+NestedDestroyGC(GCPtr pGC) {
+    NESTED_GC_FUNC_PROLOGUE(pGC);
+    (*pGC->funcs->DestroyGC)(pGC);
+    NESTED_GC_FUNC_EPILOGUE(pGC);
+}
+
+static void
+NestedChangeClip(GCPtr pGC, int type, void *pvalue, int nrects) {
+    NESTED_GC_FUNC_PROLOGUE(pGC);
+    (*pGC->funcs->ChangeClip)(pGC, type, pvalue, nrects);
+    NESTED_GC_FUNC_EPILOGUE(pGC);
+}
+
+static void
+NestedCopyClip(GCPtr pgcDst, GCPtr pgcSrc) {
+    NESTED_GC_FUNC_PROLOGUE(pgcDst);
+    (*pgcDst->funcs->CopyClip)(pgcDst, pgcSrc);
+    NESTED_GC_FUNC_EPILOGUE(pgcDst);
+}
+
+static void
+NestedDestroyClip(GCPtr pGC) {
+    NESTED_GC_FUNC_PROLOGUE(pGC);
+    (*pGC->funcs->DestroyClip)(pGC);
+    NESTED_GC_FUNC_EPILOGUE(pGC);
+}
+
+static const GCFuncs NestedGCFuncs = {
+    NestedValidateGC,
+    NestedChangeGC,
+    NestedCopyGC,
+    NestedDestroyGC,
+    NestedChangeClip,
+    NestedDestroyClip,
+    NestedCopyClip
+};
+
+/*
+ * GC operations
+ */
+
+static void
+NestedFillSpans(DrawablePtr pDrawable, GCPtr pGC, int npt,
+                DDXPointPtr ppt, int *pwidth, int fSorted) {
+    NESTED_GC_OP_PROLOGUE(pGC);
+    (*pGC->ops->FillSpans)(pDrawable, pGC, npt, ppt, pwidth, fSorted);
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static void
+NestedSetSpans(DrawablePtr pDrawable, GCPtr pGC, char *pcharsrc,
+               DDXPointPtr ppt, int *pwidth, int npt, int fSorted) {
+    NESTED_GC_OP_PROLOGUE(pGC);
+    (*pGC->ops->SetSpans)(pDrawable, pGC, pcharsrc, ppt, pwidth, npt, fSorted);
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static void
+NestedPutImage(DrawablePtr pDrawable, GCPtr pGC, int depth, int x, int y,
+               int w, int h, int leftPad, int format, char *pImage) {
+    RegionPtr pShared = NULL;
+
+    NESTED_GC_OP_PROLOGUE(pGC);
+
+    /* The host may read a MIT-SHM image from the client's segment */
+    if (NestedAccelPlainGC(pGC) && NestedAccelOnScreen(pDrawable))
+        pShared = NestedShmPutImage(pDrawable, pGC, depth, x, y, w, h,
+                                    leftPad, format, pImage);
+
+    (*pGC->ops->PutImage)(pDrawable, pGC, depth, x, y, w, h,
+                          leftPad, format, pImage);
+
+    if (pShared)
+        NestedShmPutImageDone(pGC->pScreen, pShared);
+
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static RegionPtr
+NestedCopyArea(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
+               int srcx, int srcy, int width, int height,
+               int dstx, int dsty) {
+    ScreenPtr pScreen = pGC->pScreen;
+    NestedPrivatePtr pNested = NestedAccelGetPrivate(pScreen);
+    Bool accel = pNested->accel &&
+                 pSrc->pScreen == pScreen &&
+                 NestedAccelPlainGC(pGC) &&
+                 NestedAccelOnScreen(pSrc) &&
+                 NestedAccelOnScreen(pDst);
+    int dx = (pSrc->x + srcx) - (pDst->x + dstx);
+    int dy = (pSrc->y + srcy) - (pDst->y + dsty);
+    RegionRec rgnDst;
+    RegionPtr ret;
+
+    NESTED_GC_OP_PROLOGUE(pGC);
+
+    RegionNull(&rgnDst);
+
+    if (accel) {
+        BoxRec box;
+
+        box.x1 = NestedAccelClampShort(pDst->x + dstx);
+        box.y1 = NestedAccelClampShort(pDst->y + dsty);
+        box.x2 = NestedAccelClampShort(pDst->x + dstx + width);
+        box.y2 = NestedAccelClampShort(pDst->y + dsty + height);
+        RegionReset(&rgnDst, &box);
+        RegionIntersect(&rgnDst, &rgnDst, pGC->pCompositeClip);
+
+        /* Parts of the destination whose source lies outside the visible
+         * source drawable are left untouched by fb */
+        RegionTranslate(&rgnDst, dx, dy);
+        if (pSrc->type == DRAWABLE_WINDOW) {
+            WindowPtr pSrcWin = (WindowPtr)pSrc;
+
+            if (pGC->subWindowMode == IncludeInferiors) {
+                box.x1 = pSrc->x;
+                box.y1 = pSrc->y;
+                box.x2 = pSrc->x + pSrc->width;
+                box.y2 = pSrc->y + pSrc->height;
+                RegionIntersect(&rgnDst, &rgnDst, &pSrcWin->borderClip);
+            } else
+                RegionIntersect(&rgnDst, &rgnDst, &pSrcWin->clipList);
+        } else {
+            box.x1 = 0;
+            box.y1 = 0;
+            box.x2 = pSrc->width;
+            box.y2 = pSrc->height;
+        }
+        if (pSrc->type != DRAWABLE_WINDOW ||
+            pGC->subWindowMode == IncludeInferiors) {
+            RegionRec rgnSrc;
+
+            RegionInit(&rgnSrc, &box, 1);
+            RegionIntersect(&rgnDst, &rgnDst, &rgnSrc);
+            RegionUninit(&rgnSrc);
+        }
+        RegionTranslate(&rgnDst, -dx, -dy);
+
+        NestedAccelClipToHost(pScreen, pSrc, &rgnDst, dx, dy,
+                              pGC->subWindowMode);
+    }
+
+    ret = (*pGC->ops->CopyArea)(pSrc, pDst, pGC, srcx, srcy,
+                                width, height, dstx, dsty);
+
+    if (accel)
+        NestedAccelRecordCopy(pScreen, &rgnDst, dx, dy);
+
+    RegionUninit(&rgnDst);
+
+    NESTED_GC_OP_EPILOGUE(pGC);
+    return ret;
+}
+
+static RegionPtr
+NestedCopyPlane(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
+                int srcx, int srcy, int width, int height,
+                int dstx, int dsty, unsigned long bitPlane) {
+    RegionPtr ret;
+
+    NESTED_GC_OP_PROLOGUE(pGC);
+    ret = (*pGC->ops->CopyPlane)(pSrc, pDst, pGC, srcx, srcy,
+                                 width, height, dstx, dsty, bitPlane);
+    NESTED_GC_OP_EPILOGUE(pGC);
+    return ret;
+}
+
+static void
+NestedPolyPoint(DrawablePtr pDrawable, GCPtr pGC, int mode,
+                int npt, xPoint *ppt) {
+    NESTED_GC_OP_PROLOGUE(pGC);
+    (*pGC->ops->PolyPoint)(pDrawable, pGC, mode, npt, ppt);
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static void
+NestedPolylines(DrawablePtr pDrawable, GCPtr pGC, int mode,
+                int npt, DDXPointPtr ppt) {
+    NESTED_GC_OP_PROLOGUE(pGC);
+    (*pGC->ops->Polylines)(pDrawable, pGC, mode, npt, ppt);
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static void
+NestedPolySegment(DrawablePtr pDrawable, GCPtr pGC, int nSeg,
+                  xSegment *pSeg) {
+    NESTED_GC_OP_PROLOGUE(pGC);
+    (*pGC->ops->PolySegment)(pDrawable, pGC, nSeg, pSeg);
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static void
+NestedPolyRectangle(DrawablePtr pDrawable, GCPtr pGC, int nRects,
+                    xRectangle *pRects) {
+    NESTED_GC_OP_PROLOGUE(pGC);
+    (*pGC->ops->PolyRectangle)(pDrawable, pGC, nRects, pRects);
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static void
+NestedPolyArc(DrawablePtr pDrawable, GCPtr pGC, int nArcs, xArc *pArcs) {
+    NESTED_GC_OP_PROLOGUE(pGC);
+    (*pGC->ops->PolyArc)(pDrawable, pGC, nArcs, pArcs);
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static void
+NestedFillPolygon(DrawablePtr pDrawable, GCPtr pGC, int shape, int mode,
+                  int npt, DDXPointPtr ppt) {
+    NESTED_GC_OP_PROLOGUE(pGC);
+    (*pGC->ops->FillPolygon)(pDrawable, pGC, shape, mode, npt, ppt);
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static void
+NestedPolyFillRect(DrawablePtr pDrawable, GCPtr pGC, int nRects,
+                   xRectangle *pRects) {
+    ScreenPtr pScreen = pGC->pScreen;
+    NestedPrivatePtr pNested = NestedAccelGetPrivate(pScreen);
+    RegionPtr pDst = NULL;
+
+    NESTED_GC_OP_PROLOGUE(pGC);
+
+    /* Solid fills are sent as a color and a list of rectangles. They cover
+     * whatever was below, so they don't depend on the host contents. */
+    if (pNested->accel && nRects > 0 &&
+        pGC->fillStyle == FillSolid &&
+        NestedAccelPlainGC(pGC) &&
+        NestedAccelOnScreen(pDrawable)) {
+        pDst = RegionFromRects(nRects, pRects, CT_UNSORTED);
+        if (pDst) {
+            RegionTranslate(pDst, pDrawable->x, pDrawable->y);
+            RegionIntersect(pDst, pDst, pGC->pCompositeClip);
+        }
+    }
+
+    (*pGC->ops->PolyFillRect)(pDrawable, pGC, nRects, pRects);
+
+    if (pDst) {
+        NestedAccelRecordFill(pScreen, pDst, pGC->fgPixel);
+        RegionDestroy(pDst);
+    }
+
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static void
+NestedPolyFillArc(DrawablePtr pDrawable, GCPtr pGC, int nArcs,
+                  xArc *pArcs) {
+    NESTED_GC_OP_PROLOGUE(pGC);
+    (*pGC->ops->PolyFillArc)(pDrawable, pGC, nArcs, pArcs);
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static int
+NestedPolyText8(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+                int count, char *chars) {
+    int ret;
+
+    NESTED_GC_OP_PROLOGUE(pGC);
+    ret = (*pGC->ops->PolyText8)(pDrawable, pGC, x, y, count, chars);
+    NESTED_GC_OP_EPILOGUE(pGC);
+    return ret;
+}
+
+static int
+NestedPolyText16(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+                 int count, unsigned short *chars) {
+    int ret;
+
+    NESTED_GC_OP_PROLOGUE(pGC);
+    ret = (*pGC->ops->PolyText16)(pDrawable, pGC, x, y, count, chars);
+    NESTED_GC_OP_EPILOGUE(pGC);
+    return ret;
+}
+
+static void
+NestedImageText8(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+                 int count, char *chars) {
+    NESTED_GC_OP_PROLOGUE(pGC);
+    (*pGC->ops->ImageText8)(pDrawable, pGC, x, y, count, chars);
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static void
+NestedImageText16(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+                  int count, unsigned short *chars) {
+    NESTED_GC_OP_PROLOGUE(pGC);
+    (*pGC->ops->ImageText16)(pDrawable, pGC, x, y, count, chars);
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static void
+NestedImageGlyphBlt(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+                    unsigned int nglyph, CharInfoPtr *ppci,
+                    void *pglyphBase) {
+    NESTED_GC_OP_PROLOGUE(pGC);
+    (*pGC->ops->ImageGlyphBlt)(pDrawable, pGC, x, y, nglyph,
+                               ppci, pglyphBase);
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static void
+NestedPolyGlyphBlt(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+                   unsigned int nglyph, CharInfoPtr *ppci,
+                   void *pglyphBase) {
+    NESTED_GC_OP_PROLOGUE(pGC);
+    (*pGC->ops->PolyGlyphBlt)(pDrawable, pGC, x, y, nglyph,
+                              ppci, pglyphBase);
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static void
+NestedPushPixels(GCPtr pGC, PixmapPtr pBitMap, DrawablePtr pDrawable,
+                 int dx, int dy, int xOrg, int yOrg) {
+    NESTED_GC_OP_PROLOGUE(pGC);
+    (*pGC->ops->PushPixels)(pGC, pBitMap, pDrawable, dx, dy, xOrg, yOrg);
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static const GCOps NestedGCOps = {
+    NestedFillSpans,
+    NestedSetSpans,
+    NestedPutImage,
+    NestedCopyArea,
+    NestedCopyPlane,
+    NestedPolyPoint,
+    NestedPolylines,
+    NestedPolySegment,
+    NestedPolyRectangle,
+    NestedPolyArc,
+    NestedFillPolygon,
+    NestedPolyFillRect,
+    NestedPolyFillArc,
+    NestedPolyText8,
+    NestedPolyText16,
+    NestedImageText8,
+    NestedImageText16,
+    NestedImageGlyphBlt,
+    NestedPolyGlyphBlt,
+    NestedPushPixels
+};
+
+/*
+ * Public functions
+ */
+
+/* Called from NestedScreenInit, after shadowSetup, so that our wrappers sit
+ * on top of damage's */
+Bool
+NestedAccelInit(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = NestedAccelGetPrivate(pScreen);
+
+    pNested->numCmds = 0;
+    pNested->accelDamage = NULL;
+    RegionNull(&pNested->dirty);
+    RegionNull(&pNested->replayed);
+
+    if (!pNested->accel)
+        return TRUE;
+
+    if (!dixRegisterPrivateKey(&NestedGCPrivateKeyRec, PRIVATE_GC,
+                               sizeof(NestedGCPrivRec)))
+        return FALSE;
+
+    pNested->cmds = calloc(NESTED_MAX_CMDS, sizeof(NestedCmdRec));
+    if (!pNested->cmds)
+        return FALSE;
+
+    pNested->CopyWindow = pScreen->CopyWindow;
+    pScreen->CopyWindow = NestedCopyWindow;
+
+    pNested->CreateGC = pScreen->CreateGC;
+    pScreen->CreateGC = NestedCreateGC;
+
+    return TRUE;
+}
+
+/* Called from NestedCreateScreenResources, once the screen pixmap exists */
+Bool
+NestedAccelCreateResources(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = NestedAccelGetPrivate(pScreen);
+
+    if (!pNested->accel)
+        return TRUE;
+
+    pNested->accelDamage = DamageCreate(NestedAccelDamageReport, NULL,
+                                        DamageReportRawRegion, TRUE,
+                                        pScreen, pNested);
+    if (!pNested->accelDamage)
+        return FALSE;
+
+    DamageRegister(&(*pScreen->GetScreenPixmap)(pScreen)->drawable,
+                   pNested->accelDamage);
+    return TRUE;
+}
+
+/* Replays the pending commands on the host and removes what they cover from
+ * pRegion, which is left with what still has to be uploaded */
+void
+NestedAccelReplay(ScreenPtr pScreen, RegionPtr pRegion) {
+    NestedPrivatePtr pNested = NestedAccelGetPrivate(pScreen);
+    NestedCmdPtr pCmd;
+    int i;
+
+    for (i = 0; i < pNested->numCmds; i++) {
+        pCmd = &pNested->cmds[i];
+
+        switch (pCmd->type) {
+        case NESTED_CMD_COPY:
+            NestedClientCopyArea(pNested->clientData,
+                                 RegionNumRects(&pCmd->region),
+                                 RegionRects(&pCmd->region),
+                                 pCmd->dx, pCmd->dy);
+            break;
+        case NESTED_CMD_FILL:
+            NestedClientFillRects(pNested->clientData,
+                                  RegionNumRects(&pCmd->region),
+                                  RegionRects(&pCmd->region),
+                                  pCmd->pixel);
+            break;
+        case NESTED_CMD_GLYPHS:
+            NestedClientCompositeGlyphs(pNested->clientData,
+                                        RegionNumRects(&pCmd->region),
+                                        RegionRects(&pCmd->region),
+                                        pCmd->color.red,
+                                        pCmd->color.green,
+                                        pCmd->color.blue,
+                                        pCmd->color.alpha,
+                                        pCmd->useMask,
+                                        pCmd->numGlyphs,
+                                        pCmd->glyphs);
+            break;
+        case NESTED_CMD_VIDEO:
+            NestedClientVideoShow(pNested->clientData,
+                                  RegionNumRects(&pCmd->region),
+                                  RegionRects(&pCmd->region),
+                                  pCmd->videoSrc.x, pCmd->videoSrc.y,
+                                  pCmd->videoSrc.width, pCmd->videoSrc.height,
+                                  pCmd->videoDst.x, pCmd->videoDst.y,
+                                  pCmd->videoDst.width, pCmd->videoDst.height);
+            break;
+        case NESTED_CMD_MOVE:
+        case NESTED_CMD_SHARED:
+            break;
+        }
+
+        NestedAccelFreeCmd(pCmd);
+    }
+
+    pNested->numCmds = 0;
+    NestedClientReleaseGlyphs(pNested->clientData);
+    RegionSubtract(pRegion, pRegion, &pNested->replayed);
+    RegionEmpty(&pNested->replayed);
+    RegionEmpty(&pNested->dirty);
+}
+
+/* Forgets the pending commands, whose areas will then be uploaded as pixels
+ * by a later update. The host still lags behind in dirty. */
+void
+NestedAccelDrop(ScreenPtr pScreen) {
+    NestedAccelDiscard(NestedAccelGetPrivate(pScreen));
+}
+
+/* Tells that the host doesn't have pRegion up to date, although it wasn't
+ * damaged since the last update */
+void
+NestedAccelMarkStale(ScreenPtr pScreen, RegionPtr pRegion) {
+    NestedPrivatePtr pNested = NestedAccelGetPrivate(pScreen);
+
+    if (pNested->accel)
+        RegionUnion(&pNested->dirty, &pNested->dirty, pRegion);
+}
+
+void
+NestedAccelClose(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = NestedAccelGetPrivate(pScreen);
+
+    if (pNested->accel) {
+        pScreen->CopyWindow = pNested->CopyWindow;
+        pScreen->CreateGC = pNested->CreateGC;
+
+        NestedAccelDiscard(pNested);
+        free(pNested->cmds);
+        pNested->cmds = NULL;
+    }
+
+    /* The damage itself goes away along with the screen pixmap */
+    pNested->accelDamage = NULL;
+    RegionUninit(&pNested->dirty);
+    RegionUninit(&pNested->replayed);
+}
@@ -0,0 +1,298 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Per-client upload attribution.
+ *
+ * With Option "ClientStats", the damage of the screen pixmap is reported
+ * to us as it happens, while the request of the client drawing is being
+ * processed, so it is counted for that client. The bytes uploaded in a
+ * frame are then shared among the clients that damaged the screen since
+ * the previous one, in proportion to the area each damaged. The clients
+ * that caused the most uploads are listed along with the statistics of
+ * stats.c.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <xorg-server.h>
+#include <damage.h>
+#include <dixstruct.h>
+#include <regionstr.h>
+#include <scrnintstr.h>
+#include <xf86.h>
+
+#include "compat-api.h"
+
+#include "driver.h"
+
+/* Clients listed */
+#define NESTED_ATTRIB_TOP 8
+
+typedef struct NestedAttribClient {
+    Bool          used;
+    Bool          inFrame;     /* listed in touched */
+    char          name[32];
+    unsigned long damaged;     /* pixels */
+    unsigned long frameDamage; /* since the last frame */
+    unsigned long uploaded;    /* bytes */
+} NestedAttribClientRec, *NestedAttribClientPtr;
+
+struct NestedAttrib {
+    DamagePtr             damage;
+    unsigned long         frameDamage; /* of all clients */
+    int                   touched[MAXCLIENTS]; /* damaged since */
+    int                   numTouched;
+    NestedAttribClientRec clients[MAXCLIENTS];
+};
+
+static inline NestedAttribPtr
+NestedAttribGet(ScreenPtr pScreen) {
+    return PNESTED(xf86ScreenToScrn(pScreen))->attrib;
+}
+
+static void
+NestedAttribReset(NestedAttribPtr pAttrib, ClientPtr client) {
+    NestedAttribClientPtr pClient = &pAttrib->clients[client->index];
+#if ABI_VIDEODRV_VERSION >= SET_ABI_VERSION(24, 0)
+    /* The server's client.h, included by dixstruct.h, declares it */
+    const char *name = client->index ? GetClientCmdName(client) : "server";
+#else
+    const char *name = client->index ? NULL : "server";
+#endif
+    int i;
+
+    /* The last client's damage isn't to be shared anymore */
+    if (pClient->inFrame) {
+        for (i = 0; i < pAttrib->numTouched; i++)
+            if (pAttrib->touched[i] == client->index) {
+                pAttrib->touched[i] =
+                    pAttrib->touched[--pAttrib->numTouched];
+                break;
+            }
+
+        pAttrib->frameDamage -= pClient->frameDamage;
+        pClient->inFrame = FALSE;
+    }
+
+    pClient->used = TRUE;
+    pClient->damaged = 0;
+    pClient->frameDamage = 0;
+    pClient->uploaded = 0;
+
+    if (name)
+        snprintf(pClient->name, sizeof(pClient->name), "%s", name);
+    else
+        snprintf(pClient->name, sizeof(pClient->name), "client%d",
+                 client->index);
+}
+
+static void
+NestedAttribDamageReport(DamagePtr pDamage, RegionPtr pRegion,
+                         void *closure) {
+    NestedAttribPtr pAttrib = NestedAttribGet(closure);
+    NestedAttribClientPtr pClient;
+    ClientPtr client;
+    BoxPtr pBox;
+    int nBox;
+    unsigned long area = 0;
+
+    if (!pAttrib)
+        return;
+
+#if ABI_VIDEODRV_VERSION >= SET_ABI_VERSION(24, 0)
+    client = GetCurrentClient();
+    if (!client)
+#endif
+        client = serverClient;
+
+    pBox = RegionRects(pRegion);
+    nBox = RegionNumRects(pRegion);
+
+    for (; nBox--; pBox++)
+        area += (pBox->x2 - pBox->x1) * (pBox->y2 - pBox->y1);
+
+    if (!area)
+        return;
+
+    pClient = &pAttrib->clients[client->index];
+    if (!pClient->used)
+        NestedAttribReset(pAttrib, client);
+
+    if (!pClient->inFrame) {
+        if (pAttrib->numTouched >= MAXCLIENTS)
+            return;
+
+        pAttrib->touched[pAttrib->numTouched++] = client->index;
+        pClient->inFrame = TRUE;
+    }
+
+    pClient->damaged += area;
+    pClient->frameDamage += area;
+    pAttrib->frameDamage += area;
+}
+
+/* A new client gets the counters of the last one with the same index */
+static void
+NestedAttribClientState(CallbackListPtr *pcbl, void *closure, void *data) {
+    NestedAttribPtr pAttrib = NestedAttribGet(closure);
+    ClientPtr client = ((NewClientInfoRec *)data)->client;
+
+    if (pAttrib && client->clientState == ClientStateRunning)
+        NestedAttribReset(pAttrib, client);
+}
+
+/* Called after each frame, with what was uploaded */
+void
+NestedAttribUpload(ScreenPtr pScreen, RegionPtr pRegion) {
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+    NestedAttribPtr pAttrib = PNESTED(pScrn)->attrib;
+    BoxPtr pBox = RegionRects(pRegion);
+    int nBox = RegionNumRects(pRegion);
+    unsigned long bytes = 0;
+    int i;
+
+    if (!pAttrib || !pAttrib->numTouched)
+        return;
+
+    for (; nBox--; pBox++)
+        bytes += (pBox->x2 - pBox->x1) * (pBox->y2 - pBox->y1);
+    bytes *= pScrn->bitsPerPixel / 8;
+
+    for (i = 0; i < pAttrib->numTouched; i++) {
+        NestedAttribClientPtr pClient =
+            &pAttrib->clients[pAttrib->touched[i]];
+
+        if (pAttrib->frameDamage)
+            pClient->uploaded += (double)bytes * pClient->frameDamage /
+                                 pAttrib->frameDamage;
+        pClient->frameDamage = 0;
+        pClient->inFrame = FALSE;
+    }
+
+    pAttrib->numTouched = 0;
+    pAttrib->frameDamage = 0;
+}
+
+/* Prints a "client" line for each of the clients that caused the most
+ * uploads: index, pixels damaged, bytes uploaded and name. Returns the
+ * length of the text. */
+int
+NestedAttribPrint(ScreenPtr pScreen, char *buf, size_t size) {
+    NestedAttribPtr pAttrib = NestedAttribGet(pScreen);
+    NestedAttribClientPtr top[NESTED_ATTRIB_TOP];
+    int numTop = 0, len = 0;
+    int i, j;
+
+    if (!pAttrib)
+        return 0;
+
+    for (i = 0; i < MAXCLIENTS; i++) {
+        NestedAttribClientPtr pClient = &pAttrib->clients[i];
+
+        if (!pClient->used || !pClient->damaged)
+            continue;
+
+        for (j = numTop; j > 0 &&
+             top[j - 1]->uploaded < pClient->uploaded; j--)
+            if (j < NESTED_ATTRIB_TOP)
+                top[j] = top[j - 1];
+
+        if (j < NESTED_ATTRIB_TOP) {
+            top[j] = pClient;
+            numTop = min(numTop + 1, NESTED_ATTRIB_TOP);
+        }
+    }
+
+    for (i = 0; i < numTop && (size_t)len < size; i++)
+        len += snprintf(buf + len, size - len, "client %d %lu %lu %s\n",
+                        (int)(top[i] - pAttrib->clients),
+                        top[i]->damaged, top[i]->uploaded, top[i]->name);
+
+    return min(len, (int)size - 1);
+}
+
+void
+NestedAttribInit(ScreenPtr pScreen) {
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+
+    pNested->attrib = NULL;
+
+    if (!pNested->clientStats)
+        return;
+
+#if ABI_VIDEODRV_VERSION < SET_ABI_VERSION(24, 0)
+    /* There is no telling which client is drawing */
+    xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+               "Option \"ClientStats\" needs xorg-server 1.20\n");
+    return;
+#endif
+
+    pNested->attrib = calloc(1, sizeof(struct NestedAttrib));
+    if (!pNested->attrib)
+        return;
+
+    if (!AddCallback(&ClientStateCallback, NestedAttribClientState,
+                     pScreen)) {
+        free(pNested->attrib);
+        pNested->attrib = NULL;
+    }
+}
+
+/* Damage has to be tracked on the screen pixmap, which exists by now */
+Bool
+NestedAttribCreateResources(ScreenPtr pScreen) {
+    NestedAttribPtr pAttrib = NestedAttribGet(pScreen);
+
+    if (!pAttrib)
+        return TRUE;
+
+    pAttrib->damage = DamageCreate(NestedAttribDamageReport, NULL,
+                                   DamageReportRawRegion, TRUE,
+                                   pScreen, pScreen);
+    if (!pAttrib->damage)
+        return FALSE;
+
+    DamageRegister(&(*pScreen->GetScreenPixmap)(pScreen)->drawable,
+                   pAttrib->damage);
+    return TRUE;
+}
+
+void
+NestedAttribClose(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+
+    if (!pNested->attrib)
+        return;
+
+    DeleteCallback(&ClientStateCallback, NestedAttribClientState, pScreen);
+
+    /* The damage itself goes away along with the screen pixmap, and
+     * doesn't look for the table anymore */
+    free(pNested->attrib);
+    pNested->attrib = NULL;
+}
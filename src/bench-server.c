@@ -0,0 +1,83 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * What the client backends need from the X server, for the tools running
+ * them standalone (bench.c, replay.c). Messages of the backends are only
+ * shown when benchVerbose is set.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <xorg-server.h>
+#include <xf86.h>
+#include <xf86Priv.h>
+#include <regionstr.h>
+
+Bool benchVerbose = FALSE;
+
+/* Names host windows get */
+static char benchDisplay[] = "bench";
+char *display = benchDisplay;
+const char *xf86ServerName = "nested-bench";
+
+BoxRec RegionEmptyBox = { 0, 0, 0, 0 };
+RegDataRec RegionEmptyData = { 0, 0 };
+RegDataRec RegionBrokenData = { 0, 0 };
+
+Bool
+RegionInitBoxes(RegionPtr pReg, BoxPtr boxes, int nBoxes) {
+    return pixman_region_init_rects(pReg, boxes, nBoxes);
+}
+
+void
+xf86DrvMsg(int scrnIndex, MessageType type, const char *format, ...) {
+    va_list args;
+
+    if (!benchVerbose)
+        return;
+
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+CARD64
+GetTimeInMicros(void) {
+    struct timespec tp;
+
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return (CARD64)tp.tv_sec * 1000000 + tp.tv_nsec / 1000;
+}
+
+void
+CloseWellKnownConnections(void) {
+}
+
+void
+OsCleanup(Bool terminating) {
+}
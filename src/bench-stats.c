@@ -0,0 +1,64 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Latency statistics of the benchmark tools (see bench-stats.h). Only
+ * needs the C library, as nested-latency doesn't link the X server bits.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench-stats.h"
+
+static int
+BenchCompare(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+void
+BenchPrintLatency(uint64_t *samples, int numSamples) {
+    uint64_t total = 0;
+    int i;
+
+    if (numSamples <= 0)
+        return;
+
+    qsort(samples, numSamples, sizeof(uint64_t), BenchCompare);
+
+    for (i = 0; i < numSamples; i++)
+        total += samples[i];
+
+    printf("latency ms: min %.2f avg %.2f p50 %.2f p90 %.2f p99 %.2f "
+           "max %.2f",
+           samples[0] / 1000.0,
+           total / 1000.0 / numSamples,
+           samples[numSamples / 2] / 1000.0,
+           samples[numSamples * 9 / 10] / 1000.0,
+           samples[numSamples * 99 / 100] / 1000.0,
+           samples[numSamples - 1] / 1000.0);
+}
@@ -0,0 +1,339 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Upload benchmark.
+ *
+ * Built by "make bench", nested-bench links the configured client backend
+ * without the X server around it, and drives it with synthetic workloads
+ * against a host display, e.g.:
+ *
+ *     Xvfb :99 -screen 0 1280x1024x24 &
+ *     DISPLAY=:99 ./nested-bench
+ *
+ * Starting Xvfb with "-extension MIT-SHM" measures uploads through
+ * PutImage instead. The other backend is measured by configuring with it.
+ * Each frame is painted into the framebuffer, then uploaded, flushed and
+ * waited for; its latency is the time from the first upload to the host
+ * having gone through it. Painting is not timed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <xorg-server.h>
+#include <xf86.h>
+
+#include "bench-stats.h"
+#include "client.h"
+
+extern Bool benchVerbose;
+
+#define BENCH_MAX_BOXES 256
+
+typedef struct _Bench {
+    NestedClientPrivatePtr client;
+    char                  *fb;
+    int                    width;
+    int                    height;
+    int                    stride;
+} Bench, *BenchPtr;
+
+/* A workload gives the boxes changed in a frame. Scrolling workloads have
+ * the rest of the screen moved up by scroll pixels first. */
+typedef struct _BenchWorkload {
+    const char *name;
+    int       (*boxes)(BenchPtr pBench, int frame, BoxPtr pBox);
+    int         scroll;
+    Bool        repeats;  /* alternates between two contents */
+    Bool        uncached; /* not expected to be seen again */
+} BenchWorkload;
+
+/*
+ * Workloads
+ */
+
+static int
+BenchFullscreen(BenchPtr pBench, int frame, BoxPtr pBox) {
+    pBox->x1 = 0;
+    pBox->y1 = 0;
+    pBox->x2 = pBench->width;
+    pBox->y2 = pBench->height;
+    return 1;
+}
+
+/* A terminal scrolling by a line of text */
+static int
+BenchScroll(BenchPtr pBench, int frame, BoxPtr pBox) {
+    pBox->x1 = 0;
+    pBox->y1 = pBench->height - 16;
+    pBox->x2 = pBench->width;
+    pBox->y2 = pBench->height;
+    return 1;
+}
+
+/* Glyph-sized rectangles all over the screen */
+static int
+BenchTiny(BenchPtr pBench, int frame, BoxPtr pBox) {
+    unsigned int seed = frame * 2654435761u;
+    int i;
+
+    for (i = 0; i < BENCH_MAX_BOXES; i++) {
+        seed = seed * 1103515245 + 12345;
+        pBox[i].x1 = (seed >> 8) % (pBench->width - 8);
+        seed = seed * 1103515245 + 12345;
+        pBox[i].y1 = (seed >> 8) % (pBench->height - 16);
+        pBox[i].x2 = pBox[i].x1 + 8;
+        pBox[i].y2 = pBox[i].y1 + 16;
+    }
+
+    return BENCH_MAX_BOXES;
+}
+
+/* A text cursor blinking */
+static int
+BenchCursor(BenchPtr pBench, int frame, BoxPtr pBox) {
+    pBox->x1 = pBench->width / 2;
+    pBox->y1 = pBench->height / 2;
+    pBox->x2 = pBox->x1 + 2;
+    pBox->y2 = pBox->y1 + 16;
+    return 1;
+}
+
+/* A 640x360 video playing in the middle */
+static int
+BenchVideo(BenchPtr pBench, int frame, BoxPtr pBox) {
+    pBox->x1 = max(0, (pBench->width - 640) / 2);
+    pBox->y1 = max(0, (pBench->height - 360) / 2);
+    pBox->x2 = min(pBench->width, pBox->x1 + 640);
+    pBox->y2 = min(pBench->height, pBox->y1 + 360);
+    return 1;
+}
+
+static const BenchWorkload workloads[] = {
+    { "fullscreen", BenchFullscreen, 0,  FALSE, FALSE },
+    { "scroll",     BenchScroll,     16, FALSE, FALSE },
+    { "tiny",       BenchTiny,       0,  FALSE, FALSE },
+    { "cursor",     BenchCursor,     0,  TRUE,  FALSE },
+    { "video",      BenchVideo,      0,  FALSE, TRUE  },
+};
+
+/*
+ * Running them
+ */
+
+static void
+BenchPaint(BenchPtr pBench, BoxPtr pBox, int value) {
+    int bpp = pBench->stride / pBench->width;
+    int y;
+
+    for (y = pBox->y1; y < pBox->y2; y++)
+        memset(pBench->fb + y * pBench->stride + pBox->x1 * bpp,
+               (value + y) & 0xff, (pBox->x2 - pBox->x1) * bpp);
+}
+
+static void
+BenchRun(BenchPtr pBench, const BenchWorkload *pWork, int numFrames) {
+    BoxRec boxes[BENCH_MAX_BOXES];
+    NestedClientStats before, after;
+    uint64_t *latency;
+    CARD64 total = 0;
+    unsigned long rects = 0, bytes = 0;
+    int bpp = pBench->stride / pBench->width;
+    int frame, i;
+
+    latency = calloc(numFrames, sizeof(uint64_t));
+    if (!latency)
+        return;
+
+    NestedClientGetStats(pBench->client, &before);
+
+    for (frame = 0; frame < numFrames; frame++) {
+        int nBox = pWork->boxes(pBench, frame, boxes);
+        int value = pWork->repeats ? (frame & 1) * 0x55 : frame;
+        CARD64 start;
+
+        if (pWork->scroll)
+            memmove(pBench->fb, pBench->fb + pWork->scroll * pBench->stride,
+                    (pBench->height - pWork->scroll) * pBench->stride);
+
+        for (i = 0; i < nBox; i++)
+            BenchPaint(pBench, &boxes[i], value);
+
+        start = GetTimeInMicros();
+
+        if (pWork->scroll) {
+            BoxRec moved = { 0, 0, pBench->width,
+                             pBench->height - pWork->scroll };
+
+            NestedClientCopyArea(pBench->client, 1, &moved,
+                                 0, pWork->scroll);
+        }
+
+        for (i = 0; i < nBox; i++) {
+            if (pWork->uncached)
+                NestedClientUpdateScreenUncached(pBench->client,
+                                                 boxes[i].x1, boxes[i].y1,
+                                                 boxes[i].x2, boxes[i].y2);
+            else
+                NestedClientUpdateScreen(pBench->client,
+                                         boxes[i].x1, boxes[i].y1,
+                                         boxes[i].x2, boxes[i].y2);
+
+            bytes += (boxes[i].x2 - boxes[i].x1) *
+                     (boxes[i].y2 - boxes[i].y1) * bpp;
+        }
+
+        NestedClientFlush(pBench->client);
+        NestedClientSync(pBench->client);
+
+        latency[frame] = GetTimeInMicros() - start;
+        total += latency[frame];
+        rects += nBox;
+
+        /* Expose and GraphicsExpose are handled as in the server */
+        NestedClientCheckEvents(pBench->client);
+    }
+
+    NestedClientGetStats(pBench->client, &after);
+
+    if (total == 0)
+        total = 1;
+
+    printf("%-10s %9.0f uploads/s %9.1f MB/s  ",
+           pWork->name,
+           rects * 1e6 / total,
+           bytes / (double)total);
+    BenchPrintLatency(latency, numFrames);
+    printf("  (%s)\n",
+           after.shmRects > before.shmRects ? "shm" :
+           after.putRects > before.putRects ? "put" : "cached");
+
+    free(latency);
+}
+
+static void
+BenchUsage(const char *name) {
+    size_t i;
+
+    fprintf(stderr,
+            "usage: %s [-s WIDTHxHEIGHT] [-n FRAMES] [-c TILES] [-v] "
+            "[WORKLOAD...]\n"
+            "  -s  screen size (default: 1024x768)\n"
+            "  -n  frames per workload (default: 200)\n"
+            "  -c  tile cache size, 0 disables it (default: 1024)\n"
+            "  -v  show the backend's messages\n"
+            "workloads:",
+            name);
+
+    for (i = 0; i < ARRAY_SIZE(workloads); i++)
+        fprintf(stderr, " %s", workloads[i].name);
+
+    fprintf(stderr, " (default: all)\n");
+    exit(1);
+}
+
+int
+main(int argc, char **argv) {
+    Bench bench;
+    Output output = { NULL, 0, 0, 0, 0 };
+    Pixel red, green, blue;
+    int numFrames = 200, tiles = 1024;
+    int opt, i;
+    size_t j;
+
+    bench.width = 1024;
+    bench.height = 768;
+
+    while ((opt = getopt(argc, argv, "s:n:c:v")) != -1) {
+        switch (opt) {
+        case 's':
+            if (sscanf(optarg, "%dx%d", &bench.width, &bench.height) != 2 ||
+                bench.width < 640 || bench.height < 360)
+                BenchUsage(argv[0]);
+            break;
+        case 'n':
+            numFrames = atoi(optarg);
+            if (numFrames <= 0)
+                BenchUsage(argv[0]);
+            break;
+        case 'c':
+            tiles = atoi(optarg);
+            break;
+        case 'v':
+            benchVerbose = TRUE;
+            break;
+        default:
+            BenchUsage(argv[0]);
+        }
+    }
+
+    for (i = optind; i < argc; i++) {
+        for (j = 0; j < ARRAY_SIZE(workloads); j++)
+            if (!strcmp(argv[i], workloads[j].name))
+                break;
+
+        if (j == ARRAY_SIZE(workloads))
+            BenchUsage(argv[0]);
+    }
+
+    output.width = bench.width;
+    output.height = bench.height;
+
+    bench.client = NestedClientCreateScreen(0, FALSE, FALSE, FALSE,
+                                            bench.width, bench.height,
+                                            1, &output, 24, 32,
+                                            &red, &green, &blue);
+    if (!bench.client) {
+        fprintf(stderr, "Can't open display: %s\n", getenv("DISPLAY"));
+        return 1;
+    }
+
+    bench.fb = NestedClientGetFrameBuffer(bench.client);
+    bench.stride = bench.width * 4;
+    NestedClientSetTileCacheSize(bench.client, tiles);
+
+    /* Uploads are only measured once the window can be seen */
+    for (i = 0; i < 1000 && !NestedClientIsVisible(bench.client); i++) {
+        NestedClientCheckEvents(bench.client);
+        usleep(1000);
+    }
+
+    for (j = 0; j < ARRAY_SIZE(workloads); j++) {
+        Bool selected = optind == argc;
+
+        for (i = optind; i < argc; i++)
+            if (!strcmp(argv[i], workloads[j].name))
+                selected = TRUE;
+
+        if (selected)
+            BenchRun(&bench, &workloads[j], numFrames);
+    }
+
+    NestedClientCloseScreen(bench.client);
+    return 0;
+}
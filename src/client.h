@@ -32,10 +32,19 @@
 
 #include <colormap.h>
 #include <misc.h>
+#include <miscstruct.h>
 
 struct NestedClientPrivate;
 typedef struct NestedClientPrivate *NestedClientPrivatePtr;
 
+/* A glyph of NestedClientCompositeGlyphs(), drawn at (dx, dy) from the
+ * position the previous one advanced to */
+typedef struct _NestedGlyph {
+    uint32_t id;
+    int16_t dx;
+    int16_t dy;
+} NestedGlyph, *NestedGlyphPtr;
+
 typedef struct _Output {
     const char *name;
     int x;
@@ -44,21 +53,112 @@ typedef struct _Output {
     int height;
 } Output, *OutputPtr;
 
+/* Durations are counted in buckets of doubling width: under 250 us, under
+ * 500 us, under 1 ms, ..., under 32 ms, and above */
+#define NESTED_STATS_BUCKETS 9
+
+static inline int
+NestedStatsBucket(CARD64 us) {
+    int i;
+
+    for (i = 0; i < NESTED_STATS_BUCKETS - 1; i++)
+        if (us < (CARD64)250 << i)
+            break;
+
+    return i;
+}
+
+/* What a client sent to the host so far */
+typedef struct _NestedClientStats {
+    unsigned long putRects;   /* uploaded with PutImage */
+    unsigned long putBytes;
+    unsigned long shmRects;   /* uploaded from MIT-SHM segments */
+    unsigned long shmBytes;
+    unsigned long exposes;    /* rectangles repainted on Expose */
+    unsigned long flushes;
+    unsigned long flushTime;  /* us */
+    unsigned long latency[NESTED_STATS_BUCKETS]; /* flush to host fence */
+} NestedClientStats, *NestedClientStatsPtr;
+
 Bool NestedClientCheckDisplay(int scrnIndex, OutputPtr output);
 
 Bool NestedClientValidDepth(int depth);
 
-NestedClientPrivatePtr NestedClientCreateScreen(int    scrnIndex,
-                                                Bool   wantFullscreenHint,
-                                                int    width,
-                                                int    height,
-                                                int    originX,
-                                                int    originY,
-                                                int    depth,
-                                                int    bitsPerPixel,
-                                                Pixel *retRedMask,
-                                                Pixel *retGreenMask,
-                                                Pixel *retBlueMask);
+/* Creates a host window at each output, showing the part of the
+ * framebuffer at the output's offset from the top-left corner of all of
+ * them. When rootless, the outputs only give where the framebuffer would
+ * be on the host, and windows are added with NestedClientAddWindow(). */
+NestedClientPrivatePtr NestedClientCreateScreen(int           scrnIndex,
+                                                Bool          wantFullscreenHint,
+                                                Bool          rootless,
+                                                Bool          lowLatency,
+                                                int           width,
+                                                int           height,
+                                                int           numOutputs,
+                                                const Output *outputs,
+                                                int           depth,
+                                                int           bitsPerPixel,
+                                                Pixel        *retRedMask,
+                                                Pixel        *retGreenMask,
+                                                Pixel        *retBlueMask);
+
+/* Opens a window on another host display showing the framebuffer of
+ * primary, which must be closed after it. Only uploads (and fills) are
+ * meant to be sent to a mirror; losing its display doesn't end the
+ * server. */
+NestedClientPrivatePtr NestedClientCreateMirror(NestedClientPrivatePtr primary,
+                                                const char            *displayName,
+                                                Bool                   wantFullscreenHint);
+
+/* Rootless mode: a host window showing the part of the framebuffer under
+ * a nested top-level window. Returns its id, or 0 if not rootless. */
+uint32_t NestedClientAddWindow(NestedClientPrivatePtr pPriv,
+                               int                    x,
+                               int                    y,
+                               int                    width,
+                               int                    height);
+
+/* Moves or resizes a window; its contents move along on the host */
+void NestedClientConfigureWindow(NestedClientPrivatePtr pPriv,
+                                 uint32_t               id,
+                                 int                    x,
+                                 int                    y,
+                                 int                    width,
+                                 int                    height);
+
+/* Stacks a window right below another one, or on top if above is 0 */
+void NestedClientRestackWindow(NestedClientPrivatePtr pPriv,
+                               uint32_t               id,
+                               uint32_t               above);
+
+void NestedClientRemoveWindow(NestedClientPrivatePtr pPriv, uint32_t id);
+
+/* Has the client tell when the host has gone through what was flushed to
+ * it. Mirrors and clients doing coarse uploads always do. */
+void NestedClientSetPaced(NestedClientPrivatePtr pPriv);
+
+/* Whether a paced client has gone through everything flushed to it, so
+ * more can be sent without piling up behind a slow host */
+Bool NestedClientIsReady(NestedClientPrivatePtr pPriv);
+
+/* Debugging aids, drawn over the framebuffer on the host until uploaded
+ * over: outlines of boxes, and a line of text at the top-left corner of
+ * the screen. NestedClientDrawText() returns the box covered by the text,
+ * if it could be drawn. */
+void NestedClientOutlineBoxes(NestedClientPrivatePtr pPriv,
+                              int nBox,
+                              BoxPtr pBox);
+
+Bool NestedClientDrawText(NestedClientPrivatePtr pPriv,
+                          const char *text,
+                          BoxPtr pBox);
+
+/* Sends a request the host answers once it has gone through everything
+ * sent before, and returns what to give NestedClientFenceDone() to know
+ * when it did */
+unsigned int NestedClientFence(NestedClientPrivatePtr pPriv);
+
+Bool NestedClientFenceDone(NestedClientPrivatePtr pPriv, unsigned int fence);
 
 char *NestedClientGetFrameBuffer(NestedClientPrivatePtr pPriv);
 
@@ -68,8 +168,151 @@ void NestedClientUpdateScreen(NestedClientPrivatePtr pPriv,
                               int16_t x2,
                               int16_t y2);
 
+/* Same, for content that isn't expected to be seen again, which would
+ * only push useful tiles out of the tile cache */
+void NestedClientUpdateScreenUncached(NestedClientPrivatePtr pPriv,
+                                      int16_t x1,
+                                      int16_t y1,
+                                      int16_t x2,
+                                      int16_t y2);
+
+/* Progressive uploads. NestedClientCoarseInit() tells whether the host
+ * can be sent a rectangle downscaled, which it scales back up; the full
+ * resolution is to be uploaded later. */
+Bool NestedClientCoarseInit(NestedClientPrivatePtr pPriv);
+
+void NestedClientUpdateScreenCoarse(NestedClientPrivatePtr pPriv,
+                                    int16_t x1,
+                                    int16_t y1,
+                                    int16_t x2,
+                                    int16_t y2);
+
+/* Copies, on the host window, each box from its position + (dx, dy) */
+void NestedClientCopyArea(NestedClientPrivatePtr pPriv,
+                          int nBox,
+                          BoxPtr pBox,
+                          int dx,
+                          int dy);
+
+/* Fills each box on the host window with a pixel value */
+void NestedClientFillRects(NestedClientPrivatePtr pPriv,
+                           int nBox,
+                           BoxPtr pBox,
+                           Pixel pixel);
+
+/* Puts an image of the framebuffer at (x, y) that the host reads straight
+ * from a nested client's shared memory segment. Returns FALSE if the host
+ * can't, in which case nothing was sent. The segment must not change until
+ * NestedClientSync() has returned. */
+Bool NestedClientPutSharedImage(NestedClientPrivatePtr pPriv,
+                                int shmid,
+                                uint32_t offset,
+                                int stride,
+                                int16_t x,
+                                int16_t y,
+                                uint16_t width,
+                                uint16_t height);
+
+/* Waits until the host has gone through everything sent to it */
+void NestedClientSync(NestedClientPrivatePtr pPriv);
+
+/* Host Render support. NestedClientRenderInit() tells whether the rest can
+ * be used. */
+Bool NestedClientRenderInit(NestedClientPrivatePtr pPriv);
+
+/* Uploads an a8 glyph, returning its host id or 0 on failure */
+uint32_t NestedClientAddGlyph(NestedClientPrivatePtr pPriv,
+                              uint16_t width,
+                              uint16_t height,
+                              int16_t x,
+                              int16_t y,
+                              int16_t xOff,
+                              int16_t yOff,
+                              const uint8_t *data,
+                              int stride);
+
+/* Glyphs freed are only freed on the host by NestedClientReleaseGlyphs(),
+ * once no recorded command can use them anymore */
+void NestedClientFreeGlyph(NestedClientPrivatePtr pPriv, uint32_t id);
+
+void NestedClientReleaseGlyphs(NestedClientPrivatePtr pPriv);
+
+/* Composites glyphs with PictOpOver and a solid color on the host window,
+ * clipped to the boxes. The first glyph is positioned relative to the
+ * window origin. */
+void NestedClientCompositeGlyphs(NestedClientPrivatePtr pPriv,
+                                 int nBox,
+                                 BoxPtr pBox,
+                                 uint16_t red,
+                                 uint16_t green,
+                                 uint16_t blue,
+                                 uint16_t alpha,
+                                 Bool useMask,
+                                 int nGlyphs,
+                                 NestedGlyphPtr pGlyphs);
+
+/* Host XVideo support. A frame is given to the client as soon as it is
+ * available, and shown by NestedClientVideoShow(), clipped to the boxes,
+ * when the commands are replayed. Planes are in the order of the FOURCC. */
+Bool NestedClientVideoInit(NestedClientPrivatePtr pPriv);
+
+Bool NestedClientVideoHasFormat(NestedClientPrivatePtr pPriv, int id);
+
+Bool NestedClientVideoPutFrame(NestedClientPrivatePtr pPriv,
+                               int id,
+                               int width,
+                               int height,
+                               const uint8_t **planes,
+                               const int *pitches);
+
+void NestedClientVideoShow(NestedClientPrivatePtr pPriv,
+                           int nBox,
+                           BoxPtr pBox,
+                           int16_t srcX,
+                           int16_t srcY,
+                           uint16_t srcWidth,
+                           uint16_t srcHeight,
+                           int16_t dstX,
+                           int16_t dstY,
+                           uint16_t dstWidth,
+                           uint16_t dstHeight);
+
+void NestedClientVideoStop(NestedClientPrivatePtr pPriv);
+
+void NestedClientFlush(NestedClientPrivatePtr pPriv);
+
+/* Keeps up to numTiles previously uploaded tiles on the host, so repeated
+ * content is copied there instead of uploaded again. 0 disables it. */
+void NestedClientSetTileCacheSize(NestedClientPrivatePtr pPriv,
+                                  int numTiles);
+
+void NestedClientGetTileCacheStats(NestedClientPrivatePtr pPriv,
+                                   unsigned long *hits,
+                                   unsigned long *misses);
+
+/* How long the host took to go through flushed frames, in microseconds,
+ * for paced clients */
+void NestedClientGetLatencyStats(NestedClientPrivatePtr pPriv,
+                                 unsigned long *frames,
+                                 unsigned long *average,
+                                 unsigned long *maximum);
+
+void NestedClientGetStats(NestedClientPrivatePtr pPriv,
+                          NestedClientStatsPtr pStats);
+
 void NestedClientHideCursor(NestedClientPrivatePtr pPriv);
 
+/* Whether anything put on the host window can be seen: it is mapped, not
+ * fully obscured and not hidden (minimized) by the window manager */
+Bool NestedClientIsVisible(NestedClientPrivatePtr pPriv);
+
+/* Reports the parts of the host window covered by other host windows, in
+ * window coordinates. Returns FALSE if they didn't change since the last
+ * call. The boxes belong to the client. */
+Bool NestedClientGetOcclusion(NestedClientPrivatePtr pPriv,
+                              int *nBox,
+                              BoxPtr *ppBox);
+
 void NestedClientCheckEvents(NestedClientPrivatePtr pPriv);
 
 void NestedClientCloseScreen(NestedClientPrivatePtr pPriv);
@@ -0,0 +1,209 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Debugging aids.
+ *
+ * With Option "DebugDamage", each rectangle uploaded is outlined in red on
+ * the host for a moment, then uploaded again to erase the outline. With
+ * Option "DebugHUD", a line at the top-left corner of the host window
+ * shows uploads per second, bandwidth and rectangles per frame, drawn
+ * again after each frame as uploads cover it. Both are only drawn on the
+ * host, so host-side copies must not read from them.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+
+#include <xorg-server.h>
+#include <regionstr.h>
+#include <scrnintstr.h>
+#include <xf86.h>
+
+#include "compat-api.h"
+
+#include "driver.h"
+
+/* How long outlines are shown */
+#define NESTED_DEBUG_OUTLINE_MS 100
+
+/* How often the HUD is recomputed */
+#define NESTED_DEBUG_HUD_MS 1000
+
+static void
+NestedDebugDrawHud(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+    RegionRec box;
+
+    if (!pNested->hudText[0] ||
+        !NestedClientDrawText(pNested->clientData, pNested->hudText,
+                              &pNested->hudBox))
+        return;
+
+    RegionInit(&box, &pNested->hudBox, 1);
+    NestedAccelMarkStale(pScreen, &box);
+    RegionUninit(&box);
+}
+
+/* Recomputes the HUD from the counters of stats.c */
+static void
+NestedDebugUpdateHud(ScreenPtr pScreen, CARD32 now) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+    NestedClientStats stats;
+    unsigned long bytes, frames, rects;
+    double seconds = (now - pNested->hudTime) / 1000.0;
+
+    NestedClientGetStats(pNested->clientData, &stats);
+    bytes = stats.putBytes + stats.shmBytes;
+    frames = pNested->statsFrames - pNested->hudFrames;
+    rects = pNested->statsRects - pNested->hudRects;
+
+    snprintf(pNested->hudText, sizeof(pNested->hudText),
+             " %.1f fps  %.2f MB/s  %.1f rects/frame ",
+             frames / seconds,
+             (bytes - pNested->hudBytes) / seconds / (1024 * 1024),
+             frames ? (double)rects / frames : 0.0);
+
+    pNested->hudTime = now;
+    pNested->hudFrames = pNested->statsFrames;
+    pNested->hudRects = pNested->statsRects;
+    pNested->hudBytes = bytes;
+}
+
+/* Called after each frame was uploaded, with what was */
+void
+NestedDebugUpload(ScreenPtr pScreen, RegionPtr pRegion) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+    BoxPtr pBox = RegionRects(pRegion);
+    int nBox = RegionNumRects(pRegion);
+    RegionRec edge;
+    BoxRec box;
+
+    if (pNested->debugDamage && nBox > 0) {
+        NestedClientOutlineBoxes(pNested->clientData, nBox, pBox);
+
+        if (!RegionNotEmpty(&pNested->outlines))
+            pNested->outlineTime = GetTimeInMillis();
+
+        /* Only the edges have to be erased */
+        for (; nBox--; pBox++) {
+            box = *pBox;
+            box.y2 = box.y1 + 1;
+            RegionInit(&edge, &box, 1);
+            RegionUnion(&pNested->outlines, &pNested->outlines, &edge);
+            RegionUninit(&edge);
+
+            box = *pBox;
+            box.y1 = box.y2 - 1;
+            RegionInit(&edge, &box, 1);
+            RegionUnion(&pNested->outlines, &pNested->outlines, &edge);
+            RegionUninit(&edge);
+
+            box = *pBox;
+            box.x2 = box.x1 + 1;
+            RegionInit(&edge, &box, 1);
+            RegionUnion(&pNested->outlines, &pNested->outlines, &edge);
+            RegionUninit(&edge);
+
+            box = *pBox;
+            box.x1 = box.x2 - 1;
+            RegionInit(&edge, &box, 1);
+            RegionUnion(&pNested->outlines, &pNested->outlines, &edge);
+            RegionUninit(&edge);
+        }
+
+        NestedAccelMarkStale(pScreen, &pNested->outlines);
+    }
+
+    if (pNested->debugHud)
+        NestedDebugDrawHud(pScreen);
+}
+
+/* Called from the block handler. Erases outlines and recomputes the HUD
+ * when it's time, and returns in how many milliseconds to come back, or
+ * -1. */
+int
+NestedDebugCheck(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+    CARD32 now = GetTimeInMillis();
+    int delay = -1, left;
+    Bool drawn = FALSE;
+
+    if (RegionNotEmpty(&pNested->outlines)) {
+        left = NESTED_DEBUG_OUTLINE_MS - (int)(now - pNested->outlineTime);
+
+        if (left <= 0) {
+            BoxPtr pBox = RegionRects(&pNested->outlines);
+            int nBox = RegionNumRects(&pNested->outlines);
+
+            for (; nBox--; pBox++)
+                NestedClientUpdateScreenUncached(pNested->clientData,
+                                                 pBox->x1, pBox->y1,
+                                                 pBox->x2, pBox->y2);
+
+            RegionEmpty(&pNested->outlines);
+            drawn = TRUE;
+        } else
+            delay = left;
+    }
+
+    if (pNested->debugHud) {
+        left = NESTED_DEBUG_HUD_MS - (int)(now - pNested->hudTime);
+
+        if (left <= 0) {
+            NestedDebugUpdateHud(pScreen, now);
+            left = NESTED_DEBUG_HUD_MS;
+            drawn = TRUE;
+        }
+
+        if (drawn)
+            NestedDebugDrawHud(pScreen);
+
+        delay = delay < 0 ? left : min(delay, left);
+    }
+
+    if (drawn)
+        NestedClientFlush(pNested->clientData);
+
+    return delay;
+}
+
+void
+NestedDebugInit(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+
+    RegionNull(&pNested->outlines);
+    pNested->hudText[0] = '\0';
+    pNested->hudTime = GetTimeInMillis();
+    pNested->hudFrames = 0;
+    pNested->hudRects = 0;
+    pNested->hudBytes = 0;
+}
+
+void
+NestedDebugClose(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+
+    RegionUninit(&pNested->outlines);
+}
@@ -38,6 +38,7 @@
 #endif
 
 #include <xorg-server.h>
+#include <X11/extensions/dpmsconst.h>
 #include <fb.h>
 #include <micmap.h>
 #include <mipointer.h>
@@ -48,7 +49,8 @@
 
 #include "compat-api.h"
 
-#include "client.h"
+#include "driver.h"
+#include "probes.h"
 
 #define NESTED_VERSION 0
 #define NESTED_NAME "NESTED"
@@ -60,6 +62,14 @@
 
 #define TIMER_CALLBACK_INTERVAL 20
 
+#define DEFAULT_TILE_CACHE_SIZE 1024
+
+/* How often mirrors that are behind are checked on */
+#define NESTED_MIRROR_RETRY_MS 20
+
+/* and how often the refinement of coarse uploads goes on */
+#define NESTED_REFINE_RETRY_MS 20
+
 static MODULESETUPPROTO(NestedSetup);
 static void NestedIdentify(int flags);
 static const OptionInfoRec *NestedAvailableOptions(int chipid, int busid);
@@ -79,6 +89,7 @@ static ModeStatus NestedValidMode(SCRN_ARG_TYPE arg, DisplayModePtr mode,
                                   Bool verbose, int flags);
 
 static Bool NestedSaveScreen(ScreenPtr pScreen, int mode);
+static void NestedDPMSSet(ScrnInfoPtr pScrn, int mode, int flags);
 static Bool NestedCreateScreenResources(ScreenPtr pScreen);
 
 static void NestedShadowUpdate(ScreenPtr pScreen, shadowBufPtr pBuf);
@@ -94,7 +105,27 @@ typedef enum {
     OPTION_XAUTHORITY,
     OPTION_ORIGIN,
     OPTION_FULLSCREEN,
-    OPTION_OUTPUT
+    OPTION_OUTPUT,
+    OPTION_ACCEL,
+    OPTION_TILE_CACHE_SIZE,
+    OPTION_RENDER_ACCEL,
+    OPTION_XVIDEO,
+    OPTION_CLIP_TO_VISIBLE,
+    OPTION_ROOTLESS,
+    OPTION_SHM_PASSTHROUGH,
+    OPTION_FRAME_SYNC,
+    OPTION_FRAME_HOLD_OFF,
+    OPTION_HOT_TILE_INTERVAL,
+    OPTION_PROGRESSIVE,
+    OPTION_UPLOAD_BUDGET,
+    OPTION_LOW_LATENCY,
+    OPTION_STATS_INTERVAL,
+    OPTION_STATS_FILE,
+    OPTION_TRACE_FILE,
+    OPTION_DEBUG_DAMAGE,
+    OPTION_DEBUG_HUD,
+    OPTION_CLIENT_STATS,
+    OPTION_RECORD_FILE
 } NestedOpts;
 
 typedef enum {
@@ -115,6 +146,26 @@ static OptionInfoRec NestedOptions[] = {
     { OPTION_ORIGIN,     "Origin",     OPTV_STRING,  {0}, FALSE },
     { OPTION_FULLSCREEN, "Fullscreen", OPTV_BOOLEAN, {0}, FALSE },
     { OPTION_OUTPUT,     "Output",     OPTV_STRING,  {0}, FALSE },
+    { OPTION_ACCEL,      "Accel",      OPTV_BOOLEAN, {0}, FALSE },
+    { OPTION_TILE_CACHE_SIZE, "TileCacheSize", OPTV_INTEGER, {0}, FALSE },
+    { OPTION_RENDER_ACCEL, "RenderAccel", OPTV_BOOLEAN, {0}, FALSE },
+    { OPTION_XVIDEO,     "XVideo",     OPTV_BOOLEAN, {0}, FALSE },
+    { OPTION_CLIP_TO_VISIBLE, "ClipToVisible", OPTV_BOOLEAN, {0}, FALSE },
+    { OPTION_ROOTLESS,   "Rootless",   OPTV_BOOLEAN, {0}, FALSE },
+    { OPTION_SHM_PASSTHROUGH, "ShmPassthrough", OPTV_BOOLEAN, {0}, FALSE },
+    { OPTION_FRAME_SYNC, "FrameSync",  OPTV_BOOLEAN, {0}, FALSE },
+    { OPTION_FRAME_HOLD_OFF, "FrameHoldOff", OPTV_INTEGER, {0}, FALSE },
+    { OPTION_HOT_TILE_INTERVAL, "HotTileInterval", OPTV_INTEGER, {0}, FALSE },
+    { OPTION_PROGRESSIVE, "Progressive", OPTV_BOOLEAN, {0}, FALSE },
+    { OPTION_UPLOAD_BUDGET, "UploadBudget", OPTV_INTEGER, {0}, FALSE },
+    { OPTION_LOW_LATENCY, "LowLatency", OPTV_BOOLEAN, {0}, FALSE },
+    { OPTION_STATS_INTERVAL, "StatsInterval", OPTV_INTEGER, {0}, FALSE },
+    { OPTION_STATS_FILE, "StatsFile", OPTV_STRING, {0}, FALSE },
+    { OPTION_TRACE_FILE, "TraceFile", OPTV_STRING, {0}, FALSE },
+    { OPTION_DEBUG_DAMAGE, "DebugDamage", OPTV_BOOLEAN, {0}, FALSE },
+    { OPTION_DEBUG_HUD,  "DebugHUD",   OPTV_BOOLEAN, {0}, FALSE },
+    { OPTION_CLIENT_STATS, "ClientStats", OPTV_BOOLEAN, {0}, FALSE },
+    { OPTION_RECORD_FILE, "RecordFile", OPTV_STRING, {0}, FALSE },
     { -1,                NULL,         OPTV_NONE,    {0}, FALSE }
 };
 
@@ -152,19 +203,6 @@ _X_EXPORT XF86ModuleData nestedModuleData = {
     NULL, /* teardown */
 };
 
-/* These stuff should be valid to all server generations */
-typedef struct NestedPrivate {
-    Bool                         fullscreen;
-    Output                       output;
-    NestedClientPrivatePtr       clientData;
-    CreateScreenResourcesProcPtr CreateScreenResources;
-    CloseScreenProcPtr           CloseScreen;
-    ShadowUpdateProc             update;
-} NestedPrivate, *NestedPrivatePtr;
-
-#define PNESTED(p)    ((NestedPrivatePtr)((p)->driverPrivate))
-#define PCLIENTDATA(p) (PNESTED(p)->clientData)
-
 /*static ScrnInfoPtr NESTEDScrn;*/
 
 static pointer
@@ -280,16 +318,153 @@ static Bool NestedAllocatePrivate(ScrnInfoPtr pScrn) {
 }
 
 static void NestedFreePrivate(ScrnInfoPtr pScrn) {
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    int i;
+
     if (pScrn->driverPrivate == NULL) {
         xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
                    "Double freeing NestedPrivate!\n");
         return;
     }
 
+    for (i = 0; i < pNested->numOutputs; i++)
+        free((char *)pNested->outputs[i].name);
+    free(pNested->outputs);
+
+    for (i = 0; i < pNested->numMirrors; i++)
+        free(pNested->mirrors[i].display);
+    free(pNested->mirrors);
     free(pScrn->driverPrivate);
     pScrn->driverPrivate = NULL;
 }
 
+/* Splits a list separated by commas or spaces into newly allocated
+ * strings, returning how many there are, or -1 on allocation failure */
+static int NestedSplitList(const char *list, char ***pItems) {
+    const char *p = list;
+    char **items = NULL;
+    int n = 0;
+    size_t len;
+
+    while (*p) {
+        p += strspn(p, ", \t");
+        len = strcspn(p, ", \t");
+
+        if (len > 0) {
+            char **newItems = realloc(items, (n + 1) * sizeof(char *));
+
+            if (newItems)
+                items = newItems;
+
+            if (!newItems || !(items[n] = strndup(p, len))) {
+                while (n--)
+                    free(items[n]);
+                free(items);
+                return -1;
+            }
+
+            n++;
+            p += len;
+        }
+    }
+
+    *pItems = items;
+    return n;
+}
+
+static Bool NestedParseOutputs(ScrnInfoPtr pScrn, const char *list) {
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    char **names;
+    int i, n = NestedSplitList(list, &names);
+
+    if (n <= 0)
+        return FALSE;
+
+    pNested->outputs = calloc(n, sizeof(Output));
+    if (!pNested->outputs) {
+        for (i = 0; i < n; i++)
+            free(names[i]);
+        free(names);
+        return FALSE;
+    }
+
+    for (i = 0; i < n; i++)
+        pNested->outputs[i].name = names[i];
+
+    pNested->numOutputs = n;
+    free(names);
+    return TRUE;
+}
+
+/* The first display is the primary one, the others get mirrors */
+static Bool NestedParseDisplays(ScrnInfoPtr pScrn, const char *list) {
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    char **names;
+    int i, n = NestedSplitList(list, &names);
+
+    if (n <= 0)
+        return FALSE;
+
+    setenv("DISPLAY", names[0], 1);
+    free(names[0]);
+
+    if (n > 1) {
+        pNested->mirrors = calloc(n - 1, sizeof(NestedMirrorRec));
+        if (!pNested->mirrors) {
+            for (i = 1; i < n; i++)
+                free(names[i]);
+            free(names);
+            return FALSE;
+        }
+
+        for (i = 1; i < n; i++) {
+            pNested->mirrors[i - 1].display = names[i];
+            xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Mirroring to display \"%s\"\n",
+                       names[i]);
+        }
+
+        pNested->numMirrors = n - 1;
+    }
+
+    free(names);
+    return TRUE;
+}
+
+/* Looks up each output on the host, and makes the nested screen span the
+ * rectangle around all of them */
+static Bool NestedCheckOutputs(ScrnInfoPtr pScrn) {
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    int i, x2 = 0, y2 = 0;
+
+    for (i = 0; i < pNested->numOutputs; i++) {
+        OutputPtr output = &pNested->outputs[i];
+
+        if (!NestedClientCheckDisplay(pScrn->scrnIndex, output))
+            return FALSE;
+
+        if (i == 0 || output->x < pNested->output.x)
+            pNested->output.x = output->x;
+        if (i == 0 || output->y < pNested->output.y)
+            pNested->output.y = output->y;
+        if (i == 0 || output->x + output->width > x2)
+            x2 = output->x + output->width;
+        if (i == 0 || output->y + output->height > y2)
+            y2 = output->y + output->height;
+    }
+
+    pNested->output.width = x2 - pNested->output.x;
+    pNested->output.height = y2 - pNested->output.y;
+
+    if (pNested->numOutputs > 1)
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+                   "Spanning %d host outputs: %dx%d+%d+%d\n",
+                   pNested->numOutputs,
+                   pNested->output.width, pNested->output.height,
+                   pNested->output.x, pNested->output.y);
+
+    return TRUE;
+}
+
 /* Data from here is valid to all server generations */
 static Bool NestedPreInit(ScrnInfoPtr pScrn, int flags) {
     NestedPrivatePtr pNested;
@@ -313,6 +488,28 @@ static Bool NestedPreInit(ScrnInfoPtr pScrn, int flags) {
     pNested->output.width = 0;
     pNested->output.height = 0;
     pNested->fullscreen = FALSE;
+    pNested->accel = TRUE;
+    pNested->renderAccel = FALSE;
+    pNested->xv = TRUE;
+    pNested->clipToVisible = TRUE;
+    pNested->rootless = FALSE;
+    pNested->shmPassthrough = TRUE;
+    pNested->shmSeg = 0;
+    pNested->shmUnusable = 0;
+    pNested->frameSync = TRUE;
+    pNested->frameHoldOff = 0;
+    pNested->hotTileInterval = 0;
+    pNested->progressive = FALSE;
+    pNested->uploadBudget = 0;
+    pNested->lowLatency = FALSE;
+    pNested->statsInterval = 0;
+    pNested->statsFile = NULL;
+    pNested->traceFile = NULL;
+    pNested->recordFile = NULL;
+    pNested->debugDamage = FALSE;
+    pNested->debugHud = FALSE;
+    pNested->clientStats = FALSE;
+    pNested->tileCacheSize = DEFAULT_TILE_CACHE_SIZE;
 
     if (!xf86SetDepthBpp(pScrn, 0, 0, 0, Support24bppFb | Support32bppFb))
         return FALSE;
@@ -335,8 +532,15 @@ static Bool NestedPreInit(ScrnInfoPtr pScrn, int flags) {
     xf86ProcessOptions(pScrn->scrnIndex, pScrn->options, NestedOptions);
 
     if (xf86IsOptionSet(NestedOptions, OPTION_DISPLAY)) {
-        displayName = xf86GetOptValString(NestedOptions, OPTION_DISPLAY);
-        setenv("DISPLAY", displayName, 1);
+        if (!NestedParseDisplays(pScrn,
+                                 xf86GetOptValString(NestedOptions,
+                                                     OPTION_DISPLAY))) {
+            xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+                       "Invalid value for option \"Display\"\n");
+            return FALSE;
+        }
+
+        displayName = getenv("DISPLAY");
         xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Using display \"%s\"\n",
                    displayName);
     }
@@ -364,16 +568,132 @@ static Bool NestedPreInit(ScrnInfoPtr pScrn, int flags) {
         xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Fullscreen mode %s\n",
                    pNested->fullscreen ? "enabled" : "disabled");
 
+    if (xf86GetOptValBool(NestedOptions, OPTION_LOW_LATENCY,
+                          &pNested->lowLatency))
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Low-latency mode %s\n",
+                   pNested->lowLatency ? "requested" : "disabled");
+
+    if (xf86GetOptValBool(NestedOptions, OPTION_ACCEL, &pNested->accel))
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Host-side acceleration %s\n",
+                   pNested->accel ? "enabled" : "disabled");
+
+    if (xf86GetOptValBool(NestedOptions, OPTION_RENDER_ACCEL,
+                          &pNested->renderAccel))
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Render acceleration %s\n",
+                   pNested->renderAccel ? "requested" : "disabled");
+
+    if (xf86GetOptValBool(NestedOptions, OPTION_XVIDEO, &pNested->xv))
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO, "XVideo %s\n",
+                   pNested->xv ? "enabled" : "disabled");
+
+    if (xf86GetOptValBool(NestedOptions, OPTION_CLIP_TO_VISIBLE,
+                          &pNested->clipToVisible))
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+                   "Clipping uploads to the visible host window %s\n",
+                   pNested->clipToVisible ? "enabled" : "disabled");
+
+    if (xf86GetOptValBool(NestedOptions, OPTION_ROOTLESS, &pNested->rootless))
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Rootless mode %s\n",
+                   pNested->rootless ? "requested" : "disabled");
+
+    if (xf86GetOptValBool(NestedOptions, OPTION_SHM_PASSTHROUGH,
+                          &pNested->shmPassthrough))
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO, "MIT-SHM passthrough %s\n",
+                   pNested->shmPassthrough ? "enabled" : "disabled");
+
+    if (xf86GetOptValBool(NestedOptions, OPTION_FRAME_SYNC,
+                          &pNested->frameSync))
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+                   "Waiting for client frames to end %s\n",
+                   pNested->frameSync ? "enabled" : "disabled");
+
+    if (xf86GetOptValInteger(NestedOptions, OPTION_FRAME_HOLD_OFF,
+                             &pNested->frameHoldOff))
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Frame hold-off: %d ms\n",
+                   pNested->frameHoldOff);
+
+    if (xf86GetOptValInteger(NestedOptions, OPTION_HOT_TILE_INTERVAL,
+                             &pNested->hotTileInterval))
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+                   "Uploading hot tiles every %d ms at most\n",
+                   pNested->hotTileInterval);
+
+    if (xf86GetOptValBool(NestedOptions, OPTION_PROGRESSIVE,
+                          &pNested->progressive))
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+                   "Progressive uploads %s\n",
+                   pNested->progressive ? "enabled" : "disabled");
+
+    if (xf86GetOptValInteger(NestedOptions, OPTION_UPLOAD_BUDGET,
+                             &pNested->uploadBudget))
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+                   "Uploading %d pixels per frame at most\n",
+                   pNested->uploadBudget);
+
+    if (xf86GetOptValInteger(NestedOptions, OPTION_STATS_INTERVAL,
+                             &pNested->statsInterval))
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+                   "Dumping statistics every %d s\n",
+                   pNested->statsInterval);
+
+    if (xf86IsOptionSet(NestedOptions, OPTION_STATS_FILE)) {
+        pNested->statsFile = xf86GetOptValString(NestedOptions,
+                                                 OPTION_STATS_FILE);
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+                   "Writing statistics to %s\n", pNested->statsFile);
+    }
+
+    if (xf86IsOptionSet(NestedOptions, OPTION_TRACE_FILE)) {
+        pNested->traceFile = xf86GetOptValString(NestedOptions,
+                                                 OPTION_TRACE_FILE);
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+                   "Tracing frames to %s\n", pNested->traceFile);
+    }
+
+    if (xf86IsOptionSet(NestedOptions, OPTION_RECORD_FILE)) {
+        pNested->recordFile = xf86GetOptValString(NestedOptions,
+                                                  OPTION_RECORD_FILE);
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+                   "Recording damage to %s\n", pNested->recordFile);
+    }
+
+    if (xf86GetOptValBool(NestedOptions, OPTION_DEBUG_DAMAGE,
+                          &pNested->debugDamage))
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Outlining uploads %s\n",
+                   pNested->debugDamage ? "enabled" : "disabled");
+
+    if (xf86GetOptValBool(NestedOptions, OPTION_DEBUG_HUD,
+                          &pNested->debugHud))
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Upload HUD %s\n",
+                   pNested->debugHud ? "enabled" : "disabled");
+
+    if (xf86GetOptValBool(NestedOptions, OPTION_CLIENT_STATS,
+                          &pNested->clientStats))
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Per-client statistics %s\n",
+                   pNested->clientStats ? "enabled" : "disabled");
+
+    if (xf86GetOptValInteger(NestedOptions, OPTION_TILE_CACHE_SIZE,
+                             &pNested->tileCacheSize))
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Tile cache size: %d tiles\n",
+                   pNested->tileCacheSize);
+
     if (xf86IsOptionSet(NestedOptions, OPTION_OUTPUT)) {
         pNested->output.name = xf86GetOptValString(NestedOptions,
                                                    OPTION_OUTPUT);
         xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Targeting host X server output \"%s\"\n",
                    pNested->output.name);
+
+        if (!NestedParseOutputs(pScrn, pNested->output.name)) {
+            xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+                       "Invalid value for option \"Output\"\n");
+            return FALSE;
+        }
     }
 
     xf86ShowUnusedOptions(pScrn->scrnIndex, pScrn->options);
 
-    if (!NestedClientCheckDisplay(pScrn->scrnIndex, &pNested->output)) {
+    if (pNested->numOutputs > 0 ? !NestedCheckOutputs(pScrn) :
+        !NestedClientCheckDisplay(pScrn->scrnIndex, &pNested->output)) {
         xf86DrvMsg(pScrn->scrnIndex, X_ERROR, "Can't open display: %s\n",
                    displayName);
         return FALSE;
@@ -433,7 +753,8 @@ NestedValidateModes(ScrnInfoPtr pScrn) {
     }
     xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Too bad for it...\n");
 
-    if (pNested->output.name != NULL || pNested->fullscreen) {
+    /* Rootless windows are placed on the host as on the nested screen */
+    if (pNested->output.name != NULL || pNested->fullscreen || pNested->rootless) {
         if (!NestedAddMode(pScrn, pNested->output.width, pNested->output.height)) {
             return 0;
         }
@@ -557,6 +878,33 @@ NestedAddMode(ScrnInfoPtr pScrn, int width, int height) {
     return TRUE;
 }
 
+static Bool
+NestedIsVisible(NestedPrivatePtr pNested) {
+    return !pNested->blanked && !pNested->dpmsOff &&
+           NestedClientIsVisible(pNested->clientData);
+}
+
+/* Recomputes the part of the screen that isn't covered by other host
+ * windows, from the boxes that are */
+static void
+NestedUpdateVisible(ScreenPtr pScreen, int nBox, BoxPtr pBox) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+    RegionRec occluder;
+    BoxRec box;
+
+    box.x1 = 0;
+    box.y1 = 0;
+    box.x2 = pScreen->width;
+    box.y2 = pScreen->height;
+    RegionReset(&pNested->visible, &box);
+
+    while (nBox--) {
+        RegionInit(&occluder, pBox++, 1);
+        RegionSubtract(&pNested->visible, &pNested->visible, &occluder);
+        RegionUninit(&occluder);
+    }
+}
+
 static void
 #if ABI_VIDEODRV_VERSION >= SET_ABI_VERSION(23, 0)
 NestedBlockHandler(void *data, void *wt)
@@ -564,8 +912,65 @@ NestedBlockHandler(void *data, void *wt)
 NestedBlockHandler(pointer data, OSTimePtr wt, pointer LastSelectMask)
 #endif
 {
-    NestedClientPrivatePtr pNestedClient = data;
-    NestedClientCheckEvents(pNestedClient);
+    ScreenPtr pScreen = data;
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+    RegionRec exposed;
+    BoxPtr pBox;
+    int nBox, delay;
+
+    NESTED_PROBE(block__start);
+
+    NestedClientCheckEvents(pNested->clientData);
+    NestedTraceCheck(pScreen);
+
+    /* Upload the frames that got complete */
+    NestedFrameCheck(pScreen);
+
+    /* and the hot areas that were held back, when it's time */
+    delay = NestedHeatCheck(pScreen);
+    if (delay >= 0)
+        AdjustWaitForDelay(wt, delay);
+
+    /* Come back soon for mirrors that couldn't be sent everything yet */
+    if (NestedMirrorCheckEvents(pScreen))
+        AdjustWaitForDelay(wt, NESTED_MIRROR_RETRY_MS);
+
+    /* Go on with what the upload budget left over */
+    if (NestedIsVisible(pNested)) {
+        delay = NestedPriorityCheck(pScreen);
+        if (delay >= 0)
+            AdjustWaitForDelay(wt, delay);
+    }
+
+    /* Erase outlines and redraw the HUD */
+    delay = NestedDebugCheck(pScreen);
+    if (delay >= 0)
+        AdjustWaitForDelay(wt, delay);
+
+    /* Refine what was sent coarse, as fast as the host takes it */
+    if (NestedIsVisible(pNested) && NestedRefineStep(pScreen))
+        AdjustWaitForDelay(wt, NESTED_REFINE_RETRY_MS);
+
+    if (pNested->clipToVisible &&
+        NestedClientGetOcclusion(pNested->clientData, &nBox, &pBox))
+        NestedUpdateVisible(pScreen, nBox, pBox);
+
+    /* Have what was held back and can now be seen uploaded right away */
+    if (RegionNotEmpty(&pNested->pending) && NestedIsVisible(pNested)) {
+        RegionNull(&exposed);
+        RegionIntersect(&exposed, &pNested->pending, &pNested->visible);
+
+        if (RegionNotEmpty(&exposed)) {
+            DamageDamageRegion(&(*pScreen->GetScreenPixmap)(pScreen)->drawable,
+                               &exposed);
+            RegionSubtract(&pNested->pending, &pNested->pending, &exposed);
+            AdjustWaitForDelay(wt, 0);
+        }
+
+        RegionUninit(&exposed);
+    }
+
+    NESTED_PROBE(block__done);
 }
 
 static void
@@ -575,6 +980,7 @@ NestedWakeupHandler(void *data, int i)
 NestedWakeupHandler(pointer data, int i, pointer LastSelectMask)
 #endif
 {
+    NESTED_PROBE1(wakeup, i);
 }
 
 /* Called at each server generation */
@@ -583,6 +989,7 @@ static Bool NestedScreenInit(SCREEN_INIT_ARGS_DECL)
     ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
     NestedPrivatePtr pNested;
     Pixel redMask, greenMask, blueMask;
+    Output screenOutput;
 
     xf86DrvMsg(pScrn->scrnIndex, X_INFO, "NestedScreenInit\n");
 
@@ -596,12 +1003,33 @@ static Bool NestedScreenInit(SCREEN_INIT_ARGS_DECL)
     
     //Load_Nested_Mouse();
 
+    /* Without Option "Output", a single window shows the whole screen */
+    if (pNested->numOutputs == 0) {
+        screenOutput.name = NULL;
+        screenOutput.x = pNested->output.x;
+        screenOutput.y = pNested->output.y;
+        screenOutput.width = pScrn->virtualX;
+        screenOutput.height = pScrn->virtualY;
+    }
+
+    /* Taking over the host only makes sense when covering its outputs */
+    if (pNested->lowLatency &&
+        (pNested->rootless ||
+         (pNested->output.name == NULL && !pNested->fullscreen))) {
+        xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+                   "Low-latency mode needs Option \"Fullscreen\" or "
+                   "\"Output\", and no rootless mode\n");
+        pNested->lowLatency = FALSE;
+    }
+
     pNested->clientData = NestedClientCreateScreen(pScrn->scrnIndex,
                                                    pNested->output.name != NULL || pNested->fullscreen,
+                                                   pNested->rootless,
+                                                   pNested->lowLatency,
                                                    pScrn->virtualX,
                                                    pScrn->virtualY,
-                                                   pNested->output.x,
-                                                   pNested->output.y,
+                                                   pNested->numOutputs > 0 ? pNested->numOutputs : 1,
+                                                   pNested->numOutputs > 0 ? pNested->outputs : &screenOutput,
                                                    pScrn->depth,
                                                    pScrn->bitsPerPixel,
                                                    &redMask, &greenMask, &blueMask);
@@ -611,6 +1039,9 @@ static Bool NestedScreenInit(SCREEN_INIT_ARGS_DECL)
         return FALSE;
     }
 
+    NestedClientSetTileCacheSize(pNested->clientData, pNested->tileCacheSize);
+    NestedMirrorInit(pScreen);
+
     miClearVisualTypes();
     if (!miSetVisualTypesAndMasks(pScrn->depth,
                                   miGetDefaultVisualMask(pScrn->depth),
@@ -636,18 +1067,50 @@ static Bool NestedScreenInit(SCREEN_INIT_ARGS_DECL)
         return FALSE;
 
     pNested->update = NestedShadowUpdate;
+    pNested->blanked = FALSE;
+    pNested->dpmsOff = FALSE;
+    RegionNull(&pNested->pending);
+    {
+        BoxRec box = { 0, 0, pScrn->virtualX, pScrn->virtualY };
+        RegionInit(&pNested->visible, &box, 1);
+    }
     pScreen->SaveScreen = NestedSaveScreen;
+    xf86DPMSInit(pScreen, NestedDPMSSet, 0);
 
     if (!shadowSetup(pScreen))
         return FALSE;
 
+    if (!NestedFrameInit(pScreen))
+        return FALSE;
+
+    NestedHeatInit(pScreen);
+    NestedRefineInit(pScreen);
+    NestedPriorityInit(pScreen);
+    NestedStatsInit(pScreen);
+    NestedTraceInit(pScreen);
+    NestedRecordInit(pScreen);
+    NestedAttribInit(pScreen);
+    NestedDebugInit(pScreen);
+
+    if (!NestedAccelInit(pScreen))
+        return FALSE;
+
+    if (!NestedRenderInit(pScreen))
+        return FALSE;
+
+    if (!NestedRootlessInit(pScreen))
+        return FALSE;
+
     pNested->CreateScreenResources = pScreen->CreateScreenResources;
     pScreen->CreateScreenResources = NestedCreateScreenResources;
 
     pNested->CloseScreen = pScreen->CloseScreen;
     pScreen->CloseScreen = NestedCloseScreen;
 
-    RegisterBlockAndWakeupHandlers(NestedBlockHandler, NestedWakeupHandler, pNested->clientData);
+    if (!NestedXvInit(pScreen))
+        return FALSE;
+
+    RegisterBlockAndWakeupHandlers(NestedBlockHandler, NestedWakeupHandler, pScreen);
 
     return TRUE;
 }
@@ -669,37 +1132,238 @@ NestedCreateScreenResources(ScreenPtr pScreen) {
         return FALSE;
     }
 
+    if (!NestedAccelCreateResources(pScreen)) {
+        xf86DrvMsg(pScreen->myNum, X_ERROR, "NestedCreateScreenResources failed to set up acceleration.\n");
+        return FALSE;
+    }
+
+    if (!NestedTraceCreateResources(pScreen)) {
+        xf86DrvMsg(pScreen->myNum, X_ERROR, "NestedCreateScreenResources failed to set up tracing.\n");
+        return FALSE;
+    }
+
+    if (!NestedAttribCreateResources(pScreen)) {
+        xf86DrvMsg(pScreen->myNum, X_ERROR, "NestedCreateScreenResources failed to set up client statistics.\n");
+        return FALSE;
+    }
+
     return ret;
 }
 
+/* Uploads pRegion, which is left with what was actually uploaded */
+static void
+NestedUpdate(ScreenPtr pScreen, RegionPtr pRegion) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+    NestedClientPrivatePtr pClient = pNested->clientData;
+    RegionRec hidden, hot;
+    BoxPtr pBox;
+    int nBox;
+    CARD64 start = GetTimeInMicros();
+
+    NestedTraceBegin(pScreen);
+
+    /* Mirrors have their own idea of what they can see and take */
+    NestedMirrorUpdate(pScreen, pRegion);
+
+    /* Refining what changed since would be wasted */
+    NestedRefineDamage(pScreen, pRegion);
+
+    /* Nobody would see it. Keep the damage for when the window is back,
+     * and drop the commands, as their areas will be uploaded then. */
+    if (!NestedIsVisible(pNested)) {
+        RegionUnion(&pNested->pending, &pNested->pending, pRegion);
+        RegionEmpty(pRegion);
+        NestedAccelDrop(pScreen);
+        return;
+    }
+
+    /* Whatever the host can redo by itself doesn't need to be uploaded */
+    NestedAccelReplay(pScreen, pRegion);
+    NestedTraceMark(pScreen, "replay");
+
+    /* Neither does what other host windows cover, until it can be seen */
+    RegionNull(&hidden);
+    RegionSubtract(&hidden, pRegion, &pNested->visible);
+    if (RegionNotEmpty(&hidden)) {
+        RegionUnion(&pNested->pending, &pNested->pending, &hidden);
+        RegionIntersect(pRegion, pRegion, &pNested->visible);
+    }
+    RegionUninit(&hidden);
+
+    /* Host copies must not read from what is held back */
+    NestedAccelMarkStale(pScreen, &pNested->pending);
+
+    /* Video-like areas won't be seen again, so they skip the tile cache */
+    RegionNull(&hot);
+    NestedHeatSplit(pScreen, pRegion, &hot);
+
+    pBox = RegionRects(&hot);
+    nBox = RegionNumRects(&hot);
+
+    while (nBox--) {
+        NestedClientUpdateScreenUncached(pClient,
+                                         pBox->x1, pBox->y1,
+                                         pBox->x2, pBox->y2);
+        pBox++;
+    }
+
+    NestedStatsAddRegion(pScreen, &hot);
+
+    /* What the user is looking at first */
+    NestedPriorityUpload(pScreen, pRegion);
+    NestedStatsAddRegion(pScreen, pRegion);
+
+    /* Left with all of it */
+    RegionUnion(pRegion, pRegion, &hot);
+    RegionUninit(&hot);
+    NestedDebugUpload(pScreen, pRegion);
+    NestedAttribUpload(pScreen, pRegion);
+
+    /* Host copies must not read from what only got there coarse either */
+    NestedAccelMarkStale(pScreen, &pNested->refine);
+    NestedTraceMark(pScreen, "upload");
+
+    NestedClientFlush(pClient);
+    NestedTraceEnd(pScreen);
+    NestedStatsAddFrame(pScreen, start);
+}
+
 static void
 NestedShadowUpdate(ScreenPtr pScreen, shadowBufPtr pBuf) {
-    RegionPtr pRegion = DamageRegion(pBuf->pDamage);
-    NestedClientUpdateScreen(PCLIENTDATA(xf86ScreenToScrn(pScreen)),
-                             pRegion->extents.x1, pRegion->extents.y1,
-                             pRegion->extents.x2, pRegion->extents.y2);
+    RegionRec region;
+
+    RegionNull(&region);
+    RegionCopy(&region, DamageRegion(pBuf->pDamage));
+
+    NESTED_PROBE2(update__start, RegionNumRects(&region),
+                  NestedProbeArea(&region));
+
+    /* Frames still being drawn are uploaded once complete, and recorded
+     * then, along with what was held back */
+    if (NestedFrameHold(pScreen, &region))
+        RegionEmpty(&region);
+    else {
+        NestedRecordBegin(pScreen, &region);
+        NestedUpdate(pScreen, &region);
+        NestedRecordEnd(pScreen, &region);
+    }
+
+    /* with what was uploaded */
+    NESTED_PROBE2(update__done, RegionNumRects(&region),
+                  NestedProbeArea(&region));
+
+    RegionUninit(&region);
+}
+
+/* Uploads the damage right away, as the shadow block handler would, along
+ * with whatever was held back */
+void
+NestedUpdateNow(ScreenPtr pScreen) {
+    shadowBufPtr pBuf = shadowGetBuf(pScreen);
+    RegionRec region;
+
+    if (!pBuf)
+        return;
+
+    RegionNull(&region);
+    RegionCopy(&region, DamageRegion(pBuf->pDamage));
+    NestedFrameTake(pScreen, &region);
+
+    if (RegionNotEmpty(&region)) {
+        NestedRecordBegin(pScreen, &region);
+        NestedUpdate(pScreen, &region);
+        NestedRecordEnd(pScreen, &region);
+        DamageEmpty(pBuf->pDamage);
+    }
+
+    RegionUninit(&region);
 }
 
 static Bool
 NestedCloseScreen(CLOSE_SCREEN_ARGS_DECL) {
     ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+    unsigned long hits, misses, frames, average, maximum;
 
     xf86DrvMsg(pScrn->scrnIndex, X_INFO, "NestedCloseScreen\n");
 
+    NestedClientGetTileCacheStats(PCLIENTDATA(pScrn), &hits, &misses);
+    if (hits + misses > 0)
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+                   "Tile cache: %lu hits, %lu misses (%.1f%% hit rate)\n",
+                   hits, misses, 100.0 * hits / (hits + misses));
+
+    NestedClientGetLatencyStats(PCLIENTDATA(pScrn), &frames, &average,
+                                &maximum);
+    if (frames > 0)
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+                   "Host latency: %.2f ms average, %.2f ms max over %lu "
+                   "frames\n", average / 1000.0, maximum / 1000.0, frames);
+
+    NestedStatsClose(pScreen);
+    NestedAttribClose(pScreen);
+    NestedRecordClose(pScreen);
+    NestedTraceClose(pScreen);
+    NestedDebugClose(pScreen);
     shadowRemove(pScreen, pScreen->GetScreenPixmap(pScreen));
-
-    RemoveBlockAndWakeupHandlers(NestedBlockHandler, NestedWakeupHandler, PNESTED(pScrn)->clientData);
+    NestedXvClose(pScreen);
+    NestedRootlessClose(pScreen);
+    NestedRenderClose(pScreen);
+    NestedAccelClose(pScreen);
+    NestedFrameClose(pScreen);
+    NestedHeatClose(pScreen);
+    NestedRefineClose(pScreen);
+    NestedPriorityClose(pScreen);
+    RegionUninit(&PNESTED(pScrn)->pending);
+    RegionUninit(&PNESTED(pScrn)->visible);
+
+    RemoveBlockAndWakeupHandlers(NestedBlockHandler, NestedWakeupHandler, pScreen);
+    NestedMirrorClose(pScreen);
     NestedClientCloseScreen(PCLIENTDATA(pScrn));
 
     pScreen->CloseScreen = PNESTED(pScrn)->CloseScreen;
     return (*pScreen->CloseScreen)(CLOSE_SCREEN_ARGS);
 }
 
+/* Blanks the host window and holds back uploads until unblanked, when
+ * everything gets uploaded again */
+static void
+NestedSetBlank(ScreenPtr pScreen, Bool *pFlag, Bool blank) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+    Bool wasBlank = pNested->blanked || pNested->dpmsOff;
+    BoxRec box;
+
+    *pFlag = blank;
+
+    if (wasBlank || !blank)
+        return;
+
+    box.x1 = 0;
+    box.y1 = 0;
+    box.x2 = pScreen->width;
+    box.y2 = pScreen->height;
+    RegionReset(&pNested->pending, &box);
+
+    NestedAccelDrop(pScreen);
+    NestedClientFillRects(pNested->clientData, 1, &box, pScreen->blackPixel);
+    NestedClientFlush(pNested->clientData);
+    NestedMirrorBlank(pScreen);
+}
+
 static Bool NestedSaveScreen(ScreenPtr pScreen, int mode) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+
     xf86DrvMsg(pScreen->myNum, X_INFO, "NestedSaveScreen\n");
+    NestedSetBlank(pScreen, &pNested->blanked, !xf86IsUnblank(mode));
     return TRUE;
 }
 
+static void
+NestedDPMSSet(ScrnInfoPtr pScrn, int mode, int flags) {
+    ScreenPtr pScreen = xf86ScrnToScreen(pScrn);
+
+    NestedSetBlank(pScreen, &PNESTED(pScrn)->dpmsOff, mode != DPMSModeOn);
+}
+
 static Bool NestedSwitchMode(SWITCH_MODE_ARGS_DECL) {
     SCRN_INFO_PTR(arg);
     xf86DrvMsg(pScrn->scrnIndex, X_INFO, "NestedSwitchMode\n");
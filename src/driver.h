@@ -0,0 +1,302 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *
+ * Paulo Zanoni <pzanoni@mandriva.com>
+ * Laércio de Sousa <laerciosousa@sme-mogidascruzes.sp.gov.br>
+ */
+
+#ifndef NESTED_DRIVER_H
+#define NESTED_DRIVER_H
+
+#include <damage.h>
+#include <gcstruct.h>
+#include <picturestr.h>
+#include <regionstr.h>
+#include <shadow.h>
+#include <xf86str.h>
+
+#include "client.h"
+
+/* A drawing operation recorded by the acceleration layer, to be replayed on
+ * the host window instead of uploading the pixels it produced. */
+typedef enum {
+    NESTED_CMD_COPY,
+    NESTED_CMD_FILL,
+    NESTED_CMD_GLYPHS,
+    NESTED_CMD_VIDEO,
+    NESTED_CMD_MOVE,  /* the host window was moved along with the pixels */
+    NESTED_CMD_SHARED /* the host read the pixels from a client's segment */
+} NestedCmdType;
+
+typedef struct NestedCmd {
+    NestedCmdType  type;
+    RegionRec      region;    /* destination, in screen coordinates */
+    int            dx;        /* COPY: source = destination + (dx, dy) */
+    int            dy;
+    Pixel          pixel;     /* FILL */
+    xRenderColor   color;     /* GLYPHS: solid source, PictOpOver */
+    Bool           useMask;
+    int            numGlyphs;
+    NestedGlyphPtr glyphs;
+    xRectangle     videoSrc;  /* VIDEO: last frame given to the client */
+    xRectangle     videoDst;
+} NestedCmdRec, *NestedCmdPtr;
+
+/* Another host display showing the whole screen (mirror.c) */
+typedef struct NestedMirror {
+    char                  *display;
+    NestedClientPrivatePtr client;   /* NULL if it couldn't be opened */
+    RegionRec              pending;  /* not sent to it yet */
+} NestedMirrorRec, *NestedMirrorPtr;
+
+typedef struct NestedFrameWindow *NestedFrameWindowPtr;
+
+/* How often a tile of the screen changes (heat.c) */
+typedef enum {
+    NESTED_HEAT_COLD,
+    NESTED_HEAT_WARM,
+    NESTED_HEAT_HOT,
+    NESTED_HEAT_CLASSES
+} NestedHeatClass;
+
+typedef struct NestedHeatTile *NestedHeatTilePtr;
+
+typedef struct NestedTrace *NestedTracePtr;
+
+typedef struct NestedAttrib *NestedAttribPtr;
+
+typedef struct NestedRecord *NestedRecordPtr;
+
+/* These stuff should be valid to all server generations */
+typedef struct NestedPrivate {
+    Bool                         fullscreen;
+    Bool                         lowLatency;
+    Output                       output;   /* spanning all of outputs */
+    OutputPtr                    outputs;  /* Option "Output" list */
+    int                          numOutputs;
+    NestedClientPrivatePtr       clientData;
+    CreateScreenResourcesProcPtr CreateScreenResources;
+    CloseScreenProcPtr           CloseScreen;
+    ShadowUpdateProc             update;
+    int                          tileCacheSize;
+
+    /* Uploads are held back while nothing can be seen on the host */
+    Bool                         blanked;  /* screen saver */
+    Bool                         dpmsOff;
+    RegionRec                    pending;  /* not uploaded meanwhile */
+    Bool                         clipToVisible;
+    RegionRec                    visible;  /* not covered on the host */
+
+    /* Frame-coherent updates (frame.c) */
+    Bool                         frameSync;
+    int                          frameHoldOff; /* ms */
+    RegionRec                    held;     /* waiting for frames to end */
+    CARD32                       holdStart;
+    CARD32                       lastDamage;
+    OsTimerPtr                   frameTimer;
+    NestedFrameWindowPtr         frameWindows;
+    int                          numFrameWindows;
+    RESTYPE                      counterType;
+
+    /* Damage heat (heat.c) */
+    NestedHeatTilePtr            heatTiles;
+    int                          heatColumns;
+    int                          heatRows;
+    CARD32                       heatSerial;
+    BoxPtr                       heatBoxes;
+    unsigned long                heatStats[NESTED_HEAT_CLASSES];
+    int                          hotTileInterval; /* ms */
+    CARD32                       lastHotUpload;
+    RegionRec                    hotDeferred;
+
+    /* Progressive uploads (refine.c) */
+    Bool                         progressive;
+    RegionRec                    refine;   /* sent coarse, not in full yet */
+
+    /* Upload order (priority.c) */
+    int                          uploadBudget; /* pixels per frame */
+    RegionRec                    backlog;  /* left over by the budget */
+    Bool                         backlogDamaged;
+
+    /* Statistics (stats.c) */
+    int                          statsInterval; /* s */
+    const char                  *statsFile;
+    OsTimerPtr                   statsTimer;
+    unsigned long                statsFrames;
+    unsigned long                statsRects;
+    unsigned long                statsPixels;
+    unsigned long                statsFrameTime[NESTED_STATS_BUCKETS];
+
+    /* Debugging aids (debug.c) */
+    Bool                         debugDamage;
+    RegionRec                    outlines; /* drawn on the host only */
+    CARD32                       outlineTime;
+    Bool                         debugHud;
+    char                         hudText[64];
+    BoxRec                       hudBox;
+    CARD32                       hudTime;
+    unsigned long                hudFrames;
+    unsigned long                hudRects;
+    unsigned long                hudBytes;
+
+    /* Damage recording (record.c) */
+    const char                  *recordFile;
+    NestedRecordPtr              record;
+
+    /* Per-client statistics (attrib.c) */
+    Bool                         clientStats;
+    NestedAttribPtr              attrib;
+
+    /* Latency tracing (trace.c) */
+    const char                  *traceFile;
+    NestedTracePtr               trace;
+
+    /* Acceleration layer (accel.c) */
+    Bool                         accel;
+    CopyWindowProcPtr            CopyWindow;
+    CreateGCProcPtr              CreateGC;
+    DamagePtr                    accelDamage;
+    RegionRec                    dirty;    /* damaged since the last update */
+    RegionRec                    replayed; /* part of dirty covered by cmds */
+    NestedCmdPtr                 cmds;
+    int                          numCmds;
+
+    /* Render acceleration (render.c) */
+    Bool                         renderAccel;
+    CompositeProcPtr             Composite;
+    GlyphsProcPtr                Glyphs;
+    UnrealizeGlyphProcPtr        UnrealizeGlyph;
+
+    /* XVideo adaptor (xv.c) */
+    Bool                         xv;
+    void                        *xvPort;
+
+    /* MIT-SHM passthrough (shm.c) */
+    Bool                         shmPassthrough;
+    XID                          shmSeg;   /* last segment seen */
+    XID                          shmUnusable; /* last one the host can't read */
+
+    /* Other host displays of Option "Display" (mirror.c) */
+    NestedMirrorPtr              mirrors;
+    int                          numMirrors;
+
+    /* Rootless mode (rootless.c) */
+    Bool                         rootless;
+    RealizeWindowProcPtr         RealizeWindow;
+    UnrealizeWindowProcPtr       UnrealizeWindow;
+    PositionWindowProcPtr        PositionWindow;
+    MoveWindowProcPtr            MoveWindow;
+    RestackWindowProcPtr         RestackWindow;
+    WindowPtr                    movingWindow;
+} NestedPrivate, *NestedPrivatePtr;
+
+#define PNESTED(p)    ((NestedPrivatePtr)((p)->driverPrivate))
+#define PCLIENTDATA(p) (PNESTED(p)->clientData)
+
+void NestedUpdateNow(ScreenPtr pScreen);
+
+Bool NestedFrameInit(ScreenPtr pScreen);
+Bool NestedFrameHold(ScreenPtr pScreen, RegionPtr pRegion);
+void NestedFrameTake(ScreenPtr pScreen, RegionPtr pRegion);
+void NestedFrameCheck(ScreenPtr pScreen);
+void NestedFrameClose(ScreenPtr pScreen);
+
+void NestedHeatInit(ScreenPtr pScreen);
+void NestedHeatSplit(ScreenPtr pScreen, RegionPtr pRegion, RegionPtr pHot);
+int NestedHeatCheck(ScreenPtr pScreen);
+void NestedHeatClose(ScreenPtr pScreen);
+
+void NestedRefineInit(ScreenPtr pScreen);
+Bool NestedRefineCoarse(ScreenPtr pScreen, BoxPtr pBox);
+void NestedRefineDamage(ScreenPtr pScreen, RegionPtr pDamage);
+Bool NestedRefineStep(ScreenPtr pScreen);
+void NestedRefineClose(ScreenPtr pScreen);
+
+void NestedPriorityInit(ScreenPtr pScreen);
+void NestedPriorityUpload(ScreenPtr pScreen, RegionPtr pRegion);
+int NestedPriorityCheck(ScreenPtr pScreen);
+void NestedPriorityClose(ScreenPtr pScreen);
+
+void NestedStatsInit(ScreenPtr pScreen);
+void NestedStatsAddRegion(ScreenPtr pScreen, RegionPtr pRegion);
+void NestedStatsAddFrame(ScreenPtr pScreen, CARD64 start);
+void NestedStatsClose(ScreenPtr pScreen);
+
+void NestedDebugInit(ScreenPtr pScreen);
+void NestedDebugUpload(ScreenPtr pScreen, RegionPtr pRegion);
+int NestedDebugCheck(ScreenPtr pScreen);
+void NestedDebugClose(ScreenPtr pScreen);
+
+void NestedRecordInit(ScreenPtr pScreen);
+void NestedRecordBegin(ScreenPtr pScreen, RegionPtr pDamage);
+void NestedRecordEnd(ScreenPtr pScreen, RegionPtr pUploaded);
+void NestedRecordClose(ScreenPtr pScreen);
+
+void NestedAttribInit(ScreenPtr pScreen);
+Bool NestedAttribCreateResources(ScreenPtr pScreen);
+void NestedAttribUpload(ScreenPtr pScreen, RegionPtr pRegion);
+int NestedAttribPrint(ScreenPtr pScreen, char *buf, size_t size);
+void NestedAttribClose(ScreenPtr pScreen);
+
+void NestedTraceInit(ScreenPtr pScreen);
+Bool NestedTraceCreateResources(ScreenPtr pScreen);
+void NestedTraceBegin(ScreenPtr pScreen);
+void NestedTraceMark(ScreenPtr pScreen, const char *stage);
+void NestedTraceEnd(ScreenPtr pScreen);
+void NestedTraceCheck(ScreenPtr pScreen);
+void NestedTraceClose(ScreenPtr pScreen);
+
+Bool NestedAccelInit(ScreenPtr pScreen);
+Bool NestedAccelCreateResources(ScreenPtr pScreen);
+void NestedAccelReplay(ScreenPtr pScreen, RegionPtr pRegion);
+void NestedAccelClose(ScreenPtr pScreen);
+void NestedAccelDrop(ScreenPtr pScreen);
+void NestedAccelMarkStale(ScreenPtr pScreen, RegionPtr pRegion);
+Bool NestedAccelOnScreen(DrawablePtr pDrawable);
+void NestedAccelClipToHost(ScreenPtr pScreen, DrawablePtr pSrc,
+                           RegionPtr pRegion, int dx, int dy,
+                           unsigned int subWindowMode);
+NestedCmdPtr NestedAccelRecord(ScreenPtr pScreen, NestedCmdType type,
+                               RegionPtr pRegion);
+void NestedAccelRecordFill(ScreenPtr pScreen, RegionPtr pDst, Pixel pixel);
+
+Bool NestedRenderInit(ScreenPtr pScreen);
+void NestedRenderClose(ScreenPtr pScreen);
+
+RegionPtr NestedShmPutImage(DrawablePtr pDrawable, GCPtr pGC, int depth,
+                            int x, int y, int w, int h, int leftPad,
+                            int format, char *pImage);
+void NestedShmPutImageDone(ScreenPtr pScreen, RegionPtr pRegion);
+
+Bool NestedXvInit(ScreenPtr pScreen);
+void NestedXvClose(ScreenPtr pScreen);
+
+void NestedMirrorInit(ScreenPtr pScreen);
+void NestedMirrorUpdate(ScreenPtr pScreen, RegionPtr pDamage);
+Bool NestedMirrorCheckEvents(ScreenPtr pScreen);
+void NestedMirrorBlank(ScreenPtr pScreen);
+void NestedMirrorClose(ScreenPtr pScreen);
+
+Bool NestedRootlessInit(ScreenPtr pScreen);
+void NestedRootlessClose(ScreenPtr pScreen);
+
+#endif
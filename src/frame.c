@@ -0,0 +1,322 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Frame-coherent updates.
+ *
+ * The shadow layer uploads whatever is in the framebuffer when the server
+ * goes idle, which may be a frame still being drawn. Two things make us
+ * hold the damage back until the frame is complete:
+ *
+ * - Clients following the extended _NET_WM_SYNC_REQUEST_COUNTER protocol
+ *   set their second counter to an odd value when they start drawing a
+ *   frame, and to an even value once done. While such a counter of a
+ *   viewable window is odd, nothing is uploaded.
+ *
+ * - With Option "FrameHoldOff", uploads wait until no damage came for that
+ *   many milliseconds.
+ *
+ * Nothing is held longer than NESTED_FRAME_MAX_HOLD_MS. A counter that was
+ * still odd then is ignored until it gets even, so a client that hangs in
+ * the middle of a frame doesn't slow down the others.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <xorg-server.h>
+#include <dixstruct.h>
+#include <propertyst.h>
+#include <registry.h>
+#include <regionstr.h>
+#include <resource.h>
+#include <scrnintstr.h>
+#include <syncsrv.h>
+#include <windowstr.h>
+#include <xf86.h>
+#include <xorgVersion.h>
+
+#include "compat-api.h"
+
+#include "driver.h"
+
+#define NESTED_FRAME_MAX_HOLD_MS 50
+
+/* Resource types are few; this bounds the lookup by name */
+#define NESTED_FRAME_MAX_RESTYPE 1024
+
+/* A window announcing its frames through a sync counter */
+typedef struct NestedFrameWindow {
+    WindowPtr pWin;
+    XID       counter;
+    Bool      ignored;   /* held back too long */
+} NestedFrameWindowRec;
+
+static Atom atomSyncRequestCounter;
+
+static inline NestedPrivatePtr
+NestedFrameGetPrivate(ScreenPtr pScreen) {
+    return PNESTED(xf86ScreenToScrn(pScreen));
+}
+
+/* The sync extension doesn't export its counter resource type, so it is
+ * looked up by name, once clients are around: extensions are set up after
+ * the screens. Returns 0 if there is none. */
+static RESTYPE
+NestedFrameCounterType(void) {
+    RESTYPE type;
+    const char *name;
+
+    for (type = 1; type < NESTED_FRAME_MAX_RESTYPE; type++) {
+        name = LookupResourceName(type);
+
+        if (name && !strcmp(name, "SyncCounter"))
+            return type;
+    }
+
+    return 0;
+}
+
+/* Whether the window is in the middle of a frame */
+static Bool
+NestedFrameDrawing(NestedPrivatePtr pNested, NestedFrameWindowRec *pFrame) {
+    SyncCounter *pCounter;
+    Bool odd;
+
+    if (!pFrame->pWin->viewable ||
+        dixLookupResourceByType((void **)&pCounter, pFrame->counter,
+                                pNested->counterType,
+                                serverClient, DixReadAccess) != Success)
+        return FALSE;
+
+    /* Counter values are 64 bit integers since 1.17 */
+#if XORG_VERSION_CURRENT >= XORG_VERSION_NUMERIC(1, 17, 0, 0, 0)
+    odd = pCounter->value & 1;
+#else
+    odd = pCounter->value.lo & 1;
+#endif
+
+    if (!odd)
+        pFrame->ignored = FALSE;
+
+    return odd && !pFrame->ignored;
+}
+
+/* Whether uploads have to wait, at time now */
+static Bool
+NestedFrameWaiting(NestedPrivatePtr pNested, CARD32 now) {
+    Bool waiting = FALSE;
+    int i;
+
+    if ((int)(now - pNested->lastDamage) < pNested->frameHoldOff)
+        waiting = TRUE;
+
+    for (i = 0; i < pNested->numFrameWindows && !waiting; i++)
+        if (NestedFrameDrawing(pNested, &pNested->frameWindows[i]))
+            waiting = TRUE;
+
+    if (waiting &&
+        (int)(now - pNested->holdStart) >= NESTED_FRAME_MAX_HOLD_MS) {
+        for (i = 0; i < pNested->numFrameWindows; i++)
+            if (NestedFrameDrawing(pNested, &pNested->frameWindows[i]))
+                pNested->frameWindows[i].ignored = TRUE;
+
+        waiting = FALSE;
+    }
+
+    return waiting;
+}
+
+/* How long until held back damage has to be looked at again: the end of
+ * the hold-off, or the timeout. The end of a frame comes with a request
+ * from the client, which wakes the server up anyway. */
+static CARD32
+NestedFrameDelay(NestedPrivatePtr pNested, CARD32 now) {
+    int delay = NESTED_FRAME_MAX_HOLD_MS - (int)(now - pNested->holdStart);
+    int holdOff = pNested->frameHoldOff - (int)(now - pNested->lastDamage);
+
+    if (holdOff > 0 && holdOff < delay)
+        delay = holdOff;
+
+    return delay > 0 ? delay : 1;
+}
+
+static CARD32
+NestedFrameTimer(OsTimerPtr timer, CARD32 now, void *arg) {
+    ScreenPtr pScreen = arg;
+    NestedPrivatePtr pNested = NestedFrameGetPrivate(pScreen);
+
+    if (!RegionNotEmpty(&pNested->held))
+        return 0;
+
+    if (NestedFrameWaiting(pNested, now))
+        return NestedFrameDelay(pNested, now);
+
+    NestedUpdateNow(pScreen);
+    return 0;
+}
+
+static void
+NestedFrameRemoveWindow(NestedPrivatePtr pNested, WindowPtr pWin) {
+    int i;
+
+    for (i = 0; i < pNested->numFrameWindows; i++) {
+        if (pNested->frameWindows[i].pWin == pWin) {
+            pNested->frameWindows[i] =
+                pNested->frameWindows[--pNested->numFrameWindows];
+            return;
+        }
+    }
+}
+
+static void
+NestedFramePropertyState(CallbackListPtr *pcbl, void *closure, void *data) {
+    ScreenPtr pScreen = closure;
+    NestedPrivatePtr pNested = NestedFrameGetPrivate(pScreen);
+    PropertyStateRec *rec = data;
+    NestedFrameWindowRec *frameWindows;
+    PropertyPtr pProp = rec->prop;
+
+    if (pProp->propertyName != atomSyncRequestCounter ||
+        rec->win->drawable.pScreen != pScreen)
+        return;
+
+    NestedFrameRemoveWindow(pNested, rec->win);
+
+    /* The second counter is the one telling frames apart */
+    if (rec->state != PropertyNewValue ||
+        pProp->format != 32 || pProp->size < 2)
+        return;
+
+    if (!pNested->counterType)
+        pNested->counterType = NestedFrameCounterType();
+    if (!pNested->counterType)
+        return;
+
+    frameWindows = realloc(pNested->frameWindows,
+                           (pNested->numFrameWindows + 1) *
+                           sizeof(NestedFrameWindowRec));
+    if (!frameWindows)
+        return;
+
+    pNested->frameWindows = frameWindows;
+    frameWindows[pNested->numFrameWindows].pWin = rec->win;
+    frameWindows[pNested->numFrameWindows].counter =
+        ((CARD32 *)pProp->data)[1];
+    frameWindows[pNested->numFrameWindows].ignored = FALSE;
+    pNested->numFrameWindows++;
+}
+
+/*
+ * Public functions
+ */
+
+/* Called with new damage. Returns TRUE if it was held back; otherwise,
+ * pRegion gets what was held back before, to be uploaded along. */
+Bool
+NestedFrameHold(ScreenPtr pScreen, RegionPtr pRegion) {
+    NestedPrivatePtr pNested = NestedFrameGetPrivate(pScreen);
+    CARD32 now;
+
+    if (!pNested->frameSync && pNested->frameHoldOff <= 0)
+        return FALSE;
+
+    now = GetTimeInMillis();
+    if (!RegionNotEmpty(&pNested->held))
+        pNested->holdStart = now;
+    pNested->lastDamage = now;
+
+    if (!NestedFrameWaiting(pNested, now)) {
+        NestedFrameTake(pScreen, pRegion);
+        return FALSE;
+    }
+
+    RegionUnion(&pNested->held, &pNested->held, pRegion);
+
+    pNested->frameTimer = TimerSet(pNested->frameTimer, 0,
+                                   NestedFrameDelay(pNested, now),
+                                   NestedFrameTimer, pScreen);
+    return TRUE;
+}
+
+/* Adds what was held back to pRegion */
+void
+NestedFrameTake(ScreenPtr pScreen, RegionPtr pRegion) {
+    NestedPrivatePtr pNested = NestedFrameGetPrivate(pScreen);
+
+    if (!RegionNotEmpty(&pNested->held))
+        return;
+
+    RegionUnion(pRegion, pRegion, &pNested->held);
+    RegionEmpty(&pNested->held);
+    TimerCancel(pNested->frameTimer);
+}
+
+/* Called from the block handler, to upload frames that got complete */
+void
+NestedFrameCheck(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = NestedFrameGetPrivate(pScreen);
+
+    if (RegionNotEmpty(&pNested->held) &&
+        !NestedFrameWaiting(pNested, GetTimeInMillis()))
+        NestedUpdateNow(pScreen);
+}
+
+Bool
+NestedFrameInit(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = NestedFrameGetPrivate(pScreen);
+
+    RegionNull(&pNested->held);
+    pNested->frameTimer = NULL;
+    pNested->frameWindows = NULL;
+    pNested->numFrameWindows = 0;
+    pNested->counterType = 0;
+
+    if (!pNested->frameSync)
+        return TRUE;
+
+    atomSyncRequestCounter = MakeAtom("_NET_WM_SYNC_REQUEST_COUNTER",
+                                      strlen("_NET_WM_SYNC_REQUEST_COUNTER"),
+                                      TRUE);
+
+    return AddCallback(&PropertyStateCallback, NestedFramePropertyState,
+                       pScreen);
+}
+
+void
+NestedFrameClose(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = NestedFrameGetPrivate(pScreen);
+
+    if (pNested->frameSync)
+        DeleteCallback(&PropertyStateCallback, NestedFramePropertyState,
+                       pScreen);
+
+    TimerFree(pNested->frameTimer);
+    pNested->frameTimer = NULL;
+    free(pNested->frameWindows);
+    pNested->frameWindows = NULL;
+    pNested->numFrameWindows = 0;
+    RegionUninit(&pNested->held);
+}
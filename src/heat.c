@@ -0,0 +1,252 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Damage heat.
+ *
+ * The screen is split into NESTED_HEAT_TILE pixel square tiles, and we
+ * remember when each one was last uploaded. Tiles that keep changing at
+ * a short interval, like video or animations, are "hot"; tiles that
+ * change after a long time of rest are "cold"; the rest is "warm".
+ *
+ * Hot areas are uploaded without going through the tile cache, where they
+ * would only push out content that is likely to come back, and optionally
+ * no more often than Option "HotTileInterval" says. The rest is uploaded
+ * as usual.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <xorg-server.h>
+#include <regionstr.h>
+#include <scrnintstr.h>
+#include <xf86.h>
+
+#include "compat-api.h"
+
+#include "driver.h"
+
+#define NESTED_HEAT_TILE 64
+
+/* A tile is hot once it changed that many times in a row, each within
+ * NESTED_HEAT_HOT_MS of the previous one */
+#define NESTED_HEAT_HOT_MS 100
+#define NESTED_HEAT_HOT_STREAK 8
+
+/* and cold when it changes after that long */
+#define NESTED_HEAT_COLD_MS 10000
+
+typedef struct NestedHeatTile {
+    CARD32        serial;      /* of the last update it was part of */
+    CARD32        lastChange;
+    unsigned char streak;
+} NestedHeatTileRec;
+
+static NestedHeatClass
+NestedHeatTouch(NestedHeatTileRec *pTile, CARD32 now) {
+    CARD32 since = now - pTile->lastChange;
+    Bool seen = pTile->serial != 0;
+
+    pTile->lastChange = now;
+
+    if (!seen || since >= NESTED_HEAT_COLD_MS) {
+        pTile->streak = 0;
+        return NESTED_HEAT_COLD;
+    }
+
+    if (since >= NESTED_HEAT_HOT_MS)
+        pTile->streak = 0;
+    else if (pTile->streak < NESTED_HEAT_HOT_STREAK)
+        pTile->streak++;
+
+    return pTile->streak >= NESTED_HEAT_HOT_STREAK ? NESTED_HEAT_HOT :
+                                                     NESTED_HEAT_WARM;
+}
+
+/* Classifies the tiles pRegion touches, and returns the hot ones in pHot */
+static void
+NestedHeatClassify(NestedPrivatePtr pNested, RegionPtr pRegion,
+                   RegionPtr pHot) {
+    BoxPtr pBox = RegionRects(pRegion);
+    int nBox = RegionNumRects(pRegion);
+    CARD32 now = GetTimeInMillis();
+    int nHot = 0;
+    int x, y;
+
+    if (++pNested->heatSerial == 0)
+        pNested->heatSerial = 1;
+
+    for (; nBox--; pBox++) {
+        for (y = pBox->y1 / NESTED_HEAT_TILE;
+             y <= (pBox->y2 - 1) / NESTED_HEAT_TILE; y++) {
+            for (x = pBox->x1 / NESTED_HEAT_TILE;
+                 x <= (pBox->x2 - 1) / NESTED_HEAT_TILE; x++) {
+                NestedHeatTileRec *pTile =
+                    &pNested->heatTiles[y * pNested->heatColumns + x];
+                NestedHeatClass class;
+                BoxPtr pHotBox;
+
+                if (pTile->serial == pNested->heatSerial)
+                    continue;
+
+                class = NestedHeatTouch(pTile, now);
+                pTile->serial = pNested->heatSerial;
+                pNested->heatStats[class]++;
+
+                if (class != NESTED_HEAT_HOT)
+                    continue;
+
+                /* Runs of hot tiles on a row make a single box */
+                pHotBox = nHot > 0 ? &pNested->heatBoxes[nHot - 1] : NULL;
+                if (pHotBox && pHotBox->y1 == y * NESTED_HEAT_TILE &&
+                    pHotBox->x2 == x * NESTED_HEAT_TILE) {
+                    pHotBox->x2 += NESTED_HEAT_TILE;
+                    continue;
+                }
+
+                pHotBox = &pNested->heatBoxes[nHot++];
+                pHotBox->x1 = x * NESTED_HEAT_TILE;
+                pHotBox->y1 = y * NESTED_HEAT_TILE;
+                pHotBox->x2 = pHotBox->x1 + NESTED_HEAT_TILE;
+                pHotBox->y2 = pHotBox->y1 + NESTED_HEAT_TILE;
+            }
+        }
+    }
+
+    if (nHot > 0) {
+        RegionUninit(pHot);
+        RegionInitBoxes(pHot, pNested->heatBoxes, nHot);
+        RegionIntersect(pHot, pHot, pRegion);
+    }
+}
+
+/*
+ * Public functions
+ */
+
+/* Moves the hot part of pRegion to pHot, or holds it back for a while if
+ * hot areas were uploaded too recently */
+void
+NestedHeatSplit(ScreenPtr pScreen, RegionPtr pRegion, RegionPtr pHot) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+    CARD32 now;
+
+    if (!pNested->heatTiles || !RegionNotEmpty(pRegion))
+        return;
+
+    NestedHeatClassify(pNested, pRegion, pHot);
+    if (!RegionNotEmpty(pHot))
+        return;
+
+    RegionSubtract(pRegion, pRegion, pHot);
+
+    if (pNested->hotTileInterval <= 0)
+        return;
+
+    now = GetTimeInMillis();
+    if ((int)(now - pNested->lastHotUpload) >= pNested->hotTileInterval) {
+        pNested->lastHotUpload = now;
+        return;
+    }
+
+    RegionUnion(&pNested->hotDeferred, &pNested->hotDeferred, pHot);
+    RegionEmpty(pHot);
+
+    /* Host copies must not read from what is held back */
+    NestedAccelMarkStale(pScreen, &pNested->hotDeferred);
+}
+
+/* Called from the block handler. Has the hot areas that were held back
+ * uploaded once it is time, and returns in how many milliseconds that will
+ * be, or -1 if nothing is held back. */
+int
+NestedHeatCheck(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+    int wait;
+
+    if (!RegionNotEmpty(&pNested->hotDeferred))
+        return -1;
+
+    wait = pNested->hotTileInterval -
+           (int)(GetTimeInMillis() - pNested->lastHotUpload);
+    if (wait > 0)
+        return wait;
+
+    DamageDamageRegion(&(*pScreen->GetScreenPixmap)(pScreen)->drawable,
+                       &pNested->hotDeferred);
+    RegionEmpty(&pNested->hotDeferred);
+    return 0;
+}
+
+void
+NestedHeatInit(ScreenPtr pScreen) {
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    int numTiles;
+
+    pNested->heatColumns = (pScrn->virtualX + NESTED_HEAT_TILE - 1) /
+                           NESTED_HEAT_TILE;
+    pNested->heatRows = (pScrn->virtualY + NESTED_HEAT_TILE - 1) /
+                        NESTED_HEAT_TILE;
+    pNested->heatSerial = 0;
+    pNested->lastHotUpload = 0;
+    memset(pNested->heatStats, 0, sizeof(pNested->heatStats));
+    RegionNull(&pNested->hotDeferred);
+
+    numTiles = pNested->heatColumns * pNested->heatRows;
+    pNested->heatTiles = calloc(numTiles, sizeof(NestedHeatTileRec));
+    pNested->heatBoxes = malloc(numTiles * sizeof(BoxRec));
+
+    /* Everything is then uploaded as warm */
+    if (!pNested->heatTiles || !pNested->heatBoxes) {
+        xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+                   "Failed to allocate the damage heat map\n");
+        free(pNested->heatTiles);
+        free(pNested->heatBoxes);
+        pNested->heatTiles = NULL;
+        pNested->heatBoxes = NULL;
+    }
+}
+
+void
+NestedHeatClose(ScreenPtr pScreen) {
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    unsigned long *stats = pNested->heatStats;
+
+    if (stats[NESTED_HEAT_HOT] + stats[NESTED_HEAT_WARM] +
+        stats[NESTED_HEAT_COLD] > 0)
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+                   "Tile updates: %lu hot, %lu warm, %lu cold\n",
+                   stats[NESTED_HEAT_HOT], stats[NESTED_HEAT_WARM],
+                   stats[NESTED_HEAT_COLD]);
+
+    free(pNested->heatTiles);
+    free(pNested->heatBoxes);
+    pNested->heatTiles = NULL;
+    pNested->heatBoxes = NULL;
+    RegionUninit(&pNested->hotDeferred);
+}
@@ -0,0 +1,438 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Reaction-to-display latency benchmark.
+ *
+ * Built by "make bench" when xcb-xtest and xcb-damage are available,
+ * nested-latency measures the time from a press reaching the nested
+ * server to a client's reaction to it being shown on the host. latency.sh
+ * starts an Xvfb host and a nested server on it, and runs it.
+ *
+ * A small window is mapped at the top-left corner of the nested screen,
+ * which changes color on each button (or key) press. For each sample,
+ * a press is injected into the nested server with XTEST, over that
+ * window; the host window of the nested server is watched with Damage,
+ * and the time is taken once the pixel in the middle of the window
+ * changed, read with GetImage.
+ *
+ * The driver doesn't forward host input, so the press doesn't go through
+ * the host: what is measured is the nested server's event delivery, the
+ * client's drawing and the driver's upload, not the full path from a
+ * physical input device to the screen.
+ */
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <xcb/xcb.h>
+#include <xcb/xcb_aux.h>
+#include <xcb/damage.h>
+#include <xcb/xtest.h>
+
+#include "bench-stats.h"
+
+#define LATENCY_SIZE    64  /* of the window on the nested screen */
+#define LATENCY_TIMEOUT 1000 /* ms, before a sample is counted as lost */
+
+typedef struct _Latency {
+    xcb_connection_t *host;
+    xcb_connection_t *nested;
+    xcb_window_t      hostWindow;   /* of the nested server */
+    xcb_window_t      hostRoot;
+    int16_t           hostX;        /* the point watched, on the root */
+    int16_t           hostY;
+    uint8_t           damageEvent;
+    xcb_window_t      window;       /* on the nested screen */
+    xcb_gcontext_t    gc;
+    uint32_t          pixels[2];
+    int               shown;
+} Latency, *LatencyPtr;
+
+static unsigned long
+LatencyNow(void) {
+    struct timespec tp;
+
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return tp.tv_sec * 1000000UL + tp.tv_nsec / 1000;
+}
+
+static int
+LatencyHasTitle(xcb_connection_t *conn, xcb_window_t window,
+                const char *prefix) {
+    xcb_get_property_reply_t *reply;
+    int found = 0;
+
+    reply = xcb_get_property_reply(conn,
+                                   xcb_get_property(conn, 0, window,
+                                                    XCB_ATOM_WM_NAME,
+                                                    XCB_ATOM_STRING, 0, 64),
+                                   NULL);
+    if (reply) {
+        int len = xcb_get_property_value_length(reply);
+
+        found = len >= (int)strlen(prefix) &&
+                !strncmp(xcb_get_property_value(reply), prefix,
+                         strlen(prefix));
+        free(reply);
+    }
+
+    return found;
+}
+
+/* Looks for the host window of the nested server among the top-level
+ * windows and, for window managers reparenting them, their children */
+static xcb_window_t
+LatencyFindWindow(xcb_connection_t *conn, xcb_window_t parent,
+                  const char *prefix, int depth) {
+    xcb_query_tree_reply_t *tree;
+    xcb_window_t *children, found = XCB_NONE;
+    int i, n;
+
+    tree = xcb_query_tree_reply(conn, xcb_query_tree(conn, parent), NULL);
+    if (!tree)
+        return XCB_NONE;
+
+    children = xcb_query_tree_children(tree);
+    n = xcb_query_tree_children_length(tree);
+
+    for (i = n - 1; i >= 0 && !found; i--) {
+        if (LatencyHasTitle(conn, children[i], prefix))
+            found = children[i];
+        else if (depth > 0)
+            found = LatencyFindWindow(conn, children[i], prefix, depth - 1);
+    }
+
+    free(tree);
+    return found;
+}
+
+static int
+LatencyReadPixel(LatencyPtr pLatency, uint32_t *pixel) {
+    xcb_get_image_reply_t *image;
+    xcb_translate_coordinates_reply_t *coords;
+    int len;
+
+    coords = xcb_translate_coordinates_reply(pLatency->host,
+                 xcb_translate_coordinates(pLatency->host, pLatency->hostRoot,
+                                           pLatency->hostWindow,
+                                           pLatency->hostX, pLatency->hostY),
+                 NULL);
+    if (!coords)
+        return 0;
+
+    image = xcb_get_image_reply(pLatency->host,
+                xcb_get_image(pLatency->host, XCB_IMAGE_FORMAT_Z_PIXMAP,
+                              pLatency->hostWindow,
+                              coords->dst_x, coords->dst_y, 1, 1, ~0),
+                NULL);
+    free(coords);
+
+    if (!image)
+        return 0;
+
+    len = xcb_get_image_data_length(image);
+    *pixel = 0;
+    memcpy(pixel, xcb_get_image_data(image), len < 4 ? len : 4);
+    free(image);
+    return 1;
+}
+
+/* The nested client's part: flips the window's color on each press */
+static void
+LatencyNestedEvents(LatencyPtr pLatency) {
+    xcb_generic_event_t *ev;
+    xcb_rectangle_t rect = { 0, 0, LATENCY_SIZE, LATENCY_SIZE };
+
+    while ((ev = xcb_poll_for_event(pLatency->nested))) {
+        switch (ev->response_type & ~0x80) {
+        case XCB_BUTTON_PRESS:
+        case XCB_KEY_PRESS:
+            pLatency->shown ^= 1;
+            /* fall through */
+        case XCB_EXPOSE:
+            xcb_change_gc(pLatency->nested, pLatency->gc,
+                          XCB_GC_FOREGROUND,
+                          &pLatency->pixels[pLatency->shown]);
+            xcb_poly_fill_rectangle(pLatency->nested, pLatency->window,
+                                    pLatency->gc, 1, &rect);
+            xcb_flush(pLatency->nested);
+            break;
+        }
+
+        free(ev);
+    }
+}
+
+/* Returns whether the watched pixel changed from before */
+static int
+LatencyHostEvents(LatencyPtr pLatency, uint32_t before) {
+    xcb_generic_event_t *ev;
+    int damaged = 0;
+    uint32_t pixel;
+
+    while ((ev = xcb_poll_for_event(pLatency->host))) {
+        if ((ev->response_type & ~0x80) ==
+            pLatency->damageEvent + XCB_DAMAGE_NOTIFY)
+            damaged = 1;
+
+        free(ev);
+    }
+
+    return damaged && LatencyReadPixel(pLatency, &pixel) && pixel != before;
+}
+
+/* Injects a press into the nested server, and returns how long it took
+ * for the reaction to be seen on the host, in us, or 0 if it wasn't */
+static unsigned long
+LatencySample(LatencyPtr pLatency, int keycode) {
+    struct pollfd fds[2];
+    unsigned long start, elapsed = 0;
+    uint32_t before;
+    uint8_t press = keycode ? XCB_KEY_PRESS : XCB_BUTTON_PRESS;
+    uint8_t release = keycode ? XCB_KEY_RELEASE : XCB_BUTTON_RELEASE;
+    uint8_t detail = keycode ? keycode : 1;
+
+    if (!LatencyReadPixel(pLatency, &before))
+        return 0;
+
+    start = LatencyNow();
+    xcb_test_fake_input(pLatency->nested, press, detail, XCB_CURRENT_TIME,
+                        XCB_NONE, 0, 0, 0);
+    xcb_test_fake_input(pLatency->nested, release, detail, XCB_CURRENT_TIME,
+                        XCB_NONE, 0, 0, 0);
+    xcb_flush(pLatency->nested);
+
+    fds[0].fd = xcb_get_file_descriptor(pLatency->host);
+    fds[0].events = POLLIN;
+    fds[1].fd = xcb_get_file_descriptor(pLatency->nested);
+    fds[1].events = POLLIN;
+
+    while (elapsed < LATENCY_TIMEOUT * 1000UL) {
+        LatencyNestedEvents(pLatency);
+
+        if (LatencyHostEvents(pLatency, before))
+            return LatencyNow() - start;
+
+        poll(fds, 2, LATENCY_TIMEOUT - elapsed / 1000);
+        elapsed = LatencyNow() - start;
+    }
+
+    return 0;
+}
+
+static int
+LatencySetup(LatencyPtr pLatency, const char *nestedName) {
+    xcb_screen_t *host, *nested;
+    const xcb_query_extension_reply_t *ext;
+    xcb_get_geometry_reply_t *geom;
+    xcb_translate_coordinates_reply_t *coords;
+    xcb_damage_query_version_reply_t *version;
+    uint32_t values[3];
+    char prefix[64];
+    const char *name = strchr(nestedName, ':');
+    int n;
+
+    pLatency->host = xcb_connect(NULL, &n);
+    if (xcb_connection_has_error(pLatency->host)) {
+        fprintf(stderr, "Can't open the host display\n");
+        return 0;
+    }
+    host = xcb_aux_get_screen(pLatency->host, n);
+    pLatency->hostRoot = host->root;
+
+    pLatency->nested = xcb_connect(nestedName, &n);
+    if (xcb_connection_has_error(pLatency->nested)) {
+        fprintf(stderr, "Can't open the nested display %s\n", nestedName);
+        return 0;
+    }
+    nested = xcb_aux_get_screen(pLatency->nested, n);
+
+    if (!xcb_get_extension_data(pLatency->nested, &xcb_test_id)->present) {
+        fprintf(stderr, "The nested server has no XTEST\n");
+        return 0;
+    }
+
+    ext = xcb_get_extension_data(pLatency->host, &xcb_damage_id);
+    if (!ext->present) {
+        fprintf(stderr, "The host has no DAMAGE\n");
+        return 0;
+    }
+    pLatency->damageEvent = ext->first_event;
+    version = xcb_damage_query_version_reply(pLatency->host,
+                  xcb_damage_query_version(pLatency->host, 1, 1), NULL);
+    free(version);
+
+    /* Windows are titled "Xorg at :1.0 nested on ..." (xcbclient.c) */
+    snprintf(prefix, sizeof(prefix), "Xorg at %.*s.",
+             (int)strcspn(name ? name : ":0", "."), name ? name : ":0");
+    pLatency->hostWindow = LatencyFindWindow(pLatency->host, host->root,
+                                             prefix, 1);
+    if (!pLatency->hostWindow) {
+        fprintf(stderr, "No host window titled \"%s...\"\n", prefix);
+        return 0;
+    }
+
+    /* The window on the nested screen */
+    pLatency->pixels[0] = nested->black_pixel;
+    pLatency->pixels[1] = nested->white_pixel;
+    pLatency->shown = 0;
+
+    pLatency->window = xcb_generate_id(pLatency->nested);
+    values[0] = nested->black_pixel;
+    values[1] = 1;
+    values[2] = XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_BUTTON_PRESS |
+                XCB_EVENT_MASK_KEY_PRESS;
+    xcb_create_window(pLatency->nested, XCB_COPY_FROM_PARENT,
+                      pLatency->window, nested->root, 0, 0,
+                      LATENCY_SIZE, LATENCY_SIZE, 0,
+                      XCB_WINDOW_CLASS_INPUT_OUTPUT, XCB_COPY_FROM_PARENT,
+                      XCB_CW_BACK_PIXEL | XCB_CW_OVERRIDE_REDIRECT |
+                      XCB_CW_EVENT_MASK, values);
+    pLatency->gc = xcb_generate_id(pLatency->nested);
+    xcb_create_gc(pLatency->nested, pLatency->gc, pLatency->window, 0, NULL);
+    xcb_map_window(pLatency->nested, pLatency->window);
+    xcb_set_input_focus(pLatency->nested, XCB_INPUT_FOCUS_POINTER_ROOT,
+                        pLatency->window, XCB_CURRENT_TIME);
+    xcb_flush(pLatency->nested);
+
+    /* The point watched: the middle of that window, on the host */
+    geom = xcb_get_geometry_reply(pLatency->host,
+               xcb_get_geometry(pLatency->host, pLatency->hostWindow), NULL);
+    coords = xcb_translate_coordinates_reply(pLatency->host,
+                 xcb_translate_coordinates(pLatency->host,
+                                           pLatency->hostWindow, host->root,
+                                           LATENCY_SIZE / 2,
+                                           LATENCY_SIZE / 2),
+                 NULL);
+    if (!geom || !coords || geom->width < LATENCY_SIZE ||
+        geom->height < LATENCY_SIZE) {
+        fprintf(stderr, "The host window can't be used\n");
+        free(geom);
+        free(coords);
+        return 0;
+    }
+
+    pLatency->hostX = coords->dst_x;
+    pLatency->hostY = coords->dst_y;
+    free(geom);
+    free(coords);
+
+    xcb_damage_create(pLatency->host, xcb_generate_id(pLatency->host),
+                      pLatency->hostWindow,
+                      XCB_DAMAGE_REPORT_LEVEL_RAW_RECTANGLES);
+
+    xcb_flush(pLatency->host);
+
+    /* Presses go to the window under the pointer */
+    xcb_test_fake_input(pLatency->nested, XCB_MOTION_NOTIFY, 0,
+                        XCB_CURRENT_TIME, nested->root,
+                        LATENCY_SIZE / 2, LATENCY_SIZE / 2, 0);
+    xcb_flush(pLatency->nested);
+
+    /* Let the window show up, and the pointer get there */
+    usleep(500000);
+    LatencyNestedEvents(pLatency);
+    usleep(100000);
+
+    return 1;
+}
+
+static void
+LatencyUsage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-n SAMPLES] [-i INTERVAL] [-k KEYCODE] "
+            "NESTED-DISPLAY\n"
+            "  -n  samples taken (default: 200)\n"
+            "  -i  ms between samples (default: 50)\n"
+            "  -k  press that key instead of the first button\n"
+            "Presses are injected into NESTED-DISPLAY; the host display "
+            "is DISPLAY.\n",
+            name);
+    exit(1);
+}
+
+int
+main(int argc, char **argv) {
+    Latency latency;
+    uint64_t *samples;
+    int numSamples = 200, interval = 50, keycode = 0;
+    int opt, i, n = 0;
+
+    while ((opt = getopt(argc, argv, "n:i:k:")) != -1) {
+        switch (opt) {
+        case 'n':
+            numSamples = atoi(optarg);
+            if (numSamples <= 0)
+                LatencyUsage(argv[0]);
+            break;
+        case 'i':
+            interval = atoi(optarg);
+            break;
+        case 'k':
+            keycode = atoi(optarg);
+            if (keycode < 8 || keycode > 255)
+                LatencyUsage(argv[0]);
+            break;
+        default:
+            LatencyUsage(argv[0]);
+        }
+    }
+
+    if (optind != argc - 1)
+        LatencyUsage(argv[0]);
+
+    memset(&latency, 0, sizeof(latency));
+    if (!LatencySetup(&latency, argv[optind]))
+        return 1;
+
+    samples = calloc(numSamples, sizeof(uint64_t));
+    if (!samples)
+        return 1;
+
+    for (i = 0; i < numSamples; i++) {
+        unsigned long us = LatencySample(&latency, keycode);
+
+        if (us)
+            samples[n++] = us;
+
+        usleep(interval * 1000);
+        LatencyNestedEvents(&latency);
+    }
+
+    if (n == 0) {
+        fprintf(stderr, "No reaction to a press was seen on the host\n");
+        return 1;
+    }
+
+    printf("%d samples, %d lost\n", n, numSamples - n);
+    BenchPrintLatency(samples, n);
+    printf("\n");
+
+    free(samples);
+    xcb_disconnect(latency.nested);
+    xcb_disconnect(latency.host);
+    return 0;
+}
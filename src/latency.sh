@@ -0,0 +1,72 @@
+#!/bin/sh
+#
+# Measures how long a reaction of a nested client takes to show up on the
+# host: starts an Xvfb host and a nested Xorg on it, and runs
+# nested-latency (see latency.c) against both. Presses are injected into
+# the nested server, which gets no input of its own. Arguments are passed
+# to nested-latency.
+#
+# Environment:
+#   HOST_DISPLAY     display of the Xvfb host (default: :90)
+#   NESTED_DISPLAY   display of the nested server (default: :91)
+#   NESTED_OPTIONS   lines added to the Device section, to measure options
+#   XORG             the X server to run nested (default: Xorg), which
+#                    only takes a config file outside of its config
+#                    directories when run as root
+#   MODULE_PATH      module path of the nested server, e.g.
+#                    $PWD/src/.libs,/usr/lib/xorg/modules to try the
+#                    driver just built
+
+HOST_DISPLAY=${HOST_DISPLAY:-:90}
+NESTED_DISPLAY=${NESTED_DISPLAY:-:91}
+XORG=${XORG:-Xorg}
+
+dir=$(mktemp -d) || exit 1
+trap 'kill $nested $host 2>/dev/null; rm -rf "$dir"' EXIT
+trap 'exit 1' INT TERM
+
+cat > "$dir/xorg.conf" <<EOF
+Section "ServerFlags"
+    Option "AutoEnableDevices" "false"
+    Option "AutoAddDevices" "false"
+    Option "AllowEmptyInput" "true"
+EndSection
+
+Section "Device"
+    Identifier "device1"
+    Driver "nested"
+    Option "Display" "$HOST_DISPLAY"
+$NESTED_OPTIONS
+EndSection
+
+Section "Screen"
+    Identifier "screen1"
+    Device "device1"
+    DefaultDepth 24
+    SubSection "Display"
+        Depth 24
+        Modes "1024x768"
+    EndSubSection
+EndSection
+
+Section "ServerLayout"
+    Identifier "layout1"
+    Screen "screen1"
+EndSection
+EOF
+
+Xvfb "$HOST_DISPLAY" -screen 0 1280x1024x24 -nolisten tcp 2>"$dir/Xvfb.log" &
+host=$!
+sleep 1
+
+DISPLAY=$HOST_DISPLAY $XORG "$NESTED_DISPLAY" -config "$dir/xorg.conf" \
+    -noreset -logfile "$dir/Xorg.log" \
+    ${MODULE_PATH:+-modulepath "$MODULE_PATH"} 2>/dev/null &
+nested=$!
+sleep 2
+
+if ! DISPLAY=$HOST_DISPLAY "$(dirname "$0")/nested-latency" "$@" \
+     "$NESTED_DISPLAY"; then
+    tail -n 20 "$dir/Xorg.log" >&2
+    exit 1
+fi
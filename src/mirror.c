@@ -0,0 +1,186 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Mirrors on other host displays.
+ *
+ * Each display after the first one of Option "Display" gets a window
+ * showing the whole screen, fed from the same framebuffer. The damage the
+ * shadow layer reports is added to what each mirror still has to be sent,
+ * and that is uploaded once the mirror has gone through the previous
+ * update. A slow or hidden mirror so only accumulates damage, instead of
+ * holding back the primary window and the other mirrors. Commands of the
+ * acceleration layer are only replayed on the primary display.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+
+#include <xorg-server.h>
+#include <regionstr.h>
+#include <scrnintstr.h>
+#include <xf86.h>
+
+#include "compat-api.h"
+
+#include "driver.h"
+
+static void
+NestedMirrorSend(NestedMirrorPtr pMirror) {
+    BoxPtr pBox = RegionRects(&pMirror->pending);
+    int nBox = RegionNumRects(&pMirror->pending);
+
+    while (nBox--) {
+        NestedClientUpdateScreen(pMirror->client,
+                                 pBox->x1, pBox->y1,
+                                 pBox->x2, pBox->y2);
+        pBox++;
+    }
+
+    RegionEmpty(&pMirror->pending);
+    NestedClientFlush(pMirror->client);
+}
+
+/* Sends what the mirror is missing, if it can be seen and has caught up.
+ * Returns whether something is left for later. */
+static Bool
+NestedMirrorTrySend(NestedPrivatePtr pNested, NestedMirrorPtr pMirror) {
+    if (!pMirror->client || !RegionNotEmpty(&pMirror->pending))
+        return FALSE;
+
+    if (pNested->blanked || pNested->dpmsOff)
+        return FALSE;
+
+    if (!NestedClientIsVisible(pMirror->client) ||
+        !NestedClientIsReady(pMirror->client))
+        return TRUE;
+
+    NestedMirrorSend(pMirror);
+    return FALSE;
+}
+
+void
+NestedMirrorUpdate(ScreenPtr pScreen, RegionPtr pDamage) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+    int i;
+
+    for (i = 0; i < pNested->numMirrors; i++) {
+        NestedMirrorPtr pMirror = &pNested->mirrors[i];
+
+        if (!pMirror->client)
+            continue;
+
+        RegionUnion(&pMirror->pending, &pMirror->pending, pDamage);
+        NestedMirrorTrySend(pNested, pMirror);
+    }
+}
+
+Bool
+NestedMirrorCheckEvents(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+    Bool waiting = FALSE;
+    int i;
+
+    for (i = 0; i < pNested->numMirrors; i++) {
+        NestedMirrorPtr pMirror = &pNested->mirrors[i];
+
+        if (!pMirror->client)
+            continue;
+
+        NestedClientCheckEvents(pMirror->client);
+
+        if (NestedMirrorTrySend(pNested, pMirror))
+            waiting = TRUE;
+    }
+
+    return waiting;
+}
+
+/* Blanks the mirrors, and has everything sent again once unblanked */
+void
+NestedMirrorBlank(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+    BoxRec box;
+    int i;
+
+    box.x1 = 0;
+    box.y1 = 0;
+    box.x2 = pScreen->width;
+    box.y2 = pScreen->height;
+
+    for (i = 0; i < pNested->numMirrors; i++) {
+        NestedMirrorPtr pMirror = &pNested->mirrors[i];
+
+        if (!pMirror->client)
+            continue;
+
+        RegionReset(&pMirror->pending, &box);
+        NestedClientFillRects(pMirror->client, 1, &box, pScreen->blackPixel);
+        NestedClientFlush(pMirror->client);
+    }
+}
+
+void
+NestedMirrorInit(ScreenPtr pScreen) {
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    int i;
+
+    for (i = 0; i < pNested->numMirrors; i++) {
+        NestedMirrorPtr pMirror = &pNested->mirrors[i];
+
+        RegionNull(&pMirror->pending);
+        pMirror->client = NestedClientCreateMirror(pNested->clientData,
+                                                   pMirror->display,
+                                                   pNested->fullscreen);
+
+        /* The screen goes on without it */
+        if (!pMirror->client) {
+            xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+                       "Failed to mirror the screen to %s\n",
+                       pMirror->display);
+            continue;
+        }
+
+        NestedClientSetTileCacheSize(pMirror->client, pNested->tileCacheSize);
+    }
+}
+
+/* Mirrors use the primary client's framebuffer, so this has to be called
+ * before closing it */
+void
+NestedMirrorClose(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+    int i;
+
+    for (i = 0; i < pNested->numMirrors; i++) {
+        NestedMirrorPtr pMirror = &pNested->mirrors[i];
+
+        if (pMirror->client)
+            NestedClientCloseScreen(pMirror->client);
+
+        pMirror->client = NULL;
+        RegionUninit(&pMirror->pending);
+    }
+}
@@ -0,0 +1,406 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Null client backend, built with ./configure --with-backend=null.
+ *
+ * There is no host: the framebuffer is plain memory, and everything sent
+ * to the host is counted and discarded. The host window is always
+ * visible and the host is always ready, so the whole upload path runs as
+ * it would on a fast host. This measures what the driver, fb, shadow and
+ * damage cost by themselves, and lets many nested servers run headless
+ * for load tests. Input comes from nowhere: the descriptor handed to the
+ * input driver is a pipe nothing is written to.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <xorg-server.h>
+#include <xf86.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "client.h"
+#include "probes.h"
+
+/* Size of the screen of the imaginary host, for Option "Fullscreen" */
+#define NULL_HOST_WIDTH  1920
+#define NULL_HOST_HEIGHT 1080
+
+struct NestedClientPrivate {
+    int scrnIndex; /* stored only for xf86DrvMsg usage */
+    int width;
+    int height;
+    int bitsPerPixel;
+    char *data;
+    Bool isMirror; /* data belongs to the primary client */
+    int pipe[2];
+    uint32_t lastId; /* windows and glyphs */
+    unsigned int fence;
+    NestedClientStats stats;
+};
+
+Bool
+NestedClientCheckDisplay(int scrnIndex, OutputPtr output) {
+    if (output->name != NULL) {
+        xf86DrvMsg(scrnIndex, X_ERROR,
+                   "No output %s without a host.\n", output->name);
+        return FALSE;
+    }
+
+    output->width = NULL_HOST_WIDTH;
+    output->height = NULL_HOST_HEIGHT;
+    return TRUE;
+}
+
+Bool
+NestedClientValidDepth(int depth) {
+    return depth == 15 || depth == 16 || depth == 24;
+}
+
+static NestedClientPrivatePtr
+NestedClientAlloc(int scrnIndex, int width, int height, int bitsPerPixel) {
+    NestedClientPrivatePtr pPriv = calloc(1, sizeof(struct NestedClientPrivate));
+
+    if (!pPriv)
+        return NULL;
+
+    pPriv->scrnIndex = scrnIndex;
+    pPriv->width = width;
+    pPriv->height = height;
+    pPriv->bitsPerPixel = bitsPerPixel;
+
+    if (pipe(pPriv->pipe) == -1) {
+        xf86DrvMsg(scrnIndex, X_ERROR, "pipe failed.\n");
+        free(pPriv);
+        return NULL;
+    }
+
+    return pPriv;
+}
+
+NestedClientPrivatePtr
+NestedClientCreateScreen(int scrnIndex,
+                         Bool wantFullscreenHint,
+                         Bool rootless,
+                         Bool lowLatency,
+                         int width,
+                         int height,
+                         int numOutputs,
+                         const Output *outputs,
+                         int depth,
+                         int bitsPerPixel,
+                         Pixel *retRedMask,
+                         Pixel *retGreenMask,
+                         Pixel *retBlueMask) {
+    NestedClientPrivatePtr pPriv;
+
+    pPriv = NestedClientAlloc(scrnIndex, width, height, bitsPerPixel);
+    if (!pPriv)
+        return NULL;
+
+    pPriv->data = calloc(height, width * bitsPerPixel / 8);
+    if (!pPriv->data) {
+        NestedClientCloseScreen(pPriv);
+        return NULL;
+    }
+
+    switch (depth) {
+    case 15:
+        *retRedMask = 0x7c00;
+        *retGreenMask = 0x03e0;
+        *retBlueMask = 0x001f;
+        break;
+    case 16:
+        *retRedMask = 0xf800;
+        *retGreenMask = 0x07e0;
+        *retBlueMask = 0x001f;
+        break;
+    default:
+        *retRedMask = 0xff0000;
+        *retGreenMask = 0x00ff00;
+        *retBlueMask = 0x0000ff;
+        break;
+    }
+
+    xf86DrvMsg(scrnIndex, X_INFO,
+               "Null backend: %dx%d, nothing is shown.\n", width, height);
+    return pPriv;
+}
+
+NestedClientPrivatePtr
+NestedClientCreateMirror(NestedClientPrivatePtr primary,
+                         const char *displayName,
+                         Bool wantFullscreenHint) {
+    NestedClientPrivatePtr pPriv;
+
+    pPriv = NestedClientAlloc(primary->scrnIndex, primary->width,
+                              primary->height, primary->bitsPerPixel);
+    if (!pPriv)
+        return NULL;
+
+    pPriv->data = primary->data;
+    pPriv->isMirror = TRUE;
+    return pPriv;
+}
+
+uint32_t
+NestedClientAddWindow(NestedClientPrivatePtr pPriv,
+                      int x, int y,
+                      int width, int height) {
+    return ++pPriv->lastId;
+}
+
+void
+NestedClientConfigureWindow(NestedClientPrivatePtr pPriv,
+                            uint32_t id,
+                            int x, int y,
+                            int width, int height) {
+}
+
+void
+NestedClientRestackWindow(NestedClientPrivatePtr pPriv,
+                          uint32_t id,
+                          uint32_t above) {
+}
+
+void
+NestedClientRemoveWindow(NestedClientPrivatePtr pPriv, uint32_t id) {
+}
+
+void
+NestedClientSetPaced(NestedClientPrivatePtr pPriv) {
+}
+
+Bool
+NestedClientIsReady(NestedClientPrivatePtr pPriv) {
+    return TRUE;
+}
+
+void
+NestedClientOutlineBoxes(NestedClientPrivatePtr pPriv, int nBox,
+                         BoxPtr pBox) {
+}
+
+Bool
+NestedClientDrawText(NestedClientPrivatePtr pPriv, const char *text,
+                     BoxPtr pBox) {
+    return FALSE;
+}
+
+unsigned int
+NestedClientFence(NestedClientPrivatePtr pPriv) {
+    return ++pPriv->fence;
+}
+
+Bool
+NestedClientFenceDone(NestedClientPrivatePtr pPriv, unsigned int fence) {
+    return TRUE;
+}
+
+char *
+NestedClientGetFrameBuffer(NestedClientPrivatePtr pPriv) {
+    return pPriv->data;
+}
+
+void
+NestedClientUpdateScreen(NestedClientPrivatePtr pPriv, int16_t x1,
+                         int16_t y1, int16_t x2, int16_t y2) {
+    unsigned long bytes = (x2 - x1) * (y2 - y1) * pPriv->bitsPerPixel / 8;
+
+    pPriv->stats.putRects++;
+    pPriv->stats.putBytes += bytes;
+    NESTED_PROBE6(put, x1, y1, x2 - x1, y2 - y1, bytes, NESTED_PROBE_PUT);
+}
+
+void
+NestedClientUpdateScreenUncached(NestedClientPrivatePtr pPriv, int16_t x1,
+                                 int16_t y1, int16_t x2, int16_t y2) {
+    NestedClientUpdateScreen(pPriv, x1, y1, x2, y2);
+}
+
+Bool
+NestedClientCoarseInit(NestedClientPrivatePtr pPriv) {
+    return TRUE;
+}
+
+void
+NestedClientUpdateScreenCoarse(NestedClientPrivatePtr pPriv, int16_t x1,
+                               int16_t y1, int16_t x2, int16_t y2) {
+}
+
+void
+NestedClientCopyArea(NestedClientPrivatePtr pPriv, int nBox, BoxPtr pBox,
+                     int dx, int dy) {
+}
+
+void
+NestedClientFillRects(NestedClientPrivatePtr pPriv, int nBox, BoxPtr pBox,
+                      Pixel pixel) {
+}
+
+Bool
+NestedClientPutSharedImage(NestedClientPrivatePtr pPriv,
+                           int shmid,
+                           uint32_t offset,
+                           int stride,
+                           int16_t x,
+                           int16_t y,
+                           uint16_t width,
+                           uint16_t height) {
+    unsigned long bytes = width * height * pPriv->bitsPerPixel / 8;
+
+    pPriv->stats.shmRects++;
+    pPriv->stats.shmBytes += bytes;
+    NESTED_PROBE6(put, x, y, width, height, bytes, NESTED_PROBE_SHM);
+    return TRUE;
+}
+
+void
+NestedClientSync(NestedClientPrivatePtr pPriv) {
+}
+
+Bool
+NestedClientRenderInit(NestedClientPrivatePtr pPriv) {
+    return TRUE;
+}
+
+uint32_t
+NestedClientAddGlyph(NestedClientPrivatePtr pPriv, uint16_t width,
+                     uint16_t height, int16_t x, int16_t y,
+                     int16_t xOff, int16_t yOff,
+                     const uint8_t *data, int stride) {
+    return ++pPriv->lastId;
+}
+
+void
+NestedClientFreeGlyph(NestedClientPrivatePtr pPriv, uint32_t id) {
+}
+
+void
+NestedClientReleaseGlyphs(NestedClientPrivatePtr pPriv) {
+}
+
+void
+NestedClientCompositeGlyphs(NestedClientPrivatePtr pPriv, int nBox,
+                            BoxPtr pBox, uint16_t red, uint16_t green,
+                            uint16_t blue, uint16_t alpha, Bool useMask,
+                            int nGlyphs, NestedGlyphPtr pGlyphs) {
+}
+
+Bool
+NestedClientVideoInit(NestedClientPrivatePtr pPriv) {
+    return TRUE;
+}
+
+Bool
+NestedClientVideoHasFormat(NestedClientPrivatePtr pPriv, int id) {
+    return TRUE;
+}
+
+Bool
+NestedClientVideoPutFrame(NestedClientPrivatePtr pPriv, int id, int width,
+                          int height, const uint8_t **planes,
+                          const int *pitches) {
+    return TRUE;
+}
+
+void
+NestedClientVideoShow(NestedClientPrivatePtr pPriv, int nBox, BoxPtr pBox,
+                      int16_t srcX, int16_t srcY,
+                      uint16_t srcWidth, uint16_t srcHeight,
+                      int16_t dstX, int16_t dstY,
+                      uint16_t dstWidth, uint16_t dstHeight) {
+}
+
+void
+NestedClientVideoStop(NestedClientPrivatePtr pPriv) {
+}
+
+void
+NestedClientFlush(NestedClientPrivatePtr pPriv) {
+    pPriv->stats.flushes++;
+}
+
+void
+NestedClientSetTileCacheSize(NestedClientPrivatePtr pPriv, int numTiles) {
+}
+
+void
+NestedClientGetTileCacheStats(NestedClientPrivatePtr pPriv,
+                              unsigned long *hits, unsigned long *misses) {
+    *hits = 0;
+    *misses = 0;
+}
+
+void
+NestedClientGetLatencyStats(NestedClientPrivatePtr pPriv,
+                            unsigned long *frames, unsigned long *average,
+                            unsigned long *maximum) {
+    *frames = 0;
+    *average = 0;
+    *maximum = 0;
+}
+
+void
+NestedClientGetStats(NestedClientPrivatePtr pPriv,
+                     NestedClientStatsPtr pStats) {
+    *pStats = pPriv->stats;
+}
+
+void
+NestedClientHideCursor(NestedClientPrivatePtr pPriv) {
+}
+
+Bool
+NestedClientIsVisible(NestedClientPrivatePtr pPriv) {
+    return TRUE;
+}
+
+Bool
+NestedClientGetOcclusion(NestedClientPrivatePtr pPriv, int *nBox,
+                         BoxPtr *ppBox) {
+    return FALSE;
+}
+
+void
+NestedClientCheckEvents(NestedClientPrivatePtr pPriv) {
+}
+
+void
+NestedClientCloseScreen(NestedClientPrivatePtr pPriv) {
+    close(pPriv->pipe[0]);
+    close(pPriv->pipe[1]);
+
+    if (!pPriv->isMirror)
+        free(pPriv->data);
+
+    free(pPriv);
+}
+
+int
+NestedClientGetFileDescriptor(NestedClientPrivatePtr pPriv) {
+    return pPriv->pipe[0];
+}
@@ -0,0 +1,214 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Upload order.
+ *
+ * What the user is looking at, the area around the pointer and the window
+ * having the focus, is uploaded first, then what was damaged earlier and
+ * couldn't be uploaded yet, then the rest. With Option "UploadBudget",
+ * at most that many pixels are uploaded per frame: what doesn't fit is
+ * left for the next one, which starts once the host has gone through this
+ * one. Under load, the host so shows the parts that matter most first,
+ * instead of whatever the damage region happened to list first.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <limits.h>
+
+#include <xorg-server.h>
+#include <inputstr.h>
+#include <mipointer.h>
+#include <regionstr.h>
+#include <scrnintstr.h>
+#include <windowstr.h>
+#include <xf86.h>
+
+#include "compat-api.h"
+
+#include "driver.h"
+
+/* Side of the square around the pointer uploaded first */
+#define NESTED_PRIORITY_POINTER_SIZE 256
+
+/* How often a paced host is checked on when a frame is due */
+#define NESTED_PRIORITY_RETRY_MS 10
+
+static void
+NestedPriorityAddBox(RegionPtr pRegion, int x1, int y1, int x2, int y2) {
+    RegionRec region;
+    BoxRec box;
+
+    box.x1 = x1;
+    box.y1 = y1;
+    box.x2 = x2;
+    box.y2 = y2;
+
+    RegionInit(&region, &box, 1);
+    RegionUnion(pRegion, pRegion, &region);
+    RegionUninit(&region);
+}
+
+/* The area around the pointer, and the top-level window having the focus */
+static void
+NestedPriorityGetRegion(ScreenPtr pScreen, RegionPtr pRegion) {
+    DeviceIntPtr pKeyboard = inputInfo.keyboard;
+    DeviceIntPtr pPointer = inputInfo.pointer;
+    WindowPtr pWin;
+    int x, y;
+
+    if (pPointer && miPointerGetScreen(pPointer) == pScreen) {
+        miPointerGetPosition(pPointer, &x, &y);
+        NestedPriorityAddBox(pRegion,
+                             x - NESTED_PRIORITY_POINTER_SIZE / 2,
+                             y - NESTED_PRIORITY_POINTER_SIZE / 2,
+                             x + NESTED_PRIORITY_POINTER_SIZE / 2,
+                             y + NESTED_PRIORITY_POINTER_SIZE / 2);
+    }
+
+    if (!pKeyboard || !pKeyboard->focus)
+        return;
+
+    pWin = pKeyboard->focus->win;
+    if (pWin == NoneWin || pWin == PointerRootWin ||
+        pWin == FollowKeyboardWin || !pWin->parent ||
+        pWin->drawable.pScreen != pScreen || !pWin->realized)
+        return;
+
+    /* Along with its frame, if any */
+    while (pWin->parent->parent)
+        pWin = pWin->parent;
+
+    NestedPriorityAddBox(pRegion,
+                         pWin->drawable.x - wBorderWidth(pWin),
+                         pWin->drawable.y - wBorderWidth(pWin),
+                         pWin->drawable.x + pWin->drawable.width +
+                         wBorderWidth(pWin),
+                         pWin->drawable.y + pWin->drawable.height +
+                         wBorderWidth(pWin));
+}
+
+/* Uploads pRegion box by box, as much as the budget allows, adding what
+ * was to pSent. Returns what is left of the budget. */
+static int
+NestedPrioritySend(ScreenPtr pScreen, RegionPtr pRegion, int budget,
+                   RegionPtr pSent) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+    BoxPtr pBox = RegionRects(pRegion);
+    int nBox = RegionNumRects(pRegion);
+
+    for (; nBox-- && budget > 0; pBox++) {
+        BoxRec box = *pBox;
+        int width = box.x2 - box.x1;
+
+        /* Whole rows of the box, at least one */
+        if (width * (box.y2 - box.y1) > budget)
+            box.y2 = box.y1 + max(budget / width, 1);
+
+        if (!NestedRefineCoarse(pScreen, &box))
+            NestedClientUpdateScreen(pNested->clientData,
+                                     box.x1, box.y1, box.x2, box.y2);
+
+        budget -= width * (box.y2 - box.y1);
+        NestedPriorityAddBox(pSent, box.x1, box.y1, box.x2, box.y2);
+    }
+
+    return budget;
+}
+
+/* Uploads pRegion in order, which is left with what was actually uploaded */
+void
+NestedPriorityUpload(ScreenPtr pScreen, RegionPtr pRegion) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+    RegionRec first, older, newer, sent;
+    int budget = pNested->uploadBudget > 0 ? pNested->uploadBudget : INT_MAX;
+
+    RegionNull(&first);
+    NestedPriorityGetRegion(pScreen, &first);
+    RegionIntersect(&first, &first, pRegion);
+
+    RegionNull(&older);
+    RegionIntersect(&older, pRegion, &pNested->backlog);
+    RegionSubtract(&older, &older, &first);
+
+    RegionNull(&newer);
+    RegionSubtract(&newer, pRegion, &first);
+    RegionSubtract(&newer, &newer, &older);
+
+    RegionNull(&sent);
+    budget = NestedPrioritySend(pScreen, &first, budget, &sent);
+    budget = NestedPrioritySend(pScreen, &older, budget, &sent);
+    NestedPrioritySend(pScreen, &newer, budget, &sent);
+
+    /* Whatever of the backlog isn't in pRegion went another way, so it is
+     * only made of what is left now */
+    RegionSubtract(&pNested->backlog, pRegion, &sent);
+    pNested->backlogDamaged = FALSE;
+    NestedAccelMarkStale(pScreen, &pNested->backlog);
+    RegionCopy(pRegion, &sent);
+
+    RegionUninit(&first);
+    RegionUninit(&older);
+    RegionUninit(&newer);
+    RegionUninit(&sent);
+}
+
+/* Called from the block handler, while the screen can be seen. Has the
+ * backlog uploaded once the host is done with the previous frame, and
+ * returns in how many milliseconds to check again, or -1. */
+int
+NestedPriorityCheck(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+
+    if (!RegionNotEmpty(&pNested->backlog) || pNested->backlogDamaged)
+        return -1;
+
+    if (!NestedClientIsReady(pNested->clientData))
+        return NESTED_PRIORITY_RETRY_MS;
+
+    /* It stays in the backlog, to go before newer damage */
+    DamageDamageRegion(&(*pScreen->GetScreenPixmap)(pScreen)->drawable,
+                       &pNested->backlog);
+    pNested->backlogDamaged = TRUE;
+    return 0;
+}
+
+void
+NestedPriorityInit(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+
+    RegionNull(&pNested->backlog);
+    pNested->backlogDamaged = FALSE;
+
+    /* Frames are paced by the host going through them */
+    if (pNested->uploadBudget > 0)
+        NestedClientSetPaced(pNested->clientData);
+}
+
+void
+NestedPriorityClose(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+
+    RegionUninit(&pNested->backlog);
+}
@@ -0,0 +1,74 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * USDT probes, built with ./configure --enable-sdt, for perf and bpftrace
+ * (see README). Without it, probes and their arguments compile to nothing.
+ */
+
+#ifndef NESTED_PROBES_H
+#define NESTED_PROBES_H
+
+/* How the put probe's pixels went to the host */
+#define NESTED_PROBE_SHM   0   /* MIT-SHM */
+#define NESTED_PROBE_PUT   1   /* PutImage */
+#define NESTED_PROBE_CACHE 2   /* through the tile cache */
+
+#ifdef ENABLE_SDT
+
+#include <sys/sdt.h>
+
+#include <regionstr.h>
+
+#define NESTED_PROBE(name) \
+    DTRACE_PROBE(nested, name)
+#define NESTED_PROBE1(name, a) \
+    DTRACE_PROBE1(nested, name, a)
+#define NESTED_PROBE2(name, a, b) \
+    DTRACE_PROBE2(nested, name, a, b)
+#define NESTED_PROBE6(name, a, b, c, d, e, f) \
+    DTRACE_PROBE6(nested, name, a, b, c, d, e, f)
+
+/* Only computed when probes are built in */
+static inline unsigned long
+NestedProbeArea(RegionPtr pRegion) {
+    BoxPtr pBox = RegionRects(pRegion);
+    int nBox = RegionNumRects(pRegion);
+    unsigned long area = 0;
+
+    while (nBox--) {
+        area += (pBox->x2 - pBox->x1) * (pBox->y2 - pBox->y1);
+        pBox++;
+    }
+
+    return area;
+}
+
+#else
+
+#define NESTED_PROBE(name) do { } while (0)
+#define NESTED_PROBE1(name, a) do { } while (0)
+#define NESTED_PROBE2(name, a, b) do { } while (0)
+#define NESTED_PROBE6(name, a, b, c, d, e, f) do { } while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,155 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Damage recording.
+ *
+ * With Option "RecordFile", each update of the shadow layer is written to
+ * that file: when it happened, what was damaged and what was uploaded for
+ * it (see record.h). Recordings of real sessions are replayed by
+ * nested-replay, to compare ways of uploading the same damage. Only
+ * rectangles are recorded, not what was drawn in them.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <xorg-server.h>
+#include <regionstr.h>
+#include <scrnintstr.h>
+#include <xf86.h>
+
+#include "compat-api.h"
+
+#include "driver.h"
+#include "record.h"
+
+struct NestedRecord {
+    FILE      *file;
+    CARD64     start;
+    CARD64     time;    /* of the update in progress */
+    RegionRec  damage;  /* reported for it */
+};
+
+static Bool
+NestedRecordWrite(NestedRecordPtr pRecord, const void *data, size_t size) {
+    return fwrite(data, 1, size, pRecord->file) == size;
+}
+
+void
+NestedRecordInit(ScreenPtr pScreen) {
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    NestedRecordHeader header;
+    NestedRecordPtr pRecord;
+
+    pNested->record = NULL;
+
+    if (!pNested->recordFile)
+        return;
+
+    pRecord = calloc(1, sizeof(struct NestedRecord));
+    if (!pRecord)
+        return;
+
+    pRecord->file = fopen(pNested->recordFile, "wb");
+    if (!pRecord->file) {
+        xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+                   "Failed to open %s, not recording damage\n",
+                   pNested->recordFile);
+        free(pRecord);
+        return;
+    }
+
+    memset(&header, 0, sizeof(header));
+    strcpy(header.magic, NESTED_RECORD_MAGIC);
+    header.version = NESTED_RECORD_VERSION;
+    header.width = pScreen->width;
+    header.height = pScreen->height;
+    header.bitsPerPixel = pScrn->bitsPerPixel;
+
+    pRecord->start = GetTimeInMicros();
+    RegionNull(&pRecord->damage);
+    pNested->record = pRecord;
+
+    if (!NestedRecordWrite(pRecord, &header, sizeof(header)))
+        NestedRecordClose(pScreen);
+}
+
+/* Called with the damage of an update, before it is uploaded */
+void
+NestedRecordBegin(ScreenPtr pScreen, RegionPtr pDamage) {
+    NestedRecordPtr pRecord = PNESTED(xf86ScreenToScrn(pScreen))->record;
+
+    if (!pRecord)
+        return;
+
+    pRecord->time = GetTimeInMicros() - pRecord->start;
+    RegionCopy(&pRecord->damage, pDamage);
+}
+
+/* Called with what was uploaded for it */
+void
+NestedRecordEnd(ScreenPtr pScreen, RegionPtr pUploaded) {
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+    NestedRecordPtr pRecord = PNESTED(pScrn)->record;
+    NestedRecordUpdate update;
+
+    if (!pRecord)
+        return;
+
+    update.time = pRecord->time;
+    update.numDamage = RegionNumRects(&pRecord->damage);
+    update.numUploaded = RegionNumRects(pUploaded);
+
+    if (!NestedRecordWrite(pRecord, &update, sizeof(update)) ||
+        !NestedRecordWrite(pRecord, RegionRects(&pRecord->damage),
+                           update.numDamage * sizeof(BoxRec)) ||
+        !NestedRecordWrite(pRecord, RegionRects(pUploaded),
+                           update.numUploaded * sizeof(BoxRec))) {
+        xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+                   "Failed to write %s, not recording damage anymore\n",
+                   PNESTED(pScrn)->recordFile);
+        NestedRecordClose(pScreen);
+        return;
+    }
+
+    RegionEmpty(&pRecord->damage);
+}
+
+void
+NestedRecordClose(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+    NestedRecordPtr pRecord = pNested->record;
+
+    if (!pRecord)
+        return;
+
+    fclose(pRecord->file);
+    RegionUninit(&pRecord->damage);
+    free(pRecord);
+    pNested->record = NULL;
+}
@@ -0,0 +1,55 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Damage recordings of Option "RecordFile" (record.c), replayed by
+ * nested-replay (replay.c).
+ *
+ * A recording is a header followed by a record per update of the shadow
+ * layer: the time since the recording started, the boxes of the damage it
+ * reported, then the boxes that were uploaded for it. Boxes are BoxRec,
+ * four 16-bit coordinates. Everything is in the byte order of the server
+ * that recorded it.
+ */
+
+#ifndef NESTED_RECORD_H
+#define NESTED_RECORD_H
+
+#include <stdint.h>
+
+#define NESTED_RECORD_MAGIC   "NSTDREC"
+#define NESTED_RECORD_VERSION 1
+
+typedef struct _NestedRecordHeader {
+    char     magic[8];      /* NESTED_RECORD_MAGIC, 0-terminated */
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t bitsPerPixel;
+} NestedRecordHeader;
+
+typedef struct _NestedRecordUpdate {
+    uint64_t time;          /* us */
+    uint32_t numDamage;
+    uint32_t numUploaded;
+} NestedRecordUpdate;
+
+#endif
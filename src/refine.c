@@ -0,0 +1,146 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Progressive uploads.
+ *
+ * Over a slow link, a large change takes a while to reach the host in full.
+ * With Option "Progressive", large rectangles are first sent downscaled,
+ * and scaled back up by the host, which gives a blurry but complete picture
+ * right away. The full resolution follows from the block handler, a piece
+ * at a time, each once the host has gone through the previous one. Newer
+ * damage drops whatever refinement is still due in its area.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <xorg-server.h>
+#include <regionstr.h>
+#include <scrnintstr.h>
+#include <xf86.h>
+
+#include "compat-api.h"
+
+#include "driver.h"
+
+/* Smaller rectangles are sent in full right away */
+#define NESTED_REFINE_MIN_PIXELS (128 * 128)
+
+/* Pixels refined per round trip to the host */
+#define NESTED_REFINE_STEP_PIXELS (256 * 256)
+
+/* Sends the box downscaled if it is worth it, and returns whether it was */
+Bool
+NestedRefineCoarse(ScreenPtr pScreen, BoxPtr pBox) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+    RegionRec box;
+
+    if (!pNested->progressive ||
+        (pBox->x2 - pBox->x1) * (pBox->y2 - pBox->y1) <
+        NESTED_REFINE_MIN_PIXELS)
+        return FALSE;
+
+    NestedClientUpdateScreenCoarse(pNested->clientData,
+                                   pBox->x1, pBox->y1, pBox->x2, pBox->y2);
+
+    RegionInit(&box, pBox, 1);
+    RegionUnion(&pNested->refine, &pNested->refine, &box);
+    RegionUninit(&box);
+    return TRUE;
+}
+
+/* Forgets the refinement of what is about to be sent again */
+void
+NestedRefineDamage(ScreenPtr pScreen, RegionPtr pDamage) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+
+    if (RegionNotEmpty(&pNested->refine))
+        RegionSubtract(&pNested->refine, &pNested->refine, pDamage);
+}
+
+/* Called from the block handler, while the screen can be seen. Uploads the
+ * next piece in full resolution, and returns whether there is more. */
+Bool
+NestedRefineStep(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+    int budget = NESTED_REFINE_STEP_PIXELS;
+    RegionRec done, piece;
+    BoxPtr pBox;
+    int nBox;
+
+    if (!RegionNotEmpty(&pNested->refine))
+        return FALSE;
+
+    if (!NestedClientIsReady(pNested->clientData))
+        return TRUE;
+
+    RegionNull(&done);
+    pBox = RegionRects(&pNested->refine);
+    nBox = RegionNumRects(&pNested->refine);
+
+    for (; nBox-- && budget > 0; pBox++) {
+        BoxRec box = *pBox;
+        int width = box.x2 - box.x1;
+        int rows = max(budget / width, 1);
+
+        if (box.y2 - box.y1 > rows)
+            box.y2 = box.y1 + rows;
+
+        NestedClientUpdateScreen(pNested->clientData,
+                                 box.x1, box.y1, box.x2, box.y2);
+        budget -= width * (box.y2 - box.y1);
+
+        RegionInit(&piece, &box, 1);
+        RegionUnion(&done, &done, &piece);
+        RegionUninit(&piece);
+    }
+
+    RegionSubtract(&pNested->refine, &pNested->refine, &done);
+    RegionUninit(&done);
+
+    NestedClientFlush(pNested->clientData);
+    return RegionNotEmpty(&pNested->refine);
+}
+
+void
+NestedRefineInit(ScreenPtr pScreen) {
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+
+    RegionNull(&pNested->refine);
+
+    if (pNested->progressive &&
+        !NestedClientCoarseInit(pNested->clientData)) {
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+                   "Progressive uploads not used: the host is local, lacks "
+                   "Render 0.10 or spans several windows\n");
+        pNested->progressive = FALSE;
+    }
+}
+
+void
+NestedRefineClose(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+
+    RegionUninit(&pNested->refine);
+}
@@ -0,0 +1,400 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Host-side Render acceleration.
+ *
+ * Text drawn with Render is rasterized by fb like everything else, but the
+ * host can draw it just as well from a glyph id and a position. Glyphs are
+ * uploaded once to a host glyph set, the first time they are drawn on
+ * screen, and each Glyphs request is recorded as a command of the
+ * acceleration layer (see accel.c), so that it gets replayed with
+ * CompositeGlyphs instead of being uploaded as pixels. Solid fills done
+ * with Composite are recorded like core fills.
+ *
+ * Only the common cases are handled: a solid source composited with
+ * PictOpOver through a8 glyphs. Anything else is left to fb and uploaded.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+
+#include <xorg-server.h>
+#include <fb.h>
+#include <glyphstr.h>
+#include <mipict.h>
+#include <picturestr.h>
+#include <pixmapstr.h>
+#include <scrnintstr.h>
+#include <xf86.h>
+
+#include "compat-api.h"
+
+#include "driver.h"
+
+/* Host glyph ids, one per screen since glyphs are shared by all of them */
+typedef struct NestedGlyphPriv {
+    uint32_t id[MAXSCREENS];
+} NestedGlyphPrivRec, *NestedGlyphPrivPtr;
+
+static DevPrivateKeyRec NestedGlyphPrivateKeyRec;
+
+#define NestedGetGlyphPriv(pGlyph) \
+    ((NestedGlyphPrivPtr)dixLookupPrivate(&(pGlyph)->devPrivates, \
+                                          &NestedGlyphPrivateKeyRec))
+
+static inline NestedPrivatePtr
+NestedRenderGetPrivate(ScreenPtr pScreen) {
+    return PNESTED(xf86ScreenToScrn(pScreen));
+}
+
+static inline short
+NestedRenderClampShort(int v) {
+    return v < MINSHORT ? MINSHORT : (v > MAXSHORT ? MAXSHORT : v);
+}
+
+static void
+NestedRenderExpandColor(CARD32 argb, xRenderColor *pColor) {
+    pColor->alpha = ((argb >> 24) & 0xff) * 0x101;
+    pColor->red = ((argb >> 16) & 0xff) * 0x101;
+    pColor->green = ((argb >> 8) & 0xff) * 0x101;
+    pColor->blue = (argb & 0xff) * 0x101;
+}
+
+/* Whether pPicture has the same color everywhere, and which one */
+static Bool
+NestedRenderGetSolid(PicturePtr pPicture, xRenderColor *pColor) {
+    DrawablePtr pDrawable = pPicture->pDrawable;
+    CARD32 pixel;
+
+    if (pPicture->alphaMap || pPicture->componentAlpha)
+        return FALSE;
+
+    if (!pDrawable) {
+        if (pPicture->pSourcePict->type != SourcePictTypeSolidFill)
+            return FALSE;
+
+        NestedRenderExpandColor(pPicture->pSourcePict->solidFill.color,
+                                pColor);
+        return TRUE;
+    }
+
+    if (pDrawable->width != 1 || pDrawable->height != 1 ||
+        !pPicture->repeat || pDrawable->bitsPerPixel != 32)
+        return FALSE;
+
+    (*pDrawable->pScreen->GetImage)(pDrawable, 0, 0, 1, 1, ZPixmap, ~0,
+                                    (char *)&pixel);
+    miRenderPixelToColor(pPicture->pFormat, pixel, pColor);
+    return TRUE;
+}
+
+/* Whether rendering to pDst can be reproduced on the host window */
+static Bool
+NestedRenderCheckDst(PicturePtr pDst) {
+    DrawablePtr pDrawable = pDst->pDrawable;
+
+    return pDrawable &&
+           !pDst->alphaMap &&
+           pDrawable->depth == pDrawable->pScreen->rootDepth &&
+           NestedAccelOnScreen(pDrawable);
+}
+
+/* Returns the host id of pGlyph, uploading it first if needed, or 0 if it
+ * can't be drawn by the host */
+static uint32_t
+NestedRenderGetGlyph(ScreenPtr pScreen, GlyphPtr pGlyph) {
+    NestedPrivatePtr pNested = NestedRenderGetPrivate(pScreen);
+    NestedGlyphPrivPtr pGlyphPriv = NestedGetGlyphPriv(pGlyph);
+    PicturePtr pPicture;
+    DrawablePtr pDrawable;
+    uint8_t *data = NULL;
+    int stride = 0;
+    uint32_t id;
+
+    if (pGlyphPriv->id[pScreen->myNum])
+        return pGlyphPriv->id[pScreen->myNum];
+
+    if (pGlyph->info.width > 0 && pGlyph->info.height > 0) {
+        pPicture = GetGlyphPicture(pGlyph, pScreen);
+        if (!pPicture || !pPicture->pDrawable ||
+            pPicture->format != PICT_a8)
+            return 0;
+
+        pDrawable = pPicture->pDrawable;
+        stride = PixmapBytePad(pDrawable->width, pDrawable->depth);
+        data = malloc(stride * pDrawable->height);
+        if (!data)
+            return 0;
+
+        (*pScreen->GetImage)(pDrawable, 0, 0,
+                             pDrawable->width, pDrawable->height,
+                             ZPixmap, ~0, (char *)data);
+    }
+
+    id = NestedClientAddGlyph(pNested->clientData,
+                              pGlyph->info.width, pGlyph->info.height,
+                              pGlyph->info.x, pGlyph->info.y,
+                              pGlyph->info.xOff, pGlyph->info.yOff,
+                              data, stride);
+    free(data);
+
+    pGlyphPriv->id[pScreen->myNum] = id;
+    return id;
+}
+
+/* Fills in the host glyph list of a Glyphs request, along with the region
+ * it covers in screen coordinates. Returns FALSE if some glyph can't be
+ * drawn by the host. */
+static Bool
+NestedRenderPrepareGlyphs(ScreenPtr pScreen, DrawablePtr pDrawable,
+                          int nlist, GlyphListPtr list, GlyphPtr *glyphs,
+                          NestedGlyphPtr pHostGlyphs, RegionPtr pRegion) {
+    int x = pDrawable->x;
+    int y = pDrawable->y;
+    int n, i = 0;
+    GlyphPtr pGlyph;
+    RegionRec box;
+    BoxRec extents;
+
+    for (; nlist--; list++) {
+        x += list->xOff;
+        y += list->yOff;
+
+        for (n = 0; n < list->len; n++, i++) {
+            pGlyph = *glyphs++;
+
+            pHostGlyphs[i].id = NestedRenderGetGlyph(pScreen, pGlyph);
+            if (!pHostGlyphs[i].id)
+                return FALSE;
+
+            /* The host starts each list where the previous one left, and
+             * the first one at the window origin */
+            pHostGlyphs[i].dx = n ? 0 : (i ? list->xOff : x);
+            pHostGlyphs[i].dy = n ? 0 : (i ? list->yOff : y);
+
+            if (pGlyph->info.width > 0 && pGlyph->info.height > 0) {
+                extents.x1 = NestedRenderClampShort(x - pGlyph->info.x);
+                extents.y1 = NestedRenderClampShort(y - pGlyph->info.y);
+                extents.x2 = NestedRenderClampShort(extents.x1 +
+                                                    pGlyph->info.width);
+                extents.y2 = NestedRenderClampShort(extents.y1 +
+                                                    pGlyph->info.height);
+                RegionInit(&box, &extents, 1);
+                RegionUnion(pRegion, pRegion, &box);
+                RegionUninit(&box);
+            }
+
+            x += pGlyph->info.xOff;
+            y += pGlyph->info.yOff;
+        }
+    }
+
+    return TRUE;
+}
+
+/*
+ * Picture functions
+ */
+
+static void
+NestedGlyphs(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
+             PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc,
+             int nlist, GlyphListPtr list, GlyphPtr *glyphs) {
+    ScreenPtr pScreen = pDst->pDrawable->pScreen;
+    PictureScreenPtr ps = GetPictureScreen(pScreen);
+    NestedPrivatePtr pNested = NestedRenderGetPrivate(pScreen);
+    NestedGlyphPtr pHostGlyphs = NULL;
+    NestedCmdPtr pCmd;
+    xRenderColor color;
+    RegionRec region;
+    int nGlyphs = 0;
+    int i;
+
+    RegionNull(&region);
+
+    for (i = 0; i < nlist; i++)
+        nGlyphs += list[i].len;
+
+    if (pNested->accel && op == PictOpOver && nGlyphs > 0 &&
+        (!maskFormat || maskFormat->format == PICT_a8) &&
+        NestedRenderCheckDst(pDst) &&
+        NestedRenderGetSolid(pSrc, &color))
+        pHostGlyphs = malloc(nGlyphs * sizeof(NestedGlyph));
+
+    if (pHostGlyphs) {
+        if (NestedRenderPrepareGlyphs(pScreen, pDst->pDrawable, nlist, list,
+                                      glyphs, pHostGlyphs, &region)) {
+            /* Over depends on what is below, so it has to be up to date */
+            ValidatePicture(pDst);
+            RegionIntersect(&region, &region, pDst->pCompositeClip);
+            NestedAccelClipToHost(pScreen, pDst->pDrawable, &region, 0, 0,
+                                  pDst->subWindowMode);
+        } else
+            RegionEmpty(&region);
+    }
+
+    ps->Glyphs = pNested->Glyphs;
+    (*ps->Glyphs)(op, pSrc, pDst, maskFormat, xSrc, ySrc, nlist, list, glyphs);
+    pNested->Glyphs = ps->Glyphs;
+    ps->Glyphs = NestedGlyphs;
+
+    pCmd = NULL;
+    if (pHostGlyphs)
+        pCmd = NestedAccelRecord(pScreen, NESTED_CMD_GLYPHS, &region);
+
+    if (pCmd) {
+        pCmd->color = color;
+        pCmd->useMask = maskFormat != NULL;
+        pCmd->numGlyphs = nGlyphs;
+        pCmd->glyphs = pHostGlyphs;
+    } else
+        free(pHostGlyphs);
+
+    RegionUninit(&region);
+}
+
+static void
+NestedComposite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
+                PicturePtr pDst, INT16 xSrc, INT16 ySrc,
+                INT16 xMask, INT16 yMask, INT16 xDst, INT16 yDst,
+                CARD16 width, CARD16 height) {
+    ScreenPtr pScreen = pDst->pDrawable->pScreen;
+    PictureScreenPtr ps = GetPictureScreen(pScreen);
+    NestedPrivatePtr pNested = NestedRenderGetPrivate(pScreen);
+    xRenderColor color;
+    CARD32 pixel = 0;
+    RegionRec region;
+    BoxRec box;
+    Bool accel;
+
+    RegionNull(&region);
+
+    /* Opaque solid fills don't depend on the host contents either */
+    accel = pNested->accel && !pMask &&
+            NestedRenderCheckDst(pDst) &&
+            NestedRenderGetSolid(pSrc, &color) &&
+            (op == PictOpSrc ||
+             (op == PictOpOver && color.alpha == 0xffff));
+
+    if (accel) {
+        miRenderColorToPixel(pDst->pFormat, &color, &pixel);
+
+        box.x1 = NestedRenderClampShort(pDst->pDrawable->x + xDst);
+        box.y1 = NestedRenderClampShort(pDst->pDrawable->y + yDst);
+        box.x2 = NestedRenderClampShort(box.x1 + width);
+        box.y2 = NestedRenderClampShort(box.y1 + height);
+        RegionReset(&region, &box);
+
+        ValidatePicture(pDst);
+        RegionIntersect(&region, &region, pDst->pCompositeClip);
+    }
+
+    ps->Composite = pNested->Composite;
+    (*ps->Composite)(op, pSrc, pMask, pDst, xSrc, ySrc, xMask, yMask,
+                     xDst, yDst, width, height);
+    pNested->Composite = ps->Composite;
+    ps->Composite = NestedComposite;
+
+    if (accel)
+        NestedAccelRecordFill(pScreen, &region, pixel);
+
+    RegionUninit(&region);
+}
+
+static void
+NestedUnrealizeGlyph(ScreenPtr pScreen, GlyphPtr pGlyph) {
+    PictureScreenPtr ps = GetPictureScreen(pScreen);
+    NestedPrivatePtr pNested = NestedRenderGetPrivate(pScreen);
+    NestedGlyphPrivPtr pGlyphPriv = NestedGetGlyphPriv(pGlyph);
+
+    if (pGlyphPriv->id[pScreen->myNum]) {
+        NestedClientFreeGlyph(pNested->clientData,
+                              pGlyphPriv->id[pScreen->myNum]);
+        pGlyphPriv->id[pScreen->myNum] = 0;
+    }
+
+    ps->UnrealizeGlyph = pNested->UnrealizeGlyph;
+    (*ps->UnrealizeGlyph)(pScreen, pGlyph);
+    pNested->UnrealizeGlyph = ps->UnrealizeGlyph;
+    ps->UnrealizeGlyph = NestedUnrealizeGlyph;
+}
+
+/*
+ * Public functions
+ */
+
+/* Called from NestedScreenInit, after NestedAccelInit */
+Bool
+NestedRenderInit(ScreenPtr pScreen) {
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+    NestedPrivatePtr pNested = NestedRenderGetPrivate(pScreen);
+    PictureScreenPtr ps = GetPictureScreenIfSet(pScreen);
+
+    if (!pNested->renderAccel)
+        return TRUE;
+
+    if (!ps || !pNested->accel) {
+        xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+                   "Render acceleration requires Option \"Accel\", disabling it.\n");
+        pNested->renderAccel = FALSE;
+        return TRUE;
+    }
+
+    if (!NestedClientRenderInit(pNested->clientData)) {
+        xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+                   "Host X server can't do Render acceleration, disabling it.\n");
+        pNested->renderAccel = FALSE;
+        return TRUE;
+    }
+
+    if (!dixRegisterPrivateKey(&NestedGlyphPrivateKeyRec, PRIVATE_GLYPH,
+                               sizeof(NestedGlyphPrivRec)))
+        return FALSE;
+
+    pNested->Glyphs = ps->Glyphs;
+    ps->Glyphs = NestedGlyphs;
+
+    pNested->Composite = ps->Composite;
+    ps->Composite = NestedComposite;
+
+    pNested->UnrealizeGlyph = ps->UnrealizeGlyph;
+    ps->UnrealizeGlyph = NestedUnrealizeGlyph;
+
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Render acceleration enabled\n");
+    return TRUE;
+}
+
+void
+NestedRenderClose(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = NestedRenderGetPrivate(pScreen);
+    PictureScreenPtr ps = GetPictureScreenIfSet(pScreen);
+
+    if (!pNested->renderAccel || !ps)
+        return;
+
+    ps->Glyphs = pNested->Glyphs;
+    ps->Composite = pNested->Composite;
+    ps->UnrealizeGlyph = pNested->UnrealizeGlyph;
+}
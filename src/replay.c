@@ -0,0 +1,332 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Damage replay.
+ *
+ * Built by "make bench", nested-replay feeds a recording of Option
+ * "RecordFile" (see record.h) to the configured client backend, without
+ * the X server around it. Each update is uploaded as:
+ *
+ *   uploaded  the boxes the driver uploaded when recording (default);
+ *   damage    the boxes of the damage, as reported by the shadow layer;
+ *   extents   a single box around the damage.
+ *
+ * so the same session can be compared across ways of coalescing the
+ * damage, backends, transports and hosts. Updates are replayed back to
+ * back, or at their recorded times with -r. What was drawn isn't
+ * recorded, so boxes are painted with a pattern changing every update.
+ * With the null backend, only the counts mean something.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <xorg-server.h>
+#include <xf86.h>
+
+#include "bench-stats.h"
+#include "client.h"
+#include "record.h"
+
+extern Bool benchVerbose;
+
+typedef enum {
+    REPLAY_UPLOADED,
+    REPLAY_DAMAGE,
+    REPLAY_EXTENTS
+} ReplayMode;
+
+typedef struct _Replay {
+    NestedClientPrivatePtr client;
+    char                  *fb;
+    int                    width;
+    int                    height;
+    int                    bpp;     /* bytes per pixel */
+    int                    stride;
+    ReplayMode             mode;
+    Bool                   realTime;
+    BoxPtr                 boxes;
+    uint32_t               numBoxes; /* allocated */
+    uint64_t              *latency;
+    unsigned long          numUpdates;
+    unsigned long          maxUpdates;
+    unsigned long          rects;
+    unsigned long          bytes;
+    CARD64                 total;
+} Replay, *ReplayPtr;
+
+static Bool
+ReplayRead(FILE *file, void *data, size_t size) {
+    return fread(data, 1, size, file) == size;
+}
+
+/* Keeps boxes inside the screen, in case of a truncated or foreign file */
+static int
+ReplayClip(ReplayPtr pReplay, BoxPtr pBox, int nBox) {
+    int i, n = 0;
+
+    for (i = 0; i < nBox; i++) {
+        BoxRec box = pBox[i];
+
+        box.x1 = max(box.x1, 0);
+        box.y1 = max(box.y1, 0);
+        box.x2 = min(box.x2, pReplay->width);
+        box.y2 = min(box.y2, pReplay->height);
+
+        if (box.x1 < box.x2 && box.y1 < box.y2)
+            pBox[n++] = box;
+    }
+
+    return n;
+}
+
+static void
+ReplayPaint(ReplayPtr pReplay, BoxPtr pBox, int nBox, int value) {
+    int i, y;
+
+    for (i = 0; i < nBox; i++)
+        for (y = pBox[i].y1; y < pBox[i].y2; y++)
+            memset(pReplay->fb + y * pReplay->stride +
+                   pBox[i].x1 * pReplay->bpp,
+                   (value + y) & 0xff,
+                   (pBox[i].x2 - pBox[i].x1) * pReplay->bpp);
+}
+
+static Bool
+ReplayUpdate(ReplayPtr pReplay, FILE *file, CARD64 begin) {
+    NestedRecordUpdate update;
+    BoxPtr pBox;
+    int nBox, i;
+    uint32_t size;
+    CARD64 start;
+
+    if (!ReplayRead(file, &update, sizeof(update)))
+        return FALSE;
+
+    size = update.numDamage + update.numUploaded;
+    if (size > pReplay->numBoxes) {
+        BoxPtr boxes = realloc(pReplay->boxes, size * sizeof(BoxRec));
+
+        if (!boxes)
+            return FALSE;
+
+        pReplay->boxes = boxes;
+        pReplay->numBoxes = size;
+    }
+
+    if (!ReplayRead(file, pReplay->boxes, size * sizeof(BoxRec)))
+        return FALSE;
+
+    if (pReplay->mode == REPLAY_UPLOADED) {
+        pBox = pReplay->boxes + update.numDamage;
+        nBox = update.numUploaded;
+    } else {
+        pBox = pReplay->boxes;
+        nBox = update.numDamage;
+    }
+
+    nBox = ReplayClip(pReplay, pBox, nBox);
+
+    if (pReplay->mode == REPLAY_EXTENTS && nBox > 1) {
+        for (i = 1; i < nBox; i++) {
+            pBox[0].x1 = min(pBox[0].x1, pBox[i].x1);
+            pBox[0].y1 = min(pBox[0].y1, pBox[i].y1);
+            pBox[0].x2 = max(pBox[0].x2, pBox[i].x2);
+            pBox[0].y2 = max(pBox[0].y2, pBox[i].y2);
+        }
+
+        nBox = 1;
+    }
+
+    if (pReplay->realTime) {
+        CARD64 now = GetTimeInMicros() - begin;
+
+        if (update.time > now)
+            usleep(update.time - now);
+    }
+
+    ReplayPaint(pReplay, pBox, nBox, pReplay->numUpdates);
+
+    start = GetTimeInMicros();
+
+    for (i = 0; i < nBox; i++) {
+        NestedClientUpdateScreen(pReplay->client,
+                                 pBox[i].x1, pBox[i].y1,
+                                 pBox[i].x2, pBox[i].y2);
+        pReplay->bytes += (pBox[i].x2 - pBox[i].x1) *
+                          (pBox[i].y2 - pBox[i].y1) * pReplay->bpp;
+    }
+
+    NestedClientFlush(pReplay->client);
+    NestedClientSync(pReplay->client);
+
+    if (pReplay->numUpdates == pReplay->maxUpdates) {
+        unsigned long maxUpdates = max(1024, pReplay->maxUpdates * 2);
+        uint64_t *latency = realloc(pReplay->latency,
+                                    maxUpdates * sizeof(uint64_t));
+
+        if (!latency)
+            return FALSE;
+
+        pReplay->latency = latency;
+        pReplay->maxUpdates = maxUpdates;
+    }
+
+    pReplay->latency[pReplay->numUpdates] = GetTimeInMicros() - start;
+    pReplay->total += pReplay->latency[pReplay->numUpdates];
+    pReplay->numUpdates++;
+    pReplay->rects += nBox;
+
+    NestedClientCheckEvents(pReplay->client);
+    return TRUE;
+}
+
+static void
+ReplayUsage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-m uploaded|damage|extents] [-r] [-c TILES] [-v] "
+            "FILE\n"
+            "  -m  boxes uploaded for each update (default: uploaded)\n"
+            "  -r  replay updates at their recorded times\n"
+            "  -c  tile cache size, 0 disables it (default: 1024)\n"
+            "  -v  show the backend's messages\n",
+            name);
+    exit(1);
+}
+
+int
+main(int argc, char **argv) {
+    Replay replay;
+    NestedRecordHeader header;
+    Output output = { NULL, 0, 0, 0, 0 };
+    Pixel red, green, blue;
+    FILE *file;
+    CARD64 begin;
+    int tiles = 1024, opt, i;
+
+    memset(&replay, 0, sizeof(replay));
+
+    while ((opt = getopt(argc, argv, "m:rc:v")) != -1) {
+        switch (opt) {
+        case 'm':
+            if (!strcmp(optarg, "uploaded"))
+                replay.mode = REPLAY_UPLOADED;
+            else if (!strcmp(optarg, "damage"))
+                replay.mode = REPLAY_DAMAGE;
+            else if (!strcmp(optarg, "extents"))
+                replay.mode = REPLAY_EXTENTS;
+            else
+                ReplayUsage(argv[0]);
+            break;
+        case 'r':
+            replay.realTime = TRUE;
+            break;
+        case 'c':
+            tiles = atoi(optarg);
+            break;
+        case 'v':
+            benchVerbose = TRUE;
+            break;
+        default:
+            ReplayUsage(argv[0]);
+        }
+    }
+
+    if (optind != argc - 1)
+        ReplayUsage(argv[0]);
+
+    file = fopen(argv[optind], "rb");
+    if (!file) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    if (!ReplayRead(file, &header, sizeof(header)) ||
+        strncmp(header.magic, NESTED_RECORD_MAGIC, sizeof(header.magic)) ||
+        header.version != NESTED_RECORD_VERSION ||
+        header.width == 0 || header.width > 32767 ||
+        header.height == 0 || header.height > 32767 ||
+        (header.bitsPerPixel != 16 && header.bitsPerPixel != 24 &&
+         header.bitsPerPixel != 32)) {
+        fprintf(stderr, "%s: not a recording of this version\n",
+                argv[optind]);
+        return 1;
+    }
+
+    replay.width = header.width;
+    replay.height = header.height;
+    replay.bpp = header.bitsPerPixel / 8;
+    /* Rows are padded to 32 bits, in the server's framebuffer as in the
+     * backends' */
+    replay.stride = (replay.width * header.bitsPerPixel + 31) / 32 * 4;
+    output.width = replay.width;
+    output.height = replay.height;
+
+    replay.client = NestedClientCreateScreen(0, FALSE, FALSE, FALSE,
+                                             replay.width, replay.height,
+                                             1, &output,
+                                             header.bitsPerPixel == 16 ?
+                                             16 : 24,
+                                             header.bitsPerPixel,
+                                             &red, &green, &blue);
+    if (!replay.client) {
+        fprintf(stderr, "Can't open display: %s\n", getenv("DISPLAY"));
+        return 1;
+    }
+
+    replay.fb = NestedClientGetFrameBuffer(replay.client);
+    NestedClientSetTileCacheSize(replay.client, tiles);
+
+    for (i = 0; i < 1000 && !NestedClientIsVisible(replay.client); i++) {
+        NestedClientCheckEvents(replay.client);
+        usleep(1000);
+    }
+
+    begin = GetTimeInMicros();
+
+    while (ReplayUpdate(&replay, file, begin))
+        ;
+
+    fclose(file);
+
+    if (replay.numUpdates > 0) {
+        printf("%lu updates, %lu rects, %.1f MB in %.3f s: "
+               "%.0f uploads/s, %.1f MB/s\n",
+               replay.numUpdates, replay.rects, replay.bytes / 1e6,
+               replay.total / 1e6,
+               replay.rects * 1e6 / max(replay.total, 1),
+               replay.bytes / (double)max(replay.total, 1));
+        BenchPrintLatency(replay.latency, replay.numUpdates);
+        printf("\n");
+    }
+
+    free(replay.latency);
+    free(replay.boxes);
+    NestedClientCloseScreen(replay.client);
+    return 0;
+}
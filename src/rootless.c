@@ -0,0 +1,252 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Rootless mode.
+ *
+ * Instead of a host window showing the whole screen, each viewable nested
+ * top-level window gets a host window of its own, showing the part of the
+ * framebuffer under it. The root window is never shown, so its background
+ * is never uploaded. Host windows are stacked like the nested ones, so
+ * where top-level windows overlap, the host shows the one on top, as the
+ * framebuffer does.
+ *
+ * Moving a top-level window moves its host window, which takes the
+ * contents along: the copy fb does is recorded as a command of the
+ * acceleration layer (see accel.c) that replays nothing, so the moved
+ * pixels are not uploaded again.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+
+#include <xorg-server.h>
+#include <scrnintstr.h>
+#include <windowstr.h>
+#include <xf86.h>
+
+#include "compat-api.h"
+
+#include "driver.h"
+
+typedef struct NestedWindowPriv {
+    uint32_t id;    /* host window, 0 if none */
+} NestedWindowPrivRec, *NestedWindowPrivPtr;
+
+static DevPrivateKeyRec NestedWindowPrivateKeyRec;
+
+#define NestedGetWindowPriv(pWin) \
+    ((NestedWindowPrivPtr)dixLookupPrivate(&(pWin)->devPrivates, \
+                                           &NestedWindowPrivateKeyRec))
+
+static inline NestedPrivatePtr
+NestedRootlessGetPrivate(ScreenPtr pScreen) {
+    return PNESTED(xf86ScreenToScrn(pScreen));
+}
+
+static inline Bool
+NestedRootlessTopLevel(WindowPtr pWin) {
+    return pWin->parent && !pWin->parent->parent &&
+           pWin->drawable.class == InputOutput;
+}
+
+/* Stacks the host windows in the order of the nested ones */
+static void
+NestedRootlessRestack(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = NestedRootlessGetPrivate(pScreen);
+    WindowPtr pWin;
+    uint32_t above = 0;
+
+    for (pWin = pScreen->root->firstChild; pWin; pWin = pWin->nextSib) {
+        NestedWindowPrivPtr pWinPriv = NestedGetWindowPriv(pWin);
+
+        if (!pWinPriv->id)
+            continue;
+
+        NestedClientRestackWindow(pNested->clientData, pWinPriv->id, above);
+        above = pWinPriv->id;
+    }
+}
+
+/*
+ * Screen functions
+ */
+
+static Bool
+NestedRealizeWindow(WindowPtr pWin) {
+    ScreenPtr pScreen = pWin->drawable.pScreen;
+    NestedPrivatePtr pNested = NestedRootlessGetPrivate(pScreen);
+    NestedWindowPrivPtr pWinPriv = NestedGetWindowPriv(pWin);
+    int bw = wBorderWidth(pWin);
+    Bool ret;
+
+    pScreen->RealizeWindow = pNested->RealizeWindow;
+    ret = (*pScreen->RealizeWindow)(pWin);
+    pNested->RealizeWindow = pScreen->RealizeWindow;
+    pScreen->RealizeWindow = NestedRealizeWindow;
+
+    if (ret && NestedRootlessTopLevel(pWin) && !pWinPriv->id) {
+        pWinPriv->id = NestedClientAddWindow(pNested->clientData,
+                                             pWin->drawable.x - bw,
+                                             pWin->drawable.y - bw,
+                                             pWin->drawable.width + 2 * bw,
+                                             pWin->drawable.height + 2 * bw);
+        NestedRootlessRestack(pScreen);
+    }
+
+    return ret;
+}
+
+static Bool
+NestedUnrealizeWindow(WindowPtr pWin) {
+    ScreenPtr pScreen = pWin->drawable.pScreen;
+    NestedPrivatePtr pNested = NestedRootlessGetPrivate(pScreen);
+    NestedWindowPrivPtr pWinPriv = NestedGetWindowPriv(pWin);
+    Bool ret;
+
+    if (pWinPriv->id) {
+        NestedClientRemoveWindow(pNested->clientData, pWinPriv->id);
+        pWinPriv->id = 0;
+    }
+
+    pScreen->UnrealizeWindow = pNested->UnrealizeWindow;
+    ret = (*pScreen->UnrealizeWindow)(pWin);
+    pNested->UnrealizeWindow = pScreen->UnrealizeWindow;
+    pScreen->UnrealizeWindow = NestedUnrealizeWindow;
+
+    return ret;
+}
+
+/* Called whenever a window is moved or resized */
+static Bool
+NestedPositionWindow(WindowPtr pWin, int x, int y) {
+    ScreenPtr pScreen = pWin->drawable.pScreen;
+    NestedPrivatePtr pNested = NestedRootlessGetPrivate(pScreen);
+    NestedWindowPrivPtr pWinPriv = NestedGetWindowPriv(pWin);
+    int bw = wBorderWidth(pWin);
+    Bool ret;
+
+    pScreen->PositionWindow = pNested->PositionWindow;
+    ret = (*pScreen->PositionWindow)(pWin, x, y);
+    pNested->PositionWindow = pScreen->PositionWindow;
+    pScreen->PositionWindow = NestedPositionWindow;
+
+    if (pWinPriv->id)
+        NestedClientConfigureWindow(pNested->clientData, pWinPriv->id,
+                                    pWin->drawable.x - bw,
+                                    pWin->drawable.y - bw,
+                                    pWin->drawable.width + 2 * bw,
+                                    pWin->drawable.height + 2 * bw);
+
+    return ret;
+}
+
+static void
+NestedMoveWindow(WindowPtr pWin, int x, int y, WindowPtr pNextSib,
+                 VTKind kind) {
+    ScreenPtr pScreen = pWin->drawable.pScreen;
+    NestedPrivatePtr pNested = NestedRootlessGetPrivate(pScreen);
+    Bool moving = NestedGetWindowPriv(pWin)->id != 0;
+
+    /* What the host window takes along has to be there first */
+    if (moving) {
+        NestedUpdateNow(pScreen);
+        pNested->movingWindow = pWin;
+    }
+
+    pScreen->MoveWindow = pNested->MoveWindow;
+    (*pScreen->MoveWindow)(pWin, x, y, pNextSib, kind);
+    pNested->MoveWindow = pScreen->MoveWindow;
+    pScreen->MoveWindow = NestedMoveWindow;
+
+    if (moving)
+        pNested->movingWindow = NULL;
+}
+
+static void
+NestedRestackWindow(WindowPtr pWin, WindowPtr pOldNextSib) {
+    ScreenPtr pScreen = pWin->drawable.pScreen;
+    NestedPrivatePtr pNested = NestedRootlessGetPrivate(pScreen);
+
+    pScreen->RestackWindow = pNested->RestackWindow;
+    if (pScreen->RestackWindow)
+        (*pScreen->RestackWindow)(pWin, pOldNextSib);
+    pNested->RestackWindow = pScreen->RestackWindow;
+    pScreen->RestackWindow = NestedRestackWindow;
+
+    if (NestedRootlessTopLevel(pWin))
+        NestedRootlessRestack(pScreen);
+}
+
+/*
+ * Public functions
+ */
+
+/* Called from NestedScreenInit, before the root window is created */
+Bool
+NestedRootlessInit(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = NestedRootlessGetPrivate(pScreen);
+
+    pNested->movingWindow = NULL;
+
+    if (!pNested->rootless)
+        return TRUE;
+
+    if (!dixRegisterPrivateKey(&NestedWindowPrivateKeyRec, PRIVATE_WINDOW,
+                               sizeof(NestedWindowPrivRec)))
+        return FALSE;
+
+    pNested->RealizeWindow = pScreen->RealizeWindow;
+    pScreen->RealizeWindow = NestedRealizeWindow;
+
+    pNested->UnrealizeWindow = pScreen->UnrealizeWindow;
+    pScreen->UnrealizeWindow = NestedUnrealizeWindow;
+
+    pNested->PositionWindow = pScreen->PositionWindow;
+    pScreen->PositionWindow = NestedPositionWindow;
+
+    pNested->MoveWindow = pScreen->MoveWindow;
+    pScreen->MoveWindow = NestedMoveWindow;
+
+    pNested->RestackWindow = pScreen->RestackWindow;
+    pScreen->RestackWindow = NestedRestackWindow;
+
+    xf86DrvMsg(xf86ScreenToScrn(pScreen)->scrnIndex, X_INFO,
+               "Rootless mode enabled\n");
+    return TRUE;
+}
+
+void
+NestedRootlessClose(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = NestedRootlessGetPrivate(pScreen);
+
+    if (!pNested->rootless)
+        return;
+
+    pScreen->RealizeWindow = pNested->RealizeWindow;
+    pScreen->UnrealizeWindow = pNested->UnrealizeWindow;
+    pScreen->PositionWindow = pNested->PositionWindow;
+    pScreen->MoveWindow = pNested->MoveWindow;
+    pScreen->RestackWindow = pNested->RestackWindow;
+}
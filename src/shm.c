@@ -0,0 +1,229 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Passthrough of MIT-SHM images.
+ *
+ * A nested client's ShmPutImage reaches the PutImage GC operation with the
+ * pixels still in the client's shared memory segment. When a large image
+ * goes straight to the screen and the host runs on this machine, the host
+ * is told to read it from that segment right away, while fb copies it into
+ * the framebuffer, instead of uploading it from the framebuffer at the next
+ * update. The framebuffer copy is kept, as GetImage, copies and mirrors
+ * read from it. A command of the acceleration layer (see accel.c) that
+ * replays nothing keeps the area out of the next upload.
+ *
+ * The client may reuse its segment as soon as the request is done, so we
+ * wait for the host to have read it before returning.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+
+#include <xorg-server.h>
+#include <dixstruct.h>
+#include <extnsionst.h>
+#include <gcstruct.h>
+#include <regionstr.h>
+#include <resource.h>
+#include <scrnintstr.h>
+#include <servermd.h>
+#include <xf86.h>
+#ifdef MITSHM
+#include <X11/extensions/shmproto.h>
+#include <shmint.h>
+#endif
+
+#include "compat-api.h"
+
+#include "driver.h"
+
+/* Smaller images are cheaper to upload than to wait for */
+#define NESTED_SHM_MIN_PIXELS (256 * 256)
+
+#ifdef MITSHM
+
+typedef struct NestedShmFind {
+    const char *start;
+    const char *end;
+    ShmDescPtr  desc;
+    XID         id;
+} NestedShmFindRec, *NestedShmFindPtr;
+
+static Bool
+NestedShmContains(ShmDescPtr desc, const char *start, const char *end) {
+    return start >= desc->addr && end <= desc->addr + desc->size;
+}
+
+/* The host can only attach SysV segments */
+static Bool
+NestedShmUsable(ShmDescPtr desc) {
+#ifdef SHM_FD_PASSING
+    return !desc->is_fd;
+#else
+    return TRUE;
+#endif
+}
+
+static void
+NestedShmFindSegment(void *value, XID id, void *data) {
+    NestedShmFindPtr pFind = data;
+
+    if (!pFind->desc && NestedShmContains(value, pFind->start, pFind->end)) {
+        pFind->desc = value;
+        pFind->id = id;
+    }
+}
+
+/* Whether the request being processed is a ShmPutImage, so the image is
+ * in one of the client's segments */
+static Bool
+NestedShmIsPutImage(void) {
+#if ABI_VIDEODRV_VERSION >= SET_ABI_VERSION(24, 0)
+    ClientPtr client = GetCurrentClient();
+    ExtensionEntry *ext = CheckExtension(SHMNAME);
+
+    return client && ext && client->majorOp == ext->base &&
+           client->minorOp == X_ShmPutImage;
+#else
+    /* There is no telling, so all segments get looked through */
+    return TRUE;
+#endif
+}
+
+/* Looks up the segment at id, if it holds the image */
+static ShmDescPtr
+NestedShmCheck(XID id, const char *start, const char *end) {
+    void *value;
+
+    if (id &&
+        dixLookupResourceByType(&value, id, ShmSegType, serverClient,
+                                DixReadAccess) == Success &&
+        NestedShmContains(value, start, end))
+        return value;
+
+    return NULL;
+}
+
+/* Returns the segment the image lies in, if the host can read it from
+ * there, or NULL */
+static ShmDescPtr
+NestedShmLookup(NestedPrivatePtr pNested, const char *start,
+                const char *end) {
+    NestedShmFindRec find;
+    ShmDescPtr desc;
+    int i;
+
+    if (!ShmSegType || !NestedShmIsPutImage())
+        return NULL;
+
+    /* Usually the one of the previous frame */
+    desc = NestedShmCheck(pNested->shmSeg, start, end);
+    if (desc)
+        return desc;
+
+    /* or one found before that the host can't read */
+    if (NestedShmCheck(pNested->shmUnusable, start, end))
+        return NULL;
+
+    find.start = start;
+    find.end = end;
+    find.desc = NULL;
+    find.id = 0;
+
+    for (i = 1; i < currentMaxClients && !find.desc; i++)
+        if (clients[i])
+            FindClientResourcesByType(clients[i], ShmSegType,
+                                      NestedShmFindSegment, &find);
+
+    if (find.desc && !NestedShmUsable(find.desc)) {
+        pNested->shmUnusable = find.id;
+        return NULL;
+    }
+
+    if (find.desc)
+        pNested->shmSeg = find.id;
+
+    return find.desc;
+}
+
+#endif /* MITSHM */
+
+/* Called by the PutImage GC operation before fb draws the image. Returns
+ * the area the host was given from the client's segment, to be passed to
+ * NestedShmPutImageDone() once fb is done, or NULL. */
+RegionPtr
+NestedShmPutImage(DrawablePtr pDrawable, GCPtr pGC, int depth,
+                  int x, int y, int w, int h, int leftPad, int format,
+                  char *pImage) {
+#ifdef MITSHM
+    ScreenPtr pScreen = pDrawable->pScreen;
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+    int stride = PixmapBytePad(w, depth);
+    ShmDescPtr desc;
+    BoxRec box;
+
+    if (!pNested->shmPassthrough || format != ZPixmap || leftPad != 0 ||
+        depth != pDrawable->depth || (long)w * h < NESTED_SHM_MIN_PIXELS)
+        return NULL;
+
+    if (pNested->blanked || pNested->dpmsOff ||
+        !NestedClientIsVisible(pNested->clientData))
+        return NULL;
+
+    /* The host gets no clip, so all of the image has to be drawn */
+    box.x1 = pDrawable->x + x;
+    box.y1 = pDrawable->y + y;
+    box.x2 = box.x1 + w;
+    box.y2 = box.y1 + h;
+    if (RegionContainsRect(pGC->pCompositeClip, &box) != rgnIN)
+        return NULL;
+
+    desc = NestedShmLookup(pNested, pImage, pImage + (long)stride * h);
+    if (!desc)
+        return NULL;
+
+    /* Pending commands have to reach the host before the image does */
+    NestedUpdateNow(pScreen);
+
+    if (!NestedClientPutSharedImage(pNested->clientData, desc->shmid,
+                                    pImage - desc->addr, stride,
+                                    box.x1, box.y1, w, h))
+        return NULL;
+
+    return RegionCreate(&box, 1);
+#else
+    return NULL;
+#endif
+}
+
+void
+NestedShmPutImageDone(ScreenPtr pScreen, RegionPtr pRegion) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+
+    NestedAccelRecord(pScreen, NESTED_CMD_SHARED, pRegion);
+    RegionDestroy(pRegion);
+
+    NestedClientSync(pNested->clientData);
+}
@@ -0,0 +1,228 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Statistics.
+ *
+ * What the update pipeline does is counted all along: frames uploaded,
+ * with how many rectangles and pixels and how long it took, and from the
+ * client, what went through PutImage or MIT-SHM, flushes, Expose repaints
+ * and how long the host took to go through each frame. With Option
+ * "StatsInterval", the counters are written every that many seconds to
+ * the _NESTED_STATS property of the root window, as "name value" lines,
+ * and to the log, or to Option "StatsFile". Counters only grow, so rates
+ * are the difference between two dumps.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <X11/Xatom.h>
+
+#include <xorg-server.h>
+#include <property.h>
+#include <regionstr.h>
+#include <scrnintstr.h>
+#include <windowstr.h>
+#include <xf86.h>
+
+#include "compat-api.h"
+
+#include "driver.h"
+
+#define NESTED_STATS_PROPERTY "_NESTED_STATS"
+
+static int
+NestedStatsPrintHistogram(char *buf, size_t size, const char *name,
+                          const unsigned long *buckets) {
+    int len = snprintf(buf, size, "%s", name);
+    int i;
+
+    for (i = 0; i < NESTED_STATS_BUCKETS && (size_t)len < size; i++)
+        len += snprintf(buf + len, size - len, " %lu", buckets[i]);
+
+    if ((size_t)len < size)
+        len += snprintf(buf + len, size - len, "\n");
+
+    return len;
+}
+
+/* Prints the counters as "name value" lines, histograms having a value per
+ * bucket. Returns the length of the text. */
+static int
+NestedStatsPrint(ScreenPtr pScreen, char *buf, size_t size) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+    NestedClientStats stats;
+    unsigned long hits, misses;
+    int len;
+
+    NestedClientGetStats(pNested->clientData, &stats);
+    NestedClientGetTileCacheStats(pNested->clientData, &hits, &misses);
+
+    len = snprintf(buf, size,
+                   "frames %lu\n"
+                   "frame_rects %lu\n"
+                   "frame_pixels %lu\n"
+                   "put_rects %lu\n"
+                   "put_bytes %lu\n"
+                   "shm_rects %lu\n"
+                   "shm_bytes %lu\n"
+                   "tile_cache_hits %lu\n"
+                   "tile_cache_misses %lu\n"
+                   "exposes %lu\n"
+                   "flushes %lu\n"
+                   "flush_us %lu\n"
+                   "tiles_hot %lu\n"
+                   "tiles_warm %lu\n"
+                   "tiles_cold %lu\n",
+                   pNested->statsFrames,
+                   pNested->statsRects,
+                   pNested->statsPixels,
+                   stats.putRects, stats.putBytes,
+                   stats.shmRects, stats.shmBytes,
+                   hits, misses,
+                   stats.exposes,
+                   stats.flushes, stats.flushTime,
+                   pNested->heatStats[NESTED_HEAT_HOT],
+                   pNested->heatStats[NESTED_HEAT_WARM],
+                   pNested->heatStats[NESTED_HEAT_COLD]);
+
+    if ((size_t)len < size)
+        len += NestedStatsPrintHistogram(buf + len, size - len,
+                                         "frame_time_hist",
+                                         pNested->statsFrameTime);
+    if ((size_t)len < size)
+        len += NestedStatsPrintHistogram(buf + len, size - len,
+                                         "host_latency_hist",
+                                         stats.latency);
+    if ((size_t)len < size)
+        len += NestedAttribPrint(pScreen, buf + len, size - len);
+
+    return min(len, (int)size - 1);
+}
+
+static void
+NestedStatsDump(ScreenPtr pScreen, Bool setProperty) {
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    char buf[2048], *line, *next;
+    int len = NestedStatsPrint(pScreen, buf, sizeof(buf));
+    FILE *file;
+
+    if (setProperty && pScreen->root) {
+        Atom atom = MakeAtom(NESTED_STATS_PROPERTY,
+                             strlen(NESTED_STATS_PROPERTY), TRUE);
+
+        dixChangeWindowProperty(serverClient, pScreen->root, atom, XA_STRING,
+                                8, PropModeReplace, len, buf, TRUE);
+    }
+
+    if (pNested->statsFile) {
+        file = fopen(pNested->statsFile, "a");
+        if (file) {
+            fprintf(file, "time %ld\nscreen %d\n%s\n",
+                    (long)time(NULL), pScreen->myNum, buf);
+            fclose(file);
+            return;
+        }
+
+        xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+                   "Failed to open %s, writing statistics to the log\n",
+                   pNested->statsFile);
+        pNested->statsFile = NULL;
+    }
+
+    for (line = buf; *line; line = next) {
+        next = strchr(line, '\n');
+        if (next)
+            *next++ = '\0';
+        else
+            next = line + strlen(line);
+
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Stats: %s\n", line);
+    }
+}
+
+static CARD32
+NestedStatsTimer(OsTimerPtr timer, CARD32 now, void *arg) {
+    ScreenPtr pScreen = arg;
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+
+    NestedStatsDump(pScreen, TRUE);
+    return pNested->statsInterval * 1000;
+}
+
+/* Counts rectangles uploaded as part of a frame */
+void
+NestedStatsAddRegion(ScreenPtr pScreen, RegionPtr pRegion) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+    BoxPtr pBox = RegionRects(pRegion);
+    int nBox = RegionNumRects(pRegion);
+
+    pNested->statsRects += nBox;
+
+    while (nBox--) {
+        pNested->statsPixels += (pBox->x2 - pBox->x1) * (pBox->y2 - pBox->y1);
+        pBox++;
+    }
+}
+
+/* Counts a frame, which started uploading at start (in us) */
+void
+NestedStatsAddFrame(ScreenPtr pScreen, CARD64 start) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+
+    pNested->statsFrames++;
+    pNested->statsFrameTime[NestedStatsBucket(GetTimeInMicros() - start)]++;
+}
+
+void
+NestedStatsInit(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+
+    pNested->statsFrames = 0;
+    pNested->statsRects = 0;
+    pNested->statsPixels = 0;
+    memset(pNested->statsFrameTime, 0, sizeof(pNested->statsFrameTime));
+    pNested->statsTimer = NULL;
+
+    if (pNested->statsInterval > 0)
+        pNested->statsTimer = TimerSet(NULL, 0,
+                                       pNested->statsInterval * 1000,
+                                       NestedStatsTimer, pScreen);
+}
+
+/* The client is still there, so the final counters can be dumped */
+void
+NestedStatsClose(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+
+    if (pNested->statsInterval > 0)
+        NestedStatsDump(pScreen, FALSE);
+
+    TimerFree(pNested->statsTimer);
+    pNested->statsTimer = NULL;
+}
@@ -0,0 +1,274 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Latency tracing.
+ *
+ * With Option "TraceFile", each frame is timestamped along its way to the
+ * host, and written to that file as Chrome trace events, which Perfetto
+ * (ui.perfetto.dev) and chrome://tracing can show:
+ *
+ *   damage  from the first drawing request damaging the screen to the
+ *           upload starting, including frames held back;
+ *   replay  host-side commands of the acceleration layer, after sending
+ *           mirrors what they are missing;
+ *   upload  images put to the host;
+ *   flush   writing all of it to the connection;
+ *   host    from the flush to the host answering a request sent right
+ *           after, so having gone through the frame (on its own track, as
+ *           it overlaps with the next frames).
+ *
+ * Timestamps are in microseconds of the server's monotonic clock.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <xorg-server.h>
+#include <damage.h>
+#include <scrnintstr.h>
+#include <xf86.h>
+
+#include "compat-api.h"
+
+#include "driver.h"
+
+/* Frames waiting for the host, beyond which the oldest one is forgotten */
+#define NESTED_TRACE_IN_FLIGHT 64
+
+#define NESTED_TRACE_SERVER 0
+#define NESTED_TRACE_HOST   1
+
+typedef struct NestedTraceFrame {
+    unsigned long frame;
+    CARD64        flushed;
+    unsigned int  fence;
+} NestedTraceFrameRec;
+
+struct NestedTrace {
+    FILE               *file;
+    Bool                empty;    /* no event written yet */
+    DamagePtr           damage;
+    CARD64              damaged;  /* first damage since the last frame */
+    unsigned long       frame;
+    CARD64              mark;     /* end of the last stage */
+    NestedTraceFrameRec inFlight[NESTED_TRACE_IN_FLIGHT];
+    int                 first;
+    int                 numInFlight;
+};
+
+static void
+NestedTraceWrite(NestedTracePtr pTrace, const char *event) {
+    fprintf(pTrace->file, "%s%s", pTrace->empty ? "" : ",\n", event);
+    pTrace->empty = FALSE;
+}
+
+static void
+NestedTraceEvent(ScreenPtr pScreen, int track, const char *name,
+                 CARD64 start, CARD64 end, unsigned long frame) {
+    NestedTracePtr pTrace = PNESTED(xf86ScreenToScrn(pScreen))->trace;
+    char event[256];
+
+    snprintf(event, sizeof(event),
+             "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+             "\"ts\":%llu,\"dur\":%llu,\"args\":{\"frame\":%lu}}",
+             name, pScreen->myNum, track,
+             (unsigned long long)start, (unsigned long long)(end - start),
+             frame);
+    NestedTraceWrite(pTrace, event);
+}
+
+static void
+NestedTraceName(ScreenPtr pScreen, int track, const char *name) {
+    NestedTracePtr pTrace = PNESTED(xf86ScreenToScrn(pScreen))->trace;
+    char event[256];
+
+    snprintf(event, sizeof(event),
+             "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+             "\"args\":{\"name\":\"%s\"}}",
+             pScreen->myNum, track, name);
+    NestedTraceWrite(pTrace, event);
+}
+
+static void
+NestedTraceDamageReport(DamagePtr pDamage, RegionPtr pRegion, void *closure) {
+    NestedTracePtr pTrace = PNESTED(xf86ScreenToScrn(closure))->trace;
+
+    /* Only reported when the damage stops being empty */
+    if (pTrace)
+        pTrace->damaged = GetTimeInMicros();
+}
+
+/* Starts a frame, at the beginning of an update */
+void
+NestedTraceBegin(ScreenPtr pScreen) {
+    NestedTracePtr pTrace = PNESTED(xf86ScreenToScrn(pScreen))->trace;
+
+    if (!pTrace)
+        return;
+
+    pTrace->frame++;
+    pTrace->mark = GetTimeInMicros();
+
+    if (pTrace->damaged) {
+        NestedTraceEvent(pScreen, NESTED_TRACE_SERVER, "damage",
+                         pTrace->damaged, pTrace->mark, pTrace->frame);
+        pTrace->damaged = 0;
+    }
+
+    if (pTrace->damage)
+        DamageEmpty(pTrace->damage);
+}
+
+/* Ends the stage of the frame going on since the last mark */
+void
+NestedTraceMark(ScreenPtr pScreen, const char *stage) {
+    NestedTracePtr pTrace = PNESTED(xf86ScreenToScrn(pScreen))->trace;
+    CARD64 now;
+
+    if (!pTrace)
+        return;
+
+    now = GetTimeInMicros();
+    NestedTraceEvent(pScreen, NESTED_TRACE_SERVER, stage,
+                     pTrace->mark, now, pTrace->frame);
+    pTrace->mark = now;
+}
+
+/* Ends a frame, right after it was flushed */
+void
+NestedTraceEnd(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+    NestedTracePtr pTrace = pNested->trace;
+    NestedTraceFrameRec *pFrame;
+
+    if (!pTrace)
+        return;
+
+    NestedTraceMark(pScreen, "flush");
+
+    if (pTrace->numInFlight == NESTED_TRACE_IN_FLIGHT) {
+        pTrace->first = (pTrace->first + 1) % NESTED_TRACE_IN_FLIGHT;
+        pTrace->numInFlight--;
+    }
+
+    pFrame = &pTrace->inFlight[(pTrace->first + pTrace->numInFlight++) %
+                               NESTED_TRACE_IN_FLIGHT];
+    pFrame->frame = pTrace->frame;
+    pFrame->flushed = pTrace->mark;
+    pFrame->fence = NestedClientFence(pNested->clientData);
+}
+
+/* Called from the block handler, to time the frames the host went through */
+void
+NestedTraceCheck(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+    NestedTracePtr pTrace = pNested->trace;
+    NestedTraceFrameRec *pFrame;
+
+    if (!pTrace)
+        return;
+
+    /* The host answers in order */
+    while (pTrace->numInFlight > 0) {
+        pFrame = &pTrace->inFlight[pTrace->first];
+
+        if (!NestedClientFenceDone(pNested->clientData, pFrame->fence))
+            break;
+
+        NestedTraceEvent(pScreen, NESTED_TRACE_HOST, "host",
+                         pFrame->flushed, GetTimeInMicros(), pFrame->frame);
+        pTrace->first = (pTrace->first + 1) % NESTED_TRACE_IN_FLIGHT;
+        pTrace->numInFlight--;
+    }
+}
+
+void
+NestedTraceInit(ScreenPtr pScreen) {
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    NestedTracePtr pTrace;
+
+    pNested->trace = NULL;
+
+    if (!pNested->traceFile)
+        return;
+
+    pTrace = calloc(1, sizeof(struct NestedTrace));
+    if (!pTrace)
+        return;
+
+    pTrace->file = fopen(pNested->traceFile, "w");
+    if (!pTrace->file) {
+        xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+                   "Failed to open trace file %s\n", pNested->traceFile);
+        free(pTrace);
+        return;
+    }
+
+    pTrace->empty = TRUE;
+    pNested->trace = pTrace;
+
+    fprintf(pTrace->file, "[\n");
+    NestedTraceName(pScreen, NESTED_TRACE_SERVER, "server");
+    NestedTraceName(pScreen, NESTED_TRACE_HOST, "host");
+}
+
+/* Damage has to be tracked on the screen pixmap, which exists by now */
+Bool
+NestedTraceCreateResources(ScreenPtr pScreen) {
+    NestedTracePtr pTrace = PNESTED(xf86ScreenToScrn(pScreen))->trace;
+
+    if (!pTrace)
+        return TRUE;
+
+    pTrace->damage = DamageCreate(NestedTraceDamageReport, NULL,
+                                  DamageReportNonEmpty, TRUE,
+                                  pScreen, pScreen);
+    if (!pTrace->damage)
+        return FALSE;
+
+    DamageRegister(&(*pScreen->GetScreenPixmap)(pScreen)->drawable,
+                   pTrace->damage);
+    return TRUE;
+}
+
+void
+NestedTraceClose(ScreenPtr pScreen) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+    NestedTracePtr pTrace = pNested->trace;
+
+    if (!pTrace)
+        return;
+
+    /* Frames still waiting for the host are left out */
+    fprintf(pTrace->file, "\n]\n");
+    fclose(pTrace->file);
+
+    /* The damage itself goes away along with the screen pixmap, and
+     * doesn't look for the trace anymore */
+    free(pTrace);
+    pNested->trace = NULL;
+}
@@ -28,6 +28,7 @@
 #endif
 
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <sys/shm.h>
@@ -35,44 +36,191 @@
 #include <xorg-server.h>
 #include <xf86.h>
 #include <xf86Priv.h>
+#include <fourcc.h>
+#include <regionstr.h>
 
 #include <xcb/xcb.h>
+#include <xcb/xcbext.h>
 #include <xcb/xcb_aux.h>
 #include <xcb/xcb_event.h>
 #include <xcb/xcb_icccm.h>
 #include <xcb/xcb_image.h>
 #include <xcb/shm.h>
 #include <xcb/randr.h>
+#include <xcb/render.h>
+#include <xcb/xcb_renderutil.h>
+#include <xcb/xv.h>
 
 #include "client.h"
+#include "probes.h"
 
 #define BUF_LEN 256
+
+/* Of debugging text from the top-left corner of the window */
+#define TEXT_MARGIN 4
 #define MAX_CONNECTION_TRIES 10
 #define WAIT_BEFORE_RETRY_CONNECTION_MSEC 100
 
+#define TILE_SIZE 64
+#define TILE_CACHE_COLUMNS 32
+#define TILE_CACHE_MAX_SIZE (TILE_CACHE_COLUMNS * (32767 / TILE_SIZE))
+
+/* Most glyphs a CompositeGlyphs element can hold */
+#define GLYPHS_PER_ELT 254
+
+/* Coarse uploads are downscaled that many times in each direction */
+#define COARSE_SCALE 4
+
+/* Segments of nested clients kept attached on the host */
+#define SHARED_SEGMENTS 4
+
 extern char *display;
 
 static xcb_atom_t atom_WM_DELETE_WINDOW;
+static xcb_atom_t atom_NET_WM_STATE;
+static xcb_atom_t atom_NET_WM_STATE_HIDDEN;
+
+/* A TILE_SIZE x TILE_SIZE block of pixels previously uploaded to the host,
+ * kept in a slot of the tile cache pixmap */
+typedef struct XCBClientTile {
+    uint64_t hash;
+    int slot;
+    struct XCBClientTile *hashNext;
+    struct XCBClientTile *lruPrev;
+    struct XCBClientTile *lruNext;
+} XCBClientTileRec, *XCBClientTilePtr;
+
+typedef struct XCBClientTileCache {
+    int size;
+    int used;
+    int tileStride;
+    XCBClientTilePtr tiles;
+    XCBClientTilePtr *buckets;
+    unsigned int bucketMask;
+    XCBClientTilePtr lruHead; /* most recently used */
+    XCBClientTilePtr lruTail;
+    uint8_t *data;            /* local copy of each slot, to check hits */
+    xcb_pixmap_t pixmap;
+    unsigned long hits;
+    unsigned long misses;
+} XCBClientTileCacheRec;
+
+typedef struct XCBClientRender {
+    Bool enabled;
+    xcb_render_picture_t picture;    /* the window */
+    xcb_render_pictformat_t a8;
+    xcb_render_glyphset_t glyphset;
+    uint32_t lastGlyph;
+    uint32_t *freedGlyphs;           /* to free once replayed */
+    int numFreedGlyphs;
+    int sizeFreedGlyphs;
+} XCBClientRenderRec;
+
+typedef struct XCBClientVideo {
+    Bool enabled;
+    xcb_xv_port_t port;
+    xcb_gcontext_t gc;
+    uint32_t formats[3];             /* supported by the host port */
+    int numFormats;
+
+    /* Last frame, laid out as the host port wants it */
+    int id;
+    int width;
+    int height;
+    int numPlanes;
+    uint32_t pitches[3];
+    uint32_t offsets[3];
+    uint32_t size;
+    uint8_t *data;
+    Bool usingShm;
+    xcb_shm_segment_info_t shminfo;
+} XCBClientVideoRec;
+
+/* Downscaled uploads, scaled back up by the host */
+typedef struct XCBClientCoarse {
+    Bool enabled;
+    xcb_pixmap_t pixmap;
+    xcb_render_picture_t source;     /* the pixmap, scaled up */
+    xcb_render_picture_t picture;    /* the window */
+    int width;                       /* of the pixmap */
+    int height;
+    uint32_t *data;                  /* downscaled pixels */
+} XCBClientCoarseRec;
+
+/* A shared memory segment of a nested client, attached on the host */
+typedef struct XCBClientSharedSeg {
+    Bool used;
+    Bool failed;               /* the host can't attach it */
+    int shmid;
+    xcb_shm_seg_t shmseg;
+    unsigned long lastUse;
+} XCBClientSharedSegRec, *XCBClientSharedSegPtr;
+
+/* A host window showing the part of the framebuffer at (x, y) */
+typedef struct XCBClientView {
+    xcb_window_t window;
+    int x;
+    int y;
+    int hostX;                 /* in the host root window */
+    int hostY;
+    unsigned int width;
+    unsigned int height;
+    Bool mapped;
+    Bool obscured;
+    Bool hidden;
+} XCBClientViewRec, *XCBClientViewPtr;
 
 struct NestedClientPrivate {
     /* Host X server data */
+    const char *displayName;   /* NULL for $DISPLAY */
     int screenNumber;
     xcb_connection_t *conn;
+    Bool isMirror;             /* shows the framebuffer of another client */
+    Bool lost;                 /* mirror connection closed */
+    Bool paced;                /* flushes are followed by a fence */
+    Bool fencePending;         /* host hasn't processed the last flush */
+    unsigned int fence;
+    CARD64 fenceTime;          /* when it was flushed, in us */
+    unsigned long latencyFrames;
+    CARD64 latencyTotal;       /* us */
+    CARD64 latencyMax;
+    NestedClientStats stats;
     xcb_visualtype_t *visual;
     xcb_window_t rootWindow;
     xcb_gcontext_t gc;
+    xcb_gcontext_t copyGC;
+    xcb_gcontext_t fillGC;
+    xcb_gcontext_t tileGC;
     Bool usingShm;
 
     /* Nested X server window data */
-    xcb_window_t window;
+    xcb_window_t window;       /* of the first view */
+    XCBClientViewPtr views;    /* one per host output, or top-level window */
+    int numViews;
+    Bool rootless;
+    int originX;               /* of the framebuffer on the host */
+    int originY;
+    xcb_cursor_t emptyCursor;
     int scrnIndex;
-    int x;
-    int y;
     unsigned int width;
     unsigned int height;
     Bool usingFullscreen;
+    Bool lowLatency;           /* override-redirect */
+    Bool occlusionChanged;
+    BoxPtr occluders;          /* parts covered by other host windows */
+    int numOccluders;
     xcb_image_t *img;
     xcb_shm_segment_info_t shminfo;
+    XCBClientTileCacheRec tileCache;
+    XCBClientRenderRec render;
+    XCBClientVideoRec video;
+    XCBClientCoarseRec coarse;
+    xcb_gcontext_t textGC;     /* debugging text, XCB_NONE until used */
+    int textAscent;
+    int textHeight;
+    int textWidth;             /* of a character */
+    XCBClientSharedSegRec sharedSegs[SHARED_SEGMENTS];
+    unsigned long sharedUse;
 
     /* Common data */
     uint32_t attrs[2];
@@ -127,11 +275,11 @@ XCBClientConnectionHasError(int scrnIndex,
 }
 
 static xcb_connection_t *
-XCBClientConnectOrRetry(int scrnIndex, int *n) {
+XCBClientConnectOrRetry(int scrnIndex, const char *displayName, int *n) {
     xcb_connection_t *connection;
 
     for (int i = 0; i < MAX_CONNECTION_TRIES; i++) {
-        connection = xcb_connect(NULL, n);
+        connection = xcb_connect(displayName, n);
 
         if (!XCBClientConnectionHasError(scrnIndex, connection)) {
             return connection;
@@ -448,6 +596,7 @@ XCBClientCreateXImage(NestedClientPrivatePtr pPriv, int depth) {
 
 static void
 XCBClientWindowSetTitle(NestedClientPrivatePtr pPriv,
+                        xcb_window_t window,
                         const char *extra_text) {
     char buf[BUF_LEN + 1];
 
@@ -455,11 +604,11 @@ XCBClientWindowSetTitle(NestedClientPrivatePtr pPriv,
     snprintf(buf, BUF_LEN, "Xorg at :%s.%d nested on %s%s%s",
              display,
              pPriv->scrnIndex,
-             getenv("DISPLAY"),
+             pPriv->displayName ? pPriv->displayName : getenv("DISPLAY"),
              extra_text ? " " : "",
              extra_text ? extra_text : "");
     xcb_icccm_set_wm_name(pPriv->conn,
-                          pPriv->window,
+                          window,
                           XCB_ATOM_STRING,
                           8,
                           strlen(buf),
@@ -468,6 +617,7 @@ XCBClientWindowSetTitle(NestedClientPrivatePtr pPriv,
 
 static void
 XCBClientWindowSetWMClass(NestedClientPrivatePtr pPriv,
+                    xcb_window_t window,
                     const char *wm_class) {
     const char *resource_name = getenv("RESOURCE_NAME");
     size_t class_len;
@@ -484,7 +634,7 @@ XCBClientWindowSetWMClass(NestedClientPrivatePtr pPriv,
         strcpy(class_hint + strlen(resource_name) + 1, wm_class);
         xcb_change_property(pPriv->conn,
                             XCB_PROP_MODE_REPLACE,
-                            pPriv->window,
+                            window,
                             XCB_ATOM_WM_CLASS,
                             XCB_ATOM_STRING,
                             8,
@@ -497,12 +647,16 @@ XCBClientWindowSetWMClass(NestedClientPrivatePtr pPriv,
 static Bool
 XCBClientConnectToServer(NestedClientPrivatePtr pPriv) {
     uint16_t red, green, blue;
-    uint32_t pixel;
+    uint32_t pixel, noExposures = 0;
     xcb_screen_t *screen;
 
-    pPriv->attrs[0] = XCB_EVENT_MASK_EXPOSURE;
+    pPriv->attrs[0] = XCB_EVENT_MASK_EXPOSURE |
+                      XCB_EVENT_MASK_STRUCTURE_NOTIFY |
+                      XCB_EVENT_MASK_VISIBILITY_CHANGE |
+                      XCB_EVENT_MASK_PROPERTY_CHANGE;
     pPriv->attr_mask = XCB_CW_EVENT_MASK;
-    pPriv->conn = XCBClientConnectOrRetry(pPriv->scrnIndex, &pPriv->screenNumber);
+    pPriv->conn = XCBClientConnectOrRetry(pPriv->scrnIndex, pPriv->displayName,
+                                          &pPriv->screenNumber);
 
     if (XCBClientConnectionHasError(pPriv->scrnIndex, pPriv->conn))
         return FALSE;
@@ -536,12 +690,27 @@ XCBClientConnectToServer(NestedClientPrivatePtr pPriv) {
         }
 
         xcb_change_gc(pPriv->conn, pPriv->gc, XCB_GC_FOREGROUND, &pixel);
+
+        /* Host-side copies get their clip set on each use, and rely on
+         * GraphicsExpose to learn about sources that were obscured */
+        pPriv->copyGC = xcb_generate_id(pPriv->conn);
+        xcb_create_gc(pPriv->conn, pPriv->copyGC, pPriv->rootWindow, 0, NULL);
+
+        pPriv->fillGC = xcb_generate_id(pPriv->conn);
+        xcb_create_gc(pPriv->conn, pPriv->fillGC, pPriv->rootWindow, 0, NULL);
+
+        /* Copies from the tile cache always find their source, and would
+         * only get a NoExpose back for each tile */
+        pPriv->tileGC = xcb_generate_id(pPriv->conn);
+        xcb_create_gc(pPriv->conn, pPriv->tileGC, pPriv->rootWindow,
+                      XCB_GC_GRAPHICS_EXPOSURES, &noExposures);
         return TRUE;
     }
 }
 
 static void
-XCBClientWindowSetFullscreenHint(NestedClientPrivatePtr pPriv) {
+XCBClientWindowSetFullscreenHint(NestedClientPrivatePtr pPriv,
+                                 xcb_window_t window) {
     xcb_intern_atom_cookie_t cookie_WINDOW_STATE,
         cookie_WINDOW_STATE_FULLSCREEN;
     xcb_atom_t atom_WINDOW_STATE, atom_WINDOW_STATE_FULLSCREEN;
@@ -566,7 +735,7 @@ XCBClientWindowSetFullscreenHint(NestedClientPrivatePtr pPriv) {
 
     xcb_change_property(pPriv->conn,
                         XCB_PROP_MODE_REPLACE,
-                        pPriv->window,
+                        window,
                         atom_WINDOW_STATE,
                         XCB_ATOM_ATOM,
                         32,
@@ -574,8 +743,36 @@ XCBClientWindowSetFullscreenHint(NestedClientPrivatePtr pPriv) {
                         &atom_WINDOW_STATE_FULLSCREEN);
 }
 
+/* Asks the host compositor to leave the window alone, so it is scanned out
+ * directly instead of composited a frame later */
+static void
+XCBClientWindowSetBypassCompositor(NestedClientPrivatePtr pPriv,
+                                  xcb_window_t window) {
+    xcb_intern_atom_cookie_t cookie;
+    xcb_intern_atom_reply_t *reply;
+    uint32_t bypass = 1;
+
+    cookie = xcb_intern_atom(pPriv->conn, FALSE,
+                             strlen("_NET_WM_BYPASS_COMPOSITOR"),
+                             "_NET_WM_BYPASS_COMPOSITOR");
+    reply = xcb_intern_atom_reply(pPriv->conn, cookie, NULL);
+    if (!reply)
+        return;
+
+    xcb_change_property(pPriv->conn,
+                        XCB_PROP_MODE_REPLACE,
+                        window,
+                        reply->atom,
+                        XCB_ATOM_CARDINAL,
+                        32,
+                        1,
+                        &bypass);
+    free(reply);
+}
+
 static void
-XCBClientWindowSetDeleteWindowHint(NestedClientPrivatePtr pPriv) {
+XCBClientWindowSetDeleteWindowHint(NestedClientPrivatePtr pPriv,
+                                   xcb_window_t window) {
     xcb_intern_atom_cookie_t cookie_WM_PROTOCOLS,
         cookie_WM_DELETE_WINDOW;
     xcb_atom_t atom_WM_PROTOCOLS;
@@ -600,7 +797,7 @@ XCBClientWindowSetDeleteWindowHint(NestedClientPrivatePtr pPriv) {
 
     xcb_change_property(pPriv->conn,
                         XCB_PROP_MODE_REPLACE,
-                        pPriv->window,
+                        window,
                         atom_WM_PROTOCOLS,
                         XCB_ATOM_ATOM,
                         32,
@@ -609,93 +806,300 @@ XCBClientWindowSetDeleteWindowHint(NestedClientPrivatePtr pPriv) {
 }
 
 static void
-XCBClientWindowCreate(NestedClientPrivatePtr pPriv) {
+XCBClientInternVisibilityAtoms(NestedClientPrivatePtr pPriv) {
+    xcb_intern_atom_cookie_t cookie_WINDOW_STATE,
+        cookie_WINDOW_STATE_HIDDEN;
+    xcb_intern_atom_reply_t *reply;
+
+    cookie_WINDOW_STATE = xcb_intern_atom(pPriv->conn, FALSE,
+                                          strlen("_NET_WM_STATE"),
+                                          "_NET_WM_STATE");
+    cookie_WINDOW_STATE_HIDDEN =
+        xcb_intern_atom(pPriv->conn, FALSE,
+                        strlen("_NET_WM_STATE_HIDDEN"),
+                        "_NET_WM_STATE_HIDDEN");
+
+    reply = xcb_intern_atom_reply(pPriv->conn, cookie_WINDOW_STATE, NULL);
+    atom_NET_WM_STATE = reply ? reply->atom : XCB_NONE;
+    free(reply);
+
+    reply = xcb_intern_atom_reply(pPriv->conn, cookie_WINDOW_STATE_HIDDEN,
+                                  NULL);
+    atom_NET_WM_STATE_HIDDEN = reply ? reply->atom : XCB_NONE;
+    free(reply);
+}
+
+static void
+XCBClientWindowCreate(NestedClientPrivatePtr pPriv,
+                      XCBClientViewPtr view,
+                      const char *name) {
     xcb_size_hints_t sizeHints;
     uint32_t mask = XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y;
-    uint32_t values[2] = {pPriv->x, pPriv->y};
+    uint32_t values[2] = {view->hostX, view->hostY};
 
     sizeHints.flags = XCB_ICCCM_SIZE_HINT_P_POSITION
                       | XCB_ICCCM_SIZE_HINT_P_SIZE
                       | XCB_ICCCM_SIZE_HINT_P_MIN_SIZE
                       | XCB_ICCCM_SIZE_HINT_P_MAX_SIZE;
-    sizeHints.min_width = pPriv->width;
-    sizeHints.max_width = pPriv->width;
-    sizeHints.min_height = pPriv->height;
-    sizeHints.max_height = pPriv->height;
-
-    pPriv->window = xcb_generate_id(pPriv->conn);
+    sizeHints.min_width = view->width;
+    sizeHints.max_width = view->width;
+    sizeHints.min_height = view->height;
+    sizeHints.max_height = view->height;
+
+    view->window = xcb_generate_id(pPriv->conn);
+
+    /* The event mask is set at creation, so MapNotify can't be missed */
+    view->mapped = FALSE;
+    view->obscured = FALSE;
+    view->hidden = FALSE;
+
+    /* Rootless windows are managed by the nested window manager */
+    if (pPriv->rootless) {
+        uint32_t attrs[2] = { TRUE, pPriv->attrs[0] };
+
+        xcb_create_window(pPriv->conn,
+                          XCB_COPY_FROM_PARENT,
+                          view->window,
+                          pPriv->rootWindow,
+                          view->hostX, view->hostY,
+                          view->width, view->height,
+                          0,
+                          XCB_WINDOW_CLASS_COPY_FROM_PARENT,
+                          pPriv->visual->visual_id,
+                          XCB_CW_OVERRIDE_REDIRECT | XCB_CW_EVENT_MASK,
+                          attrs);
+        xcb_map_window(pPriv->conn, view->window);
+        return;
+    }
 
-    xcb_create_window(pPriv->conn,
-                      XCB_COPY_FROM_PARENT,
-                      pPriv->window,
-                      pPriv->rootWindow,
-                      0, 0, pPriv->width, pPriv->height,
-                      0,
-                      XCB_WINDOW_CLASS_COPY_FROM_PARENT,
-                      pPriv->visual->visual_id,
-                      pPriv->attr_mask,
-                      pPriv->attrs);
+    /* Without a window manager in the way, nothing delays or decorates the
+     * window; it is placed on its output right away */
+    if (pPriv->lowLatency) {
+        uint32_t attrs[2] = { TRUE, pPriv->attrs[0] };
+
+        xcb_create_window(pPriv->conn,
+                          XCB_COPY_FROM_PARENT,
+                          view->window,
+                          pPriv->rootWindow,
+                          view->hostX, view->hostY,
+                          view->width, view->height,
+                          0,
+                          XCB_WINDOW_CLASS_COPY_FROM_PARENT,
+                          pPriv->visual->visual_id,
+                          XCB_CW_OVERRIDE_REDIRECT | pPriv->attr_mask,
+                          attrs);
+    } else
+        xcb_create_window(pPriv->conn,
+                          XCB_COPY_FROM_PARENT,
+                          view->window,
+                          pPriv->rootWindow,
+                          0, 0, view->width, view->height,
+                          0,
+                          XCB_WINDOW_CLASS_COPY_FROM_PARENT,
+                          pPriv->visual->visual_id,
+                          pPriv->attr_mask,
+                          pPriv->attrs);
 
     xcb_icccm_set_wm_normal_hints(pPriv->conn,
-                                  pPriv->window,
+                                  view->window,
                                   &sizeHints);
 
     if (pPriv->usingFullscreen)
-        XCBClientWindowSetFullscreenHint(pPriv);
+        XCBClientWindowSetFullscreenHint(pPriv, view->window);
+
+    if (pPriv->lowLatency)
+        XCBClientWindowSetBypassCompositor(pPriv, view->window);
 
-    XCBClientWindowSetDeleteWindowHint(pPriv);
-    XCBClientWindowSetTitle(pPriv, NULL);
-    XCBClientWindowSetWMClass(pPriv, "Xorg");
+    XCBClientWindowSetDeleteWindowHint(pPriv, view->window);
+    XCBClientWindowSetTitle(pPriv, view->window,
+                            pPriv->numViews > 1 ? name : NULL);
+    XCBClientWindowSetWMClass(pPriv, view->window, "Xorg");
 
-    xcb_map_window(pPriv->conn, pPriv->window);
+    xcb_map_window(pPriv->conn, view->window);
 
     /* Put this code after xcb_map_window() call, so that
      * our window position values won't be overriden by WM. */
-    xcb_configure_window(pPriv->conn, pPriv->window, mask, values);
+    xcb_configure_window(pPriv->conn, view->window, mask, values);
 }
 
-static void
-XCBClientWindowHideCursor(NestedClientPrivatePtr pPriv) {
-    uint32_t pixel = 0;
-    xcb_cursor_t empty_cursor = xcb_generate_id(pPriv->conn);
-    xcb_pixmap_t cursor_pxm = xcb_generate_id(pPriv->conn);
-    xcb_gcontext_t cursor_gc = xcb_generate_id(pPriv->conn);
-    xcb_rectangle_t rect = {0, 0, 1, 1};
+/* Makes a view for each output, placed in the framebuffer as the outputs
+ * are on the host */
+static Bool
+XCBClientCreateViews(NestedClientPrivatePtr pPriv,
+                     int numOutputs,
+                     const Output *outputs) {
+    int i, originX = outputs[0].x, originY = outputs[0].y;
+
+    for (i = 1; i < numOutputs; i++) {
+        originX = min(originX, outputs[i].x);
+        originY = min(originY, outputs[i].y);
+    }
+
+    pPriv->originX = originX;
+    pPriv->originY = originY;
+    pPriv->window = XCB_NONE;
+
+    /* Views come and go with the nested top-level windows */
+    if (pPriv->rootless) {
+        pPriv->views = NULL;
+        pPriv->numViews = 0;
+    } else {
+        pPriv->views = calloc(numOutputs, sizeof(XCBClientViewRec));
+        if (!pPriv->views)
+            return FALSE;
+
+        pPriv->numViews = numOutputs;
+    }
+
+    pPriv->occlusionChanged = TRUE;
+    pPriv->occluders = NULL;
+    pPriv->numOccluders = 0;
+    XCBClientInternVisibilityAtoms(pPriv);
+
+    /* Other top-level windows moving around change what is visible */
+    {
+        uint32_t mask = XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY;
+        xcb_change_window_attributes(pPriv->conn, pPriv->rootWindow,
+                                     XCB_CW_EVENT_MASK, &mask);
+    }
+
+    for (i = 0; i < pPriv->numViews; i++) {
+        XCBClientViewPtr view = &pPriv->views[i];
 
-    xcb_create_pixmap(pPriv->conn, 1, cursor_pxm, pPriv->rootWindow, 1, 1);
-    xcb_create_gc(pPriv->conn, cursor_gc, cursor_pxm,
-                  XCB_GC_FOREGROUND, &pixel);
-    xcb_poly_fill_rectangle(pPriv->conn, cursor_pxm, cursor_gc, 1, &rect);
-    xcb_free_gc(pPriv->conn, cursor_gc);
+        view->x = outputs[i].x - originX;
+        view->y = outputs[i].y - originY;
+        view->hostX = outputs[i].x;
+        view->hostY = outputs[i].y;
+        view->width = outputs[i].width;
+        view->height = outputs[i].height;
+        XCBClientWindowCreate(pPriv, view, outputs[i].name);
+    }
+
+    if (pPriv->numViews > 0)
+        pPriv->window = pPriv->views[0].window;
+
+    return TRUE;
+}
+
+static XCBClientViewPtr
+XCBClientFindView(NestedClientPrivatePtr pPriv, xcb_window_t window) {
+    int i;
+
+    for (i = 0; i < pPriv->numViews; i++)
+        if (pPriv->views[i].window == window)
+            return &pPriv->views[i];
+
+    return NULL;
+}
 
-    xcb_create_cursor(pPriv->conn,
-                      empty_cursor,
-                      cursor_pxm, cursor_pxm,
-                      0, 0, 0,
-                      0, 0, 0,
-                      1, 1);
-    xcb_free_pixmap(pPriv->conn, cursor_pxm);
+static void
+XCBClientWindowHideCursor(NestedClientPrivatePtr pPriv) {
+    int i;
+
+    if (pPriv->emptyCursor == XCB_NONE) {
+        uint32_t pixel = 0;
+        xcb_pixmap_t cursor_pxm = xcb_generate_id(pPriv->conn);
+        xcb_gcontext_t cursor_gc = xcb_generate_id(pPriv->conn);
+        xcb_rectangle_t rect = {0, 0, 1, 1};
+
+        pPriv->emptyCursor = xcb_generate_id(pPriv->conn);
+
+        xcb_create_pixmap(pPriv->conn, 1, cursor_pxm, pPriv->rootWindow, 1, 1);
+        xcb_create_gc(pPriv->conn, cursor_gc, cursor_pxm,
+                      XCB_GC_FOREGROUND, &pixel);
+        xcb_poly_fill_rectangle(pPriv->conn, cursor_pxm, cursor_gc, 1, &rect);
+        xcb_free_gc(pPriv->conn, cursor_gc);
+
+        xcb_create_cursor(pPriv->conn,
+                          pPriv->emptyCursor,
+                          cursor_pxm, cursor_pxm,
+                          0, 0, 0,
+                          0, 0, 0,
+                          1, 1);
+        xcb_free_pixmap(pPriv->conn, cursor_pxm);
+    }
 
-    xcb_change_window_attributes(pPriv->conn,
-                                 pPriv->window,
-                                 XCB_CW_CURSOR,
-                                 &empty_cursor);
+    for (i = 0; i < pPriv->numViews; i++)
+        xcb_change_window_attributes(pPriv->conn,
+                                     pPriv->views[i].window,
+                                     XCB_CW_CURSOR,
+                                     &pPriv->emptyCursor);
 }
 
 static void
 XCBClientHandleEventExpose(NestedClientPrivatePtr pPriv,
                            xcb_expose_event_t *event) {
-    NestedClientUpdateScreen(pPriv,
-                             event->x,
-                             event->y,
-                             event->x + event->width,
-                             event->y + event->height);
+    XCBClientViewPtr view = XCBClientFindView(pPriv, event->window);
+
+    if (view) {
+        pPriv->stats.exposes++;
+        NestedClientUpdateScreen(pPriv,
+                                 view->x + event->x,
+                                 view->y + event->y,
+                                 view->x + event->x + event->width,
+                                 view->y + event->y + event->height);
+    }
+}
+
+static void
+XCBClientHandleEventGraphicsExposure(NestedClientPrivatePtr pPriv,
+                                     xcb_graphics_exposure_event_t *event) {
+    XCBClientViewPtr view = XCBClientFindView(pPriv, event->drawable);
+
+    /* The source of a host-side copy wasn't available, so upload what it
+     * should have produced from the framebuffer instead */
+    if (view)
+        NestedClientUpdateScreen(pPriv,
+                                 view->x + event->x,
+                                 view->y + event->y,
+                                 view->x + event->x + event->width,
+                                 view->y + event->y + event->height);
+}
+
+static void
+XCBClientHandleEventPropertyNotify(NestedClientPrivatePtr pPriv,
+                                   xcb_property_notify_event_t *event) {
+    xcb_get_property_cookie_t cookie;
+    xcb_get_property_reply_t *reply;
+    XCBClientViewPtr view = XCBClientFindView(pPriv, event->window);
+    xcb_atom_t *atoms;
+    int i, n;
+
+    if (!view || event->atom != atom_NET_WM_STATE ||
+        atom_NET_WM_STATE == XCB_NONE)
+        return;
+
+    cookie = xcb_get_property(pPriv->conn, FALSE, view->window,
+                              atom_NET_WM_STATE, XCB_ATOM_ATOM, 0, 32);
+    reply = xcb_get_property_reply(pPriv->conn, cookie, NULL);
+    view->hidden = FALSE;
+
+    if (!reply)
+        return;
+
+    if (reply->type == XCB_ATOM_ATOM && reply->format == 32) {
+        atoms = xcb_get_property_value(reply);
+        n = xcb_get_property_value_length(reply) / sizeof(xcb_atom_t);
+
+        for (i = 0; i < n; i++)
+            if (atoms[i] == atom_NET_WM_STATE_HIDDEN)
+                view->hidden = TRUE;
+    }
+
+    free(reply);
 }
 
 static void
 XCBClientHandleEventClientMessage(NestedClientPrivatePtr pPriv,
                                   xcb_client_message_event_t *event) {
-    if (event->data.data32[0] == atom_WM_DELETE_WINDOW) {
+    if (event->data.data32[0] == atom_WM_DELETE_WINDOW && pPriv->isMirror) {
+        /* Only this display stops showing the screen */
+        xf86DrvMsg(pPriv->scrnIndex,
+                   X_INFO,
+                   "Mirror window on %s closed.\n",
+                   pPriv->displayName);
+        xcb_destroy_window(pPriv->conn, event->window);
+    } else if (event->data.data32[0] == atom_WM_DELETE_WINDOW) {
         /* XXX: Is there a better way to terminate nested Xorg
          *      on window deletion, avoiding memory leaks? */
         xf86DrvMsg(pPriv->scrnIndex,
@@ -709,10 +1113,26 @@ XCBClientHandleEventClientMessage(NestedClientPrivatePtr pPriv,
 
 static void
 XCBClientPoll(NestedClientPrivatePtr pPriv) {
+    XCBClientViewPtr view;
+
+    if (pPriv->lost)
+        return;
+
     while (TRUE) {
         xcb_generic_event_t *event = xcb_poll_for_event(pPriv->conn);
         
         if (!event) {
+            /* A mirror going away leaves the other displays running */
+            if (pPriv->isMirror &&
+                XCBClientConnectionHasError(pPriv->scrnIndex, pPriv->conn)) {
+                xf86DrvMsg(pPriv->scrnIndex,
+                           X_WARNING,
+                           "Lost connection to mirror display %s.\n",
+                           pPriv->displayName);
+                pPriv->lost = TRUE;
+                return;
+            }
+
             /* If our XCB connection has died (for example, our window was
              * closed), exit now.
              */
@@ -725,163 +1145,2154 @@ XCBClientPoll(NestedClientPrivatePtr pPriv) {
             break;
         }
 
+        NESTED_PROBE1(event, XCB_EVENT_RESPONSE_TYPE(event));
+
         switch (XCB_EVENT_RESPONSE_TYPE(event)) {
         case XCB_EXPOSE:
             XCBClientHandleEventExpose(pPriv, (xcb_expose_event_t *)event);
             break;
+        case XCB_GRAPHICS_EXPOSURE:
+            XCBClientHandleEventGraphicsExposure(pPriv, (xcb_graphics_exposure_event_t *)event);
+            break;
+        case XCB_MAP_NOTIFY:
+            view = XCBClientFindView(pPriv,
+                                     ((xcb_map_notify_event_t *)event)->window);
+            if (view)
+                view->mapped = TRUE;
+            pPriv->occlusionChanged = TRUE;
+            break;
+        case XCB_UNMAP_NOTIFY:
+            view = XCBClientFindView(pPriv,
+                                     ((xcb_unmap_notify_event_t *)event)->window);
+            if (view)
+                view->mapped = FALSE;
+            pPriv->occlusionChanged = TRUE;
+            break;
+        case XCB_CONFIGURE_NOTIFY:
+        case XCB_CIRCULATE_NOTIFY:
+        case XCB_DESTROY_NOTIFY:
+        case XCB_REPARENT_NOTIFY:
+            pPriv->occlusionChanged = TRUE;
+            break;
+        case XCB_VISIBILITY_NOTIFY:
+            view = XCBClientFindView(pPriv,
+                                     ((xcb_visibility_notify_event_t *)event)->window);
+            if (view)
+                view->obscured = ((xcb_visibility_notify_event_t *)event)->state ==
+                                 XCB_VISIBILITY_FULLY_OBSCURED;
+            break;
+        case XCB_PROPERTY_NOTIFY:
+            XCBClientHandleEventPropertyNotify(pPriv, (xcb_property_notify_event_t *)event);
+            break;
         case XCB_CLIENT_MESSAGE:
             XCBClientHandleEventClientMessage(pPriv, (xcb_client_message_event_t *)event);
         }
 
         free(event);
     }
+
+    xcb_flush(pPriv->conn);
 }
 
 /*
  * ----------------------------------------------------------------------------------------
- * PUBLIC API IMPLEMENTATION
+ * INTERNAL FUNCTIONS (needed for NestedClientUpdateScreen)
  * ----------------------------------------------------------------------------------------
  */
 
-Bool
-NestedClientCheckDisplay(int scrnIndex, OutputPtr output) {
-    int n;
-    xcb_connection_t *conn = XCBClientConnectOrRetry(scrnIndex, &n);
+static void
+XCBClientPutImage(NestedClientPrivatePtr pPriv,
+                  xcb_drawable_t drawable,
+                  int16_t srcX, int16_t srcY,
+                  uint16_t width, uint16_t height,
+                  int16_t dstX, int16_t dstY) {
+    xcb_image_t *subimg = xcb_image_subimage(pPriv->img, srcX, srcY,
+                                             width, height, 0, 0, 0);
+    xcb_image_t *img = xcb_image_native(pPriv->conn, subimg, 1);
+
+    xcb_image_put(pPriv->conn, drawable, pPriv->gc, img, dstX, dstY, 0);
+    pPriv->stats.putRects++;
+    pPriv->stats.putBytes += img->size;
+
+    if (subimg != img)
+        xcb_image_destroy(img);
+
+    xcb_image_destroy(subimg);
+}
 
-    if (XCBClientConnectionHasError(scrnIndex, conn))
-        return FALSE;
-    else if (output->name != NULL) {
-        output->width = 0;
-        output->height = 0;
-        output->x = 0;
-        output->y = 0;
+static uint64_t
+XCBClientTileHash(NestedClientPrivatePtr pPriv, int x, int y) {
+    int bytesPerLine = TILE_SIZE * pPriv->img->bpp / 8;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    int i, j;
 
-        if (!XCBClientGetOutputGeometry(scrnIndex, conn, n, output))
-            return FALSE;
-        else
-            xf86DrvMsg(scrnIndex,
-                       X_INFO,
-                       "Got CRTC geometry from output %s: %dx%d+%d+%d\n",
-                       output->name,
-                       output->width,
-                       output->height,
-                       output->x,
-                       output->y);
-    } else {
-        xcb_screen_t *s = xcb_aux_get_screen(conn, n);
-        output->width = s->width_in_pixels;
-        output->height = s->height_in_pixels;
+    for (j = 0; j < TILE_SIZE; j++) {
+        const uint8_t *row = pPriv->img->data +
+                             (y + j) * pPriv->img->stride +
+                             x * pPriv->img->bpp / 8;
+
+        for (i = 0; i + 8 <= bytesPerLine; i += 8) {
+            uint64_t word;
+
+            memcpy(&word, row + i, 8);
+            hash = (hash ^ word) * 0x100000001b3ULL;
+            hash ^= hash >> 29;
+        }
     }
 
-    xcb_disconnect(conn);
-    return TRUE;
+    return hash;
 }
 
-Bool
-NestedClientValidDepth(int depth) {
-    /* XXX: implement! */
-    return TRUE;
+static void
+XCBClientTileCacheUnlink(XCBClientTileCacheRec *cache,
+                         XCBClientTilePtr tile) {
+    if (tile->lruPrev)
+        tile->lruPrev->lruNext = tile->lruNext;
+    else
+        cache->lruHead = tile->lruNext;
+
+    if (tile->lruNext)
+        tile->lruNext->lruPrev = tile->lruPrev;
+    else
+        cache->lruTail = tile->lruPrev;
+
+    tile->lruPrev = tile->lruNext = NULL;
 }
 
-NestedClientPrivatePtr
-NestedClientCreateScreen(int scrnIndex,
-                         Bool wantFullscreenHint,
-                         int width,
-                         int height,
-                         int originX,
-                         int originY,
-                         int depth,
-                         int bitsPerPixel,
-                         Pixel *retRedMask,
-                         Pixel *retGreenMask,
-                         Pixel *retBlueMask) {
-    NestedClientPrivatePtr pPriv = malloc(sizeof(struct NestedClientPrivate));
-
-    if (!pPriv)
-        return NULL;
-    else {
-        pPriv->scrnIndex = scrnIndex;
-        pPriv->usingFullscreen = wantFullscreenHint;
-        pPriv->width = width;
-        pPriv->height = height;
-        pPriv->x = originX;
-        pPriv->y = originY;
-	pPriv->img = NULL;
+static void
+XCBClientTileCachePushFront(XCBClientTileCacheRec *cache,
+                            XCBClientTilePtr tile) {
+    tile->lruPrev = NULL;
+    tile->lruNext = cache->lruHead;
 
-        if (!XCBClientConnectToServer(pPriv)) {
-            xcb_disconnect(pPriv->conn);
-            free(pPriv);
-            return NULL;
-        } else {
-            XCBClientTryXShm(pPriv);
-            XCBClientCreateXImage(pPriv, depth);
-            XCBClientWindowCreate(pPriv);
-            XCBClientWindowHideCursor(pPriv);
-            xcb_flush(pPriv->conn);
+    if (cache->lruHead)
+        cache->lruHead->lruPrev = tile;
+    else
+        cache->lruTail = tile;
 
-#if 0
-            xf86DrvMsg(pPriv->scrnIndex, X_INFO, "width: %d\n", pPriv->img->width);
-            xf86DrvMsg(pPriv->scrnIndex, X_INFO, "height: %d\n", pPriv->img->height);
-            xf86DrvMsg(pPriv->scrnIndex, X_INFO, "depth: %d\n", pPriv->img->depth);
-            xf86DrvMsg(pPriv->scrnIndex, X_INFO, "bpp: %d\n", pPriv->img->bpp);
-            xf86DrvMsg(pPriv->scrnIndex, X_INFO, "red_mask: 0x%x\n", pPriv->visual->red_mask);
-            xf86DrvMsg(pPriv->scrnIndex, X_INFO, "gre_mask: 0x%x\n", pPriv->visual->green_mask);
-            xf86DrvMsg(pPriv->scrnIndex, X_INFO, "blu_mask: 0x%x\n", pPriv->visual->blue_mask);
-#endif
+    cache->lruHead = tile;
+}
 
-            *retRedMask = pPriv->visual->red_mask;
-            *retGreenMask = pPriv->visual->green_mask;
-            *retBlueMask = pPriv->visual->blue_mask;
+static XCBClientTilePtr
+XCBClientTileCacheLookup(NestedClientPrivatePtr pPriv,
+                         uint64_t hash, int x, int y) {
+    XCBClientTileCacheRec *cache = &pPriv->tileCache;
+    XCBClientTilePtr tile;
+    int j;
+
+    for (tile = cache->buckets[hash & cache->bucketMask];
+         tile != NULL;
+         tile = tile->hashNext) {
+        if (tile->hash != hash)
+            continue;
 
-            return pPriv;
+        /* Make sure it's not a collision */
+        for (j = 0; j < TILE_SIZE; j++) {
+            if (memcmp(cache->data + tile->slot * TILE_SIZE * cache->tileStride +
+                       j * cache->tileStride,
+                       pPriv->img->data + (y + j) * pPriv->img->stride +
+                       x * pPriv->img->bpp / 8,
+                       cache->tileStride))
+                break;
         }
+
+        if (j == TILE_SIZE)
+            return tile;
     }
+
+    return NULL;
 }
 
-void
-NestedClientHideCursor(NestedClientPrivatePtr pPriv) {
-    XCBClientWindowHideCursor(pPriv);
+static XCBClientTilePtr
+XCBClientTileCacheInsert(NestedClientPrivatePtr pPriv,
+                         uint64_t hash, int x, int y) {
+    XCBClientTileCacheRec *cache = &pPriv->tileCache;
+    XCBClientTilePtr tile, *prev;
+    int j;
+
+    if (cache->used < cache->size) {
+        tile = &cache->tiles[cache->used];
+        tile->slot = cache->used++;
+    } else {
+        /* Evict the least recently used tile */
+        tile = cache->lruTail;
+        XCBClientTileCacheUnlink(cache, tile);
+
+        for (prev = &cache->buckets[tile->hash & cache->bucketMask];
+             *prev != tile;
+             prev = &(*prev)->hashNext)
+            ;
+        *prev = tile->hashNext;
+    }
+
+    tile->hash = hash;
+    tile->hashNext = cache->buckets[hash & cache->bucketMask];
+    cache->buckets[hash & cache->bucketMask] = tile;
+
+    for (j = 0; j < TILE_SIZE; j++)
+        memcpy(cache->data + tile->slot * TILE_SIZE * cache->tileStride +
+               j * cache->tileStride,
+               pPriv->img->data + (y + j) * pPriv->img->stride +
+               x * pPriv->img->bpp / 8,
+               cache->tileStride);
+
+    XCBClientPutImage(pPriv, cache->pixmap,
+                      x, y, TILE_SIZE, TILE_SIZE,
+                      (tile->slot % TILE_CACHE_COLUMNS) * TILE_SIZE,
+                      (tile->slot / TILE_CACHE_COLUMNS) * TILE_SIZE);
+    return tile;
 }
 
-char *
-NestedClientGetFrameBuffer(NestedClientPrivatePtr pPriv) {
-    return (char *)pPriv->img->data;
+static void
+XCBClientTileCacheUpdateTile(NestedClientPrivatePtr pPriv,
+                             XCBClientViewPtr view,
+                             int x, int y) {
+    XCBClientTileCacheRec *cache = &pPriv->tileCache;
+    uint64_t hash = XCBClientTileHash(pPriv, x, y);
+    XCBClientTilePtr tile = XCBClientTileCacheLookup(pPriv, hash, x, y);
+
+    if (tile) {
+        cache->hits++;
+        XCBClientTileCacheUnlink(cache, tile);
+    } else {
+        cache->misses++;
+        tile = XCBClientTileCacheInsert(pPriv, hash, x, y);
+    }
+
+    XCBClientTileCachePushFront(cache, tile);
+
+    xcb_copy_area(pPriv->conn,
+                  cache->pixmap, view->window,
+                  pPriv->tileGC,
+                  (tile->slot % TILE_CACHE_COLUMNS) * TILE_SIZE,
+                  (tile->slot / TILE_CACHE_COLUMNS) * TILE_SIZE,
+                  x - view->x, y - view->y,
+                  TILE_SIZE, TILE_SIZE);
 }
 
-void
-NestedClientUpdateScreen(NestedClientPrivatePtr pPriv,
+/* Uploads the tiles fully inside the rectangle through the cache, and the
+ * borders around them as plain images */
+static void
+XCBClientTileCacheUpdate(NestedClientPrivatePtr pPriv,
+                         XCBClientViewPtr view,
                          int16_t x1, int16_t y1,
                          int16_t x2, int16_t y2) {
-    if (pPriv->usingShm)
-        xcb_image_shm_put(pPriv->conn, pPriv->window,
+    int tx1 = (x1 + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE;
+    int ty1 = (y1 + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE;
+    int tx2 = x2 / TILE_SIZE * TILE_SIZE;
+    int ty2 = y2 / TILE_SIZE * TILE_SIZE;
+    int x, y;
+
+    if (tx1 >= tx2 || ty1 >= ty2) {
+        XCBClientPutImage(pPriv, view->window,
+                          x1, y1, x2 - x1, y2 - y1,
+                          x1 - view->x, y1 - view->y);
+        return;
+    }
+
+    if (y1 < ty1)
+        XCBClientPutImage(pPriv, view->window,
+                          x1, y1, x2 - x1, ty1 - y1,
+                          x1 - view->x, y1 - view->y);
+    if (ty2 < y2)
+        XCBClientPutImage(pPriv, view->window,
+                          x1, ty2, x2 - x1, y2 - ty2,
+                          x1 - view->x, ty2 - view->y);
+    if (x1 < tx1)
+        XCBClientPutImage(pPriv, view->window,
+                          x1, ty1, tx1 - x1, ty2 - ty1,
+                          x1 - view->x, ty1 - view->y);
+    if (tx2 < x2)
+        XCBClientPutImage(pPriv, view->window,
+                          tx2, ty1, x2 - tx2, ty2 - ty1,
+                          tx2 - view->x, ty1 - view->y);
+
+    for (y = ty1; y < ty2; y += TILE_SIZE)
+        for (x = tx1; x < tx2; x += TILE_SIZE)
+            XCBClientTileCacheUpdateTile(pPriv, view, x, y);
+}
+
+static void
+XCBClientTileCacheFree(NestedClientPrivatePtr pPriv) {
+    XCBClientTileCacheRec *cache = &pPriv->tileCache;
+
+    if (cache->size > 0)
+        xcb_free_pixmap(pPriv->conn, cache->pixmap);
+
+    free(cache->tiles);
+    free(cache->buckets);
+    free(cache->data);
+    memset(cache, 0, sizeof(XCBClientTileCacheRec));
+}
+
+/* Uploads a rectangle of the framebuffer, which the view fully contains */
+static void
+XCBClientUpdateView(NestedClientPrivatePtr pPriv,
+                    XCBClientViewPtr view,
+                    int16_t x1, int16_t y1,
+                    int16_t x2, int16_t y2,
+                    Bool useCache) {
+    unsigned long putBytes = pPriv->stats.putBytes;
+    unsigned long bytes;
+    int transport;
+
+    if (pPriv->usingShm) {
+        xcb_image_shm_put(pPriv->conn, view->window,
                           pPriv->gc, pPriv->img,
                           pPriv->shminfo,
-                          x1, y1, x1, y1, x2 - x1, y2 - y1, FALSE);
-    else {
-        xcb_image_t *subimg = xcb_image_subimage(pPriv->img, x1, y1,
-                                                 x2 - x1, y2 - y1, 0, 0, 0);
-        xcb_image_t *img = xcb_image_native(pPriv->conn, subimg, 1);
-        xcb_image_put(pPriv->conn, pPriv->window, pPriv->gc, img, x1, y1, 0);
+                          x1, y1, x1 - view->x, y1 - view->y,
+                          x2 - x1, y2 - y1, FALSE);
+        pPriv->stats.shmRects++;
+        pPriv->stats.shmBytes += (x2 - x1) * (y2 - y1) * pPriv->img->bpp / 8;
+        transport = NESTED_PROBE_SHM;
+    } else if (useCache && pPriv->tileCache.size > 0) {
+        XCBClientTileCacheUpdate(pPriv, view, x1, y1, x2, y2);
+        transport = NESTED_PROBE_CACHE;
+    } else {
+        XCBClientPutImage(pPriv, view->window,
+                          x1, y1, x2 - x1, y2 - y1,
+                          x1 - view->x, y1 - view->y);
+        transport = NESTED_PROBE_PUT;
+    }
+
+    /* Tiles found in the cache are only copied on the host */
+    if (transport == NESTED_PROBE_SHM)
+        bytes = (x2 - x1) * (y2 - y1) * pPriv->img->bpp / 8;
+    else
+        bytes = pPriv->stats.putBytes - putBytes;
 
-        if (subimg != img)
-            xcb_image_destroy(img);
+    NESTED_PROBE6(put, x1, y1, x2 - x1, y2 - y1, bytes, transport);
+}
 
-        xcb_image_destroy(subimg);
+/* Uploads a rectangle of the framebuffer to the views it is on */
+static void
+XCBClientUpdateScreen(NestedClientPrivatePtr pPriv,
+                      int16_t x1, int16_t y1,
+                      int16_t x2, int16_t y2,
+                      Bool useCache) {
+    int i;
+
+    for (i = 0; i < pPriv->numViews; i++) {
+        XCBClientViewPtr view = &pPriv->views[i];
+        int16_t vx1 = max(x1, view->x);
+        int16_t vy1 = max(y1, view->y);
+        int16_t vx2 = min(x2, view->x + (int)view->width);
+        int16_t vy2 = min(y2, view->y + (int)view->height);
+
+        if (vx1 < vx2 && vy1 < vy2)
+            XCBClientUpdateView(pPriv, view, vx1, vy1, vx2, vy2, useCache);
     }
+}
 
-    xcb_flush(pPriv->conn);
+/*
+ * ----------------------------------------------------------------------------------------
+ * INTERNAL FUNCTIONS (needed for NestedClientCopyArea)
+ * ----------------------------------------------------------------------------------------
+ */
+
+static void
+XCBClientViewBox(XCBClientViewPtr view, int dx, int dy, BoxPtr pBox) {
+    pBox->x1 = view->x - dx;
+    pBox->y1 = view->y - dy;
+    pBox->x2 = view->x + view->width - dx;
+    pBox->y2 = view->y + view->height - dy;
 }
 
-void
-NestedClientCheckEvents(NestedClientPrivatePtr pPriv) {
-    XCBClientPoll(pPriv);
+/* Copies the region, from its position + (dx, dy) in the source view */
+static void
+XCBClientCopyBetweenViews(NestedClientPrivatePtr pPriv,
+                          XCBClientViewPtr src,
+                          XCBClientViewPtr dst,
+                          RegionPtr pRegion,
+                          int dx, int dy) {
+    int i, nBox = RegionNumRects(pRegion);
+    BoxPtr pBox = RegionRects(pRegion);
+    BoxPtr extents = RegionExtents(pRegion);
+    xcb_rectangle_t *rects;
+
+    rects = malloc(nBox * sizeof(xcb_rectangle_t));
+    if (!rects)
+        return;
+
+    for (i = 0; i < nBox; i++) {
+        rects[i].x = pBox[i].x1 - dst->x;
+        rects[i].y = pBox[i].y1 - dst->y;
+        rects[i].width = pBox[i].x2 - pBox[i].x1;
+        rects[i].height = pBox[i].y2 - pBox[i].y1;
+    }
+
+    /* Clip a single copy to the boxes, so the host takes care of ordering
+     * overlapping source and destination */
+    xcb_set_clip_rectangles(pPriv->conn,
+                            XCB_CLIP_ORDERING_UNSORTED,
+                            pPriv->copyGC,
+                            0, 0,
+                            nBox, rects);
+    xcb_copy_area(pPriv->conn,
+                  src->window, dst->window,
+                  pPriv->copyGC,
+                  extents->x1 + dx - src->x, extents->y1 + dy - src->y,
+                  extents->x1 - dst->x, extents->y1 - dst->y,
+                  extents->x2 - extents->x1,
+                  extents->y2 - extents->y1);
+    free(rects);
 }
 
-void
-NestedClientCloseScreen(NestedClientPrivatePtr pPriv) {
-    if (pPriv->usingShm) {
-        xcb_shm_detach(pPriv->conn, pPriv->shminfo.shmseg);
-        shmdt(pPriv->shminfo.shmaddr);
+/* Whether view a has to be drawn before view b, so that a copy by (dx, dy)
+ * spanning both reads its sources before they are overwritten */
+static Bool
+XCBClientViewBefore(XCBClientViewPtr a, XCBClientViewPtr b, int dx, int dy) {
+    if (a->y != b->y)
+        return dy > 0 ? a->y < b->y : a->y > b->y;
+
+    return dx > 0 ? a->x < b->x : a->x > b->x;
+}
+
+/*
+ * ----------------------------------------------------------------------------------------
+ * INTERNAL FUNCTIONS (needed for NestedClientPutSharedImage)
+ * ----------------------------------------------------------------------------------------
+ */
+
+/* Returns the host attachment of a nested client's segment, attaching it
+ * in place of the least recently used one if needed, or NULL if the host
+ * can't read it */
+static XCBClientSharedSegPtr
+XCBClientSharedSegGet(NestedClientPrivatePtr pPriv, int shmid) {
+    XCBClientSharedSegPtr seg = NULL;
+    xcb_generic_error_t *error;
+    int i;
+
+    for (i = 0; i < SHARED_SEGMENTS; i++) {
+        XCBClientSharedSegPtr s = &pPriv->sharedSegs[i];
+
+        if (s->used && s->shmid == shmid) {
+            seg = s;
+            break;
+        }
+
+        if (!seg || !s->used ||
+            (seg->used && s->lastUse < seg->lastUse))
+            seg = s;
+    }
+
+    if (!seg->used || seg->shmid != shmid) {
+        if (seg->used && !seg->failed)
+            xcb_shm_detach(pPriv->conn, seg->shmseg);
+
+        seg->used = TRUE;
+        seg->shmid = shmid;
+        seg->shmseg = xcb_generate_id(pPriv->conn);
+
+        /* Checked once per segment: the host may lack the permissions */
+        error = xcb_request_check(pPriv->conn,
+                                  xcb_shm_attach_checked(pPriv->conn,
+                                                         seg->shmseg,
+                                                         shmid, TRUE));
+        seg->failed = error != NULL;
+        free(error);
+    }
+
+    seg->lastUse = ++pPriv->sharedUse;
+    return seg->failed ? NULL : seg;
+}
+
+static void
+XCBClientSharedSegFree(NestedClientPrivatePtr pPriv) {
+    int i;
+
+    for (i = 0; i < SHARED_SEGMENTS; i++) {
+        XCBClientSharedSegPtr seg = &pPriv->sharedSegs[i];
+
+        if (seg->used && !seg->failed)
+            xcb_shm_detach(pPriv->conn, seg->shmseg);
+
+        seg->used = FALSE;
+    }
+}
+
+/*
+ * ----------------------------------------------------------------------------------------
+ * INTERNAL FUNCTIONS (needed for Render acceleration)
+ * ----------------------------------------------------------------------------------------
+ */
+
+static void
+XCBClientRenderFlushFreedGlyphs(NestedClientPrivatePtr pPriv) {
+    XCBClientRenderRec *render = &pPriv->render;
+
+    if (render->numFreedGlyphs > 0) {
+        xcb_render_free_glyphs(pPriv->conn, render->glyphset,
+                               render->numFreedGlyphs, render->freedGlyphs);
+        render->numFreedGlyphs = 0;
+    }
+}
+
+static void
+XCBClientRenderFree(NestedClientPrivatePtr pPriv) {
+    XCBClientRenderRec *render = &pPriv->render;
+
+    if (render->enabled) {
+        xcb_render_free_glyph_set(pPriv->conn, render->glyphset);
+        xcb_render_free_picture(pPriv->conn, render->picture);
+    }
+
+    free(render->freedGlyphs);
+    memset(render, 0, sizeof(XCBClientRenderRec));
+    xcb_render_util_disconnect(pPriv->conn);
+}
+
+/*
+ * ----------------------------------------------------------------------------------------
+ * INTERNAL FUNCTIONS (needed for coarse uploads)
+ * ----------------------------------------------------------------------------------------
+ */
+
+/* Averages each COARSE_SCALE x COARSE_SCALE block of a rectangle of the
+ * framebuffer into a pixel of coarse->data, with the last column and row
+ * repeated once more, so the host has something to blend the edges with */
+static void
+XCBClientCoarseDownscale(NestedClientPrivatePtr pPriv,
+                         int x1, int y1, int x2, int y2,
+                         int width, int height) {
+    XCBClientCoarseRec *coarse = &pPriv->coarse;
+    int stride = width + 1;
+    int i, j, x, y, c;
+
+    for (j = 0; j < height; j++) {
+        for (i = 0; i < width; i++) {
+            int bx1 = x1 + i * COARSE_SCALE;
+            int by1 = y1 + j * COARSE_SCALE;
+            int bx2 = min(bx1 + COARSE_SCALE, x2);
+            int by2 = min(by1 + COARSE_SCALE, y2);
+            int n = (bx2 - bx1) * (by2 - by1);
+            uint32_t sum[4] = { 0, 0, 0, 0 };
+            uint32_t pixel = 0;
+
+            for (y = by1; y < by2; y++) {
+                const uint8_t *p = pPriv->img->data + y * pPriv->img->stride +
+                                   bx1 * 4;
+
+                for (x = bx1; x < bx2; x++, p += 4)
+                    for (c = 0; c < 4; c++)
+                        sum[c] += p[c];
+            }
+
+            for (c = 0; c < 4; c++)
+                ((uint8_t *)&pixel)[c] = sum[c] / n;
+
+            coarse->data[j * stride + i] = pixel;
+        }
+
+        coarse->data[j * stride + width] = coarse->data[j * stride + width - 1];
+    }
+
+    memcpy(coarse->data + height * stride,
+           coarse->data + (height - 1) * stride,
+           stride * sizeof(uint32_t));
+}
+
+static void
+XCBClientCoarseFree(NestedClientPrivatePtr pPriv) {
+    XCBClientCoarseRec *coarse = &pPriv->coarse;
+
+    if (coarse->enabled) {
+        xcb_render_free_picture(pPriv->conn, coarse->source);
+        xcb_render_free_picture(pPriv->conn, coarse->picture);
+        xcb_free_pixmap(pPriv->conn, coarse->pixmap);
+    }
+
+    free(coarse->data);
+    memset(coarse, 0, sizeof(XCBClientCoarseRec));
+}
+
+/*
+ * ----------------------------------------------------------------------------------------
+ * INTERNAL FUNCTIONS (needed for NestedClientGetOcclusion)
+ * ----------------------------------------------------------------------------------------
+ */
+
+/* Returns the child of the root window our window lives in, which is the
+ * window manager frame when there is one */
+static xcb_window_t
+XCBClientGetTopLevel(NestedClientPrivatePtr pPriv) {
+    xcb_window_t window = pPriv->window;
+    xcb_query_tree_cookie_t cookie;
+    xcb_query_tree_reply_t *reply;
+    xcb_window_t parent;
+
+    while (TRUE) {
+        cookie = xcb_query_tree(pPriv->conn, window);
+        reply = xcb_query_tree_reply(pPriv->conn, cookie, NULL);
+
+        if (!reply)
+            return XCB_NONE;
+
+        parent = reply->parent;
+        free(reply);
+
+        if (parent == pPriv->rootWindow || parent == XCB_NONE)
+            return window;
+
+        window = parent;
+    }
+}
+
+/* Adds the box of window, if it is viewable and opaque, clipped to ours at
+ * (wx, wy) in root coordinates */
+static void
+XCBClientAddOccluder(NestedClientPrivatePtr pPriv,
+                     xcb_get_window_attributes_reply_t *attrs,
+                     xcb_get_geometry_reply_t *geom,
+                     int wx, int wy) {
+    BoxRec box;
+
+    /* Depth 32 windows are most likely translucent on a composited host */
+    if (!attrs || !geom ||
+        attrs->map_state != XCB_MAP_STATE_VIEWABLE ||
+        attrs->_class != XCB_WINDOW_CLASS_INPUT_OUTPUT ||
+        geom->depth == 32)
+        return;
+
+    box.x1 = max(geom->x - wx, 0);
+    box.y1 = max(geom->y - wy, 0);
+    box.x2 = min(geom->x + geom->width + 2 * geom->border_width - wx,
+                 (int)pPriv->width);
+    box.y2 = min(geom->y + geom->height + 2 * geom->border_width - wy,
+                 (int)pPriv->height);
+
+    if (box.x1 < box.x2 && box.y1 < box.y2)
+        pPriv->occluders[pPriv->numOccluders++] = box;
+}
+
+/* Finds the host windows stacked above ours, and where they cover it */
+static void
+XCBClientUpdateOccluders(NestedClientPrivatePtr pPriv) {
+    xcb_translate_coordinates_cookie_t translateCookie;
+    xcb_translate_coordinates_reply_t *translate;
+    xcb_query_tree_cookie_t treeCookie;
+    xcb_query_tree_reply_t *tree;
+    xcb_get_window_attributes_cookie_t *attrsCookies;
+    xcb_get_geometry_cookie_t *geomCookies;
+    xcb_window_t topLevel, *children;
+    int i, first, numChildren, wx, wy;
+
+    pPriv->numOccluders = 0;
+
+    topLevel = XCBClientGetTopLevel(pPriv);
+    translateCookie = xcb_translate_coordinates(pPriv->conn, pPriv->window,
+                                                pPriv->rootWindow, 0, 0);
+    treeCookie = xcb_query_tree(pPriv->conn, pPriv->rootWindow);
+    translate = xcb_translate_coordinates_reply(pPriv->conn,
+                                                translateCookie, NULL);
+    tree = xcb_query_tree_reply(pPriv->conn, treeCookie, NULL);
+
+    if (!translate || !tree || topLevel == XCB_NONE) {
+        free(translate);
+        free(tree);
+        return;
+    }
+
+    wx = translate->dst_x;
+    wy = translate->dst_y;
+    free(translate);
+
+    /* Children come bottom to top */
+    children = xcb_query_tree_children(tree);
+    numChildren = xcb_query_tree_children_length(tree);
+    for (first = 0; first < numChildren; first++)
+        if (children[first] == topLevel)
+            break;
+    first++;
+
+    if (first >= numChildren) {
+        free(tree);
+        return;
+    }
+
+    free(pPriv->occluders);
+    pPriv->occluders = malloc((numChildren - first) * sizeof(BoxRec));
+    attrsCookies = malloc((numChildren - first) *
+                          sizeof(xcb_get_window_attributes_cookie_t));
+    geomCookies = malloc((numChildren - first) *
+                         sizeof(xcb_get_geometry_cookie_t));
+
+    if (pPriv->occluders && attrsCookies && geomCookies) {
+        for (i = first; i < numChildren; i++) {
+            attrsCookies[i - first] =
+                xcb_get_window_attributes(pPriv->conn, children[i]);
+            geomCookies[i - first] = xcb_get_geometry(pPriv->conn, children[i]);
+        }
+
+        for (i = 0; i < numChildren - first; i++) {
+            xcb_get_window_attributes_reply_t *attrs =
+                xcb_get_window_attributes_reply(pPriv->conn, attrsCookies[i],
+                                                NULL);
+            xcb_get_geometry_reply_t *geom =
+                xcb_get_geometry_reply(pPriv->conn, geomCookies[i], NULL);
+
+            XCBClientAddOccluder(pPriv, attrs, geom, wx, wy);
+            free(attrs);
+            free(geom);
+        }
+    }
+
+    free(attrsCookies);
+    free(geomCookies);
+    free(tree);
+}
+
+/*
+ * ----------------------------------------------------------------------------------------
+ * INTERNAL FUNCTIONS (needed for XVideo)
+ * ----------------------------------------------------------------------------------------
+ */
+
+/* Fills formats with those of ours the port supports, returning how many */
+static int
+XCBClientVideoGetFormats(NestedClientPrivatePtr pPriv,
+                         xcb_xv_port_t port,
+                         uint32_t *formats) {
+    static const uint32_t wanted[] = { FOURCC_YV12, FOURCC_I420, FOURCC_YUY2 };
+    xcb_xv_list_image_formats_cookie_t cookie;
+    xcb_xv_list_image_formats_reply_t *reply;
+    xcb_xv_image_format_info_iterator_t it;
+    int i, n = 0;
+
+    cookie = xcb_xv_list_image_formats(pPriv->conn, port);
+    reply = xcb_xv_list_image_formats_reply(pPriv->conn, cookie, NULL);
+
+    if (!reply)
+        return 0;
+
+    for (it = xcb_xv_list_image_formats_format_iterator(reply);
+         it.rem;
+         xcb_xv_image_format_info_next(&it))
+        for (i = 0; i < ARRAY_SIZE(wanted); i++)
+            if (it.data->id == wanted[i])
+                formats[n++] = wanted[i];
+
+    free(reply);
+    return n;
+}
+
+static Bool
+XCBClientVideoGrabPort(NestedClientPrivatePtr pPriv, xcb_xv_port_t port) {
+    xcb_xv_grab_port_cookie_t cookie;
+    xcb_xv_grab_port_reply_t *reply;
+    Bool ret;
+
+    cookie = xcb_xv_grab_port(pPriv->conn, port, XCB_CURRENT_TIME);
+    reply = xcb_xv_grab_port_reply(pPriv->conn, cookie, NULL);
+
+    if (!reply)
+        return FALSE;
+
+    ret = reply->result == XCB_GRAB_STATUS_SUCCESS;
+    free(reply);
+    return ret;
+}
+
+/* Overlay ports only show the video where the host window has their color
+ * key, and we never put it there ourselves */
+static void
+XCBClientVideoSetAutopaint(NestedClientPrivatePtr pPriv) {
+    const char *name = "XV_AUTOPAINT_COLORKEY";
+    xcb_intern_atom_cookie_t atomCookie;
+    xcb_intern_atom_reply_t *atomReply;
+    xcb_xv_query_port_attributes_cookie_t cookie;
+    xcb_xv_query_port_attributes_reply_t *reply;
+    xcb_xv_attribute_info_iterator_t it;
+    xcb_atom_t atom;
+
+    atomCookie = xcb_intern_atom(pPriv->conn, TRUE, strlen(name), name);
+    cookie = xcb_xv_query_port_attributes(pPriv->conn, pPriv->video.port);
+
+    atomReply = xcb_intern_atom_reply(pPriv->conn, atomCookie, NULL);
+    reply = xcb_xv_query_port_attributes_reply(pPriv->conn, cookie, NULL);
+
+    atom = atomReply ? atomReply->atom : XCB_NONE;
+    free(atomReply);
+
+    if (!reply)
+        return;
+
+    for (it = xcb_xv_query_port_attributes_attributes_iterator(reply);
+         atom != XCB_NONE && it.rem;
+         xcb_xv_attribute_info_next(&it)) {
+        if (xcb_xv_attribute_info_name_length(it.data) - 1 == strlen(name) &&
+            !strncmp(xcb_xv_attribute_info_name(it.data), name, strlen(name)) &&
+            (it.data->flags & XCB_XV_ATTRIBUTE_FLAG_SETTABLE)) {
+            xcb_xv_set_port_attribute(pPriv->conn, pPriv->video.port, atom, 1);
+            break;
+        }
+    }
+
+    free(reply);
+}
+
+static void
+XCBClientVideoFreeFrame(NestedClientPrivatePtr pPriv) {
+    XCBClientVideoRec *video = &pPriv->video;
+
+    if (video->usingShm) {
+        xcb_shm_detach(pPriv->conn, video->shminfo.shmseg);
+        shmdt(video->shminfo.shmaddr);
+        shmctl(video->shminfo.shmid, IPC_RMID, 0);
+    } else
+        free(video->data);
+
+    video->data = NULL;
+    video->usingShm = FALSE;
+    video->size = 0;
+    video->id = 0;
+}
+
+/* Makes room for a frame of the given format, as the host lays it out */
+static Bool
+XCBClientVideoAllocFrame(NestedClientPrivatePtr pPriv,
+                         int id, int width, int height) {
+    XCBClientVideoRec *video = &pPriv->video;
+    xcb_xv_query_image_attributes_cookie_t cookie;
+    xcb_xv_query_image_attributes_reply_t *reply;
+    uint32_t *pitches, *offsets;
+    int i;
+
+    if (video->id == id && video->width == width && video->height == height)
+        return TRUE;
+
+    XCBClientVideoFreeFrame(pPriv);
+
+    cookie = xcb_xv_query_image_attributes(pPriv->conn, video->port,
+                                           id, width, height);
+    reply = xcb_xv_query_image_attributes_reply(pPriv->conn, cookie, NULL);
+
+    if (!reply)
+        return FALSE;
+
+    pitches = xcb_xv_query_image_attributes_pitches(reply);
+    offsets = xcb_xv_query_image_attributes_offsets(reply);
+    video->numPlanes = reply->num_planes < 3 ? reply->num_planes : 3;
+    for (i = 0; i < video->numPlanes; i++) {
+        video->pitches[i] = pitches[i];
+        video->offsets[i] = offsets[i];
+    }
+    video->size = reply->data_size;
+    free(reply);
+
+    if (pPriv->usingShm) {
+        video->shminfo.shmid = shmget(IPC_PRIVATE, video->size,
+                                      IPC_CREAT | 0777);
+        video->shminfo.shmaddr = shmat(video->shminfo.shmid, 0, 0);
+
+        if (video->shminfo.shmaddr != (uint8_t *)-1) {
+            video->shminfo.shmseg = xcb_generate_id(pPriv->conn);
+            xcb_shm_attach(pPriv->conn, video->shminfo.shmseg,
+                           video->shminfo.shmid, TRUE);
+            video->data = video->shminfo.shmaddr;
+            video->usingShm = TRUE;
+        } else
+            shmctl(video->shminfo.shmid, IPC_RMID, 0);
+    }
+
+    if (!video->data)
+        video->data = malloc(video->size);
+
+    if (!video->data) {
+        video->size = 0;
+        return FALSE;
+    }
+
+    video->id = id;
+    video->width = width;
+    video->height = height;
+    return TRUE;
+}
+
+static void
+XCBClientVideoFree(NestedClientPrivatePtr pPriv) {
+    XCBClientVideoRec *video = &pPriv->video;
+
+    if (video->enabled) {
+        xcb_xv_ungrab_port(pPriv->conn, video->port, XCB_CURRENT_TIME);
+        xcb_free_gc(pPriv->conn, video->gc);
+    }
+
+    XCBClientVideoFreeFrame(pPriv);
+    memset(video, 0, sizeof(XCBClientVideoRec));
+}
+
+/*
+ * ----------------------------------------------------------------------------------------
+ * PUBLIC API IMPLEMENTATION
+ * ----------------------------------------------------------------------------------------
+ */
+
+Bool
+NestedClientCheckDisplay(int scrnIndex, OutputPtr output) {
+    int n;
+    xcb_connection_t *conn = XCBClientConnectOrRetry(scrnIndex, NULL, &n);
+
+    if (XCBClientConnectionHasError(scrnIndex, conn))
+        return FALSE;
+    else if (output->name != NULL) {
+        output->width = 0;
+        output->height = 0;
+        output->x = 0;
+        output->y = 0;
+
+        if (!XCBClientGetOutputGeometry(scrnIndex, conn, n, output))
+            return FALSE;
+        else
+            xf86DrvMsg(scrnIndex,
+                       X_INFO,
+                       "Got CRTC geometry from output %s: %dx%d+%d+%d\n",
+                       output->name,
+                       output->width,
+                       output->height,
+                       output->x,
+                       output->y);
+    } else {
+        xcb_screen_t *s = xcb_aux_get_screen(conn, n);
+        output->width = s->width_in_pixels;
+        output->height = s->height_in_pixels;
+    }
+
+    xcb_disconnect(conn);
+    return TRUE;
+}
+
+Bool
+NestedClientValidDepth(int depth) {
+    /* XXX: implement! */
+    return TRUE;
+}
+
+NestedClientPrivatePtr
+NestedClientCreateScreen(int scrnIndex,
+                         Bool wantFullscreenHint,
+                         Bool rootless,
+                         Bool lowLatency,
+                         int width,
+                         int height,
+                         int numOutputs,
+                         const Output *outputs,
+                         int depth,
+                         int bitsPerPixel,
+                         Pixel *retRedMask,
+                         Pixel *retGreenMask,
+                         Pixel *retBlueMask) {
+    NestedClientPrivatePtr pPriv = malloc(sizeof(struct NestedClientPrivate));
+
+    if (!pPriv)
+        return NULL;
+    else {
+        pPriv->scrnIndex = scrnIndex;
+        pPriv->displayName = NULL;
+        pPriv->isMirror = FALSE;
+        pPriv->lost = FALSE;
+        pPriv->paced = lowLatency;
+        pPriv->fencePending = FALSE;
+        pPriv->usingFullscreen = wantFullscreenHint;
+        pPriv->lowLatency = lowLatency;
+        pPriv->latencyFrames = 0;
+        pPriv->latencyTotal = 0;
+        pPriv->latencyMax = 0;
+        memset(&pPriv->stats, 0, sizeof(NestedClientStats));
+        pPriv->width = width;
+        pPriv->height = height;
+        pPriv->views = NULL;
+        pPriv->numViews = 0;
+        pPriv->rootless = rootless;
+        pPriv->emptyCursor = XCB_NONE;
+	pPriv->img = NULL;
+        memset(&pPriv->tileCache, 0, sizeof(XCBClientTileCacheRec));
+        memset(&pPriv->render, 0, sizeof(XCBClientRenderRec));
+        memset(&pPriv->video, 0, sizeof(XCBClientVideoRec));
+        memset(&pPriv->coarse, 0, sizeof(XCBClientCoarseRec));
+        pPriv->textGC = XCB_NONE;
+        memset(pPriv->sharedSegs, 0, sizeof(pPriv->sharedSegs));
+        pPriv->sharedUse = 0;
+
+        if (!XCBClientConnectToServer(pPriv)) {
+            xcb_disconnect(pPriv->conn);
+            free(pPriv);
+            return NULL;
+        } else {
+            XCBClientTryXShm(pPriv);
+            XCBClientCreateXImage(pPriv, depth);
+
+            if (!XCBClientCreateViews(pPriv, numOutputs, outputs)) {
+                xcb_disconnect(pPriv->conn);
+                free(pPriv);
+                return NULL;
+            }
+
+            XCBClientWindowHideCursor(pPriv);
+            xcb_flush(pPriv->conn);
+
+#if 0
+            xf86DrvMsg(pPriv->scrnIndex, X_INFO, "width: %d\n", pPriv->img->width);
+            xf86DrvMsg(pPriv->scrnIndex, X_INFO, "height: %d\n", pPriv->img->height);
+            xf86DrvMsg(pPriv->scrnIndex, X_INFO, "depth: %d\n", pPriv->img->depth);
+            xf86DrvMsg(pPriv->scrnIndex, X_INFO, "bpp: %d\n", pPriv->img->bpp);
+            xf86DrvMsg(pPriv->scrnIndex, X_INFO, "red_mask: 0x%x\n", pPriv->visual->red_mask);
+            xf86DrvMsg(pPriv->scrnIndex, X_INFO, "gre_mask: 0x%x\n", pPriv->visual->green_mask);
+            xf86DrvMsg(pPriv->scrnIndex, X_INFO, "blu_mask: 0x%x\n", pPriv->visual->blue_mask);
+#endif
+
+            *retRedMask = pPriv->visual->red_mask;
+            *retGreenMask = pPriv->visual->green_mask;
+            *retBlueMask = pPriv->visual->blue_mask;
+
+            return pPriv;
+        }
+    }
+}
+
+NestedClientPrivatePtr
+NestedClientCreateMirror(NestedClientPrivatePtr primary,
+                         const char *displayName,
+                         Bool wantFullscreenHint) {
+    NestedClientPrivatePtr pPriv = calloc(1, sizeof(struct NestedClientPrivate));
+    Output output = { NULL, 0, 0, primary->width, primary->height };
+    xcb_screen_t *screen;
+
+    if (!pPriv)
+        return NULL;
+
+    pPriv->scrnIndex = primary->scrnIndex;
+    pPriv->displayName = displayName;
+    pPriv->isMirror = TRUE;
+    pPriv->paced = TRUE;
+    pPriv->usingFullscreen = wantFullscreenHint;
+    pPriv->width = primary->width;
+    pPriv->height = primary->height;
+
+    if (!XCBClientConnectToServer(pPriv)) {
+        xcb_disconnect(pPriv->conn);
+        free(pPriv);
+        return NULL;
+    }
+
+    /* The pixels are sent as they are in the primary's framebuffer */
+    screen = xcb_aux_get_screen(pPriv->conn, pPriv->screenNumber);
+    if (screen->root_depth == primary->img->depth &&
+        pPriv->visual->red_mask == primary->visual->red_mask &&
+        pPriv->visual->green_mask == primary->visual->green_mask &&
+        pPriv->visual->blue_mask == primary->visual->blue_mask)
+        pPriv->img = xcb_image_create_native(pPriv->conn,
+                                             primary->width,
+                                             primary->height,
+                                             XCB_IMAGE_FORMAT_Z_PIXMAP,
+                                             primary->img->depth,
+                                             NULL,
+                                             ~0,
+                                             primary->img->data);
+
+    if (!pPriv->img || pPriv->img->stride != primary->img->stride) {
+        xf86DrvMsg(pPriv->scrnIndex,
+                   X_ERROR,
+                   "Host display %s doesn't have the pixel format of the nested screen.\n",
+                   displayName);
+        if (pPriv->img)
+            xcb_image_destroy(pPriv->img);
+        xcb_disconnect(pPriv->conn);
+        free(pPriv);
+        return NULL;
+    }
+
+    /* A local host can read the primary's segment too */
+    if (primary->usingShm &&
+        (displayName[0] == ':' || !strncmp(displayName, "unix:", 5)))
+        XCBClientTryXShm(pPriv);
+
+    if (pPriv->usingShm) {
+        pPriv->shminfo = primary->shminfo;
+        pPriv->shminfo.shmseg = xcb_generate_id(pPriv->conn);
+        xcb_shm_attach(pPriv->conn,
+                       pPriv->shminfo.shmseg,
+                       pPriv->shminfo.shmid,
+                       FALSE);
+    }
+
+    if (!XCBClientCreateViews(pPriv, 1, &output)) {
+        xcb_image_destroy(pPriv->img);
+        xcb_disconnect(pPriv->conn);
+        free(pPriv);
+        return NULL;
+    }
+
+    XCBClientWindowHideCursor(pPriv);
+    xcb_flush(pPriv->conn);
+
+    xf86DrvMsg(pPriv->scrnIndex,
+               X_INFO,
+               "Mirroring the screen to %s%s.\n",
+               displayName, pPriv->usingShm ? " through XShm" : "");
+    return pPriv;
+}
+
+uint32_t
+NestedClientAddWindow(NestedClientPrivatePtr pPriv,
+                      int x, int y,
+                      int width, int height) {
+    XCBClientViewPtr views, view;
+
+    if (!pPriv->rootless)
+        return 0;
+
+    views = realloc(pPriv->views,
+                    (pPriv->numViews + 1) * sizeof(XCBClientViewRec));
+    if (!views)
+        return 0;
+
+    pPriv->views = views;
+    view = &views[pPriv->numViews++];
+    memset(view, 0, sizeof(XCBClientViewRec));
+    view->x = x;
+    view->y = y;
+    view->hostX = pPriv->originX + x;
+    view->hostY = pPriv->originY + y;
+    view->width = width;
+    view->height = height;
+
+    XCBClientWindowCreate(pPriv, view, NULL);
+
+    if (pPriv->emptyCursor != XCB_NONE)
+        xcb_change_window_attributes(pPriv->conn, view->window,
+                                     XCB_CW_CURSOR, &pPriv->emptyCursor);
+
+    return view->window;
+}
+
+void
+NestedClientConfigureWindow(NestedClientPrivatePtr pPriv,
+                            uint32_t id,
+                            int x, int y,
+                            int width, int height) {
+    XCBClientViewPtr view = XCBClientFindView(pPriv, id);
+    uint32_t mask = XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y |
+                    XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT;
+    uint32_t values[4];
+
+    if (!view)
+        return;
+
+    view->x = x;
+    view->y = y;
+    view->hostX = pPriv->originX + x;
+    view->hostY = pPriv->originY + y;
+    view->width = width;
+    view->height = height;
+
+    values[0] = view->hostX;
+    values[1] = view->hostY;
+    values[2] = view->width;
+    values[3] = view->height;
+    xcb_configure_window(pPriv->conn, view->window, mask, values);
+}
+
+void
+NestedClientRestackWindow(NestedClientPrivatePtr pPriv,
+                          uint32_t id,
+                          uint32_t above) {
+    uint32_t values[2] = { above, XCB_STACK_MODE_BELOW };
+
+    if (!XCBClientFindView(pPriv, id))
+        return;
+
+    if (above)
+        xcb_configure_window(pPriv->conn, id,
+                             XCB_CONFIG_WINDOW_SIBLING |
+                             XCB_CONFIG_WINDOW_STACK_MODE,
+                             values);
+    else {
+        values[0] = XCB_STACK_MODE_ABOVE;
+        xcb_configure_window(pPriv->conn, id,
+                             XCB_CONFIG_WINDOW_STACK_MODE,
+                             values);
+    }
+}
+
+void
+NestedClientRemoveWindow(NestedClientPrivatePtr pPriv, uint32_t id) {
+    XCBClientViewPtr view = XCBClientFindView(pPriv, id);
+
+    if (!view)
+        return;
+
+    xcb_destroy_window(pPriv->conn, view->window);
+    memmove(view, view + 1,
+            (pPriv->views + pPriv->numViews - (view + 1)) *
+            sizeof(XCBClientViewRec));
+    pPriv->numViews--;
+}
+
+unsigned int
+NestedClientFence(NestedClientPrivatePtr pPriv) {
+    unsigned int fence = xcb_get_input_focus(pPriv->conn).sequence;
+
+    xcb_flush(pPriv->conn);
+    return fence;
+}
+
+Bool
+NestedClientFenceDone(NestedClientPrivatePtr pPriv, unsigned int fence) {
+    void *reply;
+    xcb_generic_error_t *error;
+
+    if (pPriv->lost)
+        return TRUE;
+
+    if (!xcb_poll_for_reply(pPriv->conn, fence, &reply, &error))
+        return FALSE;
+
+    free(reply);
+    free(error);
+    return TRUE;
+}
+
+void
+NestedClientSetPaced(NestedClientPrivatePtr pPriv) {
+    pPriv->paced = TRUE;
+}
+
+Bool
+NestedClientIsReady(NestedClientPrivatePtr pPriv) {
+    void *reply;
+    xcb_generic_error_t *error;
+    CARD64 latency;
+
+    if (pPriv->lost)
+        return FALSE;
+
+    if (!pPriv->fencePending)
+        return TRUE;
+
+    if (!xcb_poll_for_reply(pPriv->conn, pPriv->fence, &reply, &error))
+        return FALSE;
+
+    free(reply);
+    free(error);
+    pPriv->fencePending = FALSE;
+
+    latency = GetTimeInMicros() - pPriv->fenceTime;
+    pPriv->latencyFrames++;
+    pPriv->latencyTotal += latency;
+    pPriv->latencyMax = max(pPriv->latencyMax, latency);
+    pPriv->stats.latency[NestedStatsBucket(latency)]++;
+    return TRUE;
+}
+
+void
+NestedClientHideCursor(NestedClientPrivatePtr pPriv) {
+    XCBClientWindowHideCursor(pPriv);
+}
+
+Bool
+NestedClientIsVisible(NestedClientPrivatePtr pPriv) {
+    int i;
+
+    for (i = 0; i < pPriv->numViews; i++)
+        if (pPriv->views[i].mapped &&
+            !pPriv->views[i].obscured &&
+            !pPriv->views[i].hidden)
+            return TRUE;
+
+    return FALSE;
+}
+
+Bool
+NestedClientGetOcclusion(NestedClientPrivatePtr pPriv,
+                         int *nBox,
+                         BoxPtr *ppBox) {
+    if (!pPriv->occlusionChanged)
+        return FALSE;
+
+    pPriv->occlusionChanged = FALSE;
+
+    /* XXX: only tracked for a single window */
+    if (pPriv->rootless || pPriv->numViews > 1)
+        return FALSE;
+
+    XCBClientUpdateOccluders(pPriv);
+
+    *nBox = pPriv->numOccluders;
+    *ppBox = pPriv->occluders;
+    return TRUE;
+}
+
+char *
+NestedClientGetFrameBuffer(NestedClientPrivatePtr pPriv) {
+    return (char *)pPriv->img->data;
+}
+
+void
+NestedClientUpdateScreen(NestedClientPrivatePtr pPriv,
+                         int16_t x1, int16_t y1,
+                         int16_t x2, int16_t y2) {
+    XCBClientUpdateScreen(pPriv, x1, y1, x2, y2, TRUE);
+}
+
+void
+NestedClientUpdateScreenUncached(NestedClientPrivatePtr pPriv,
+                                 int16_t x1, int16_t y1,
+                                 int16_t x2, int16_t y2) {
+    XCBClientUpdateScreen(pPriv, x1, y1, x2, y2, FALSE);
+}
+
+void
+NestedClientSetTileCacheSize(NestedClientPrivatePtr pPriv, int numTiles) {
+    XCBClientTileCacheRec *cache = &pPriv->tileCache;
+    unsigned int numBuckets = 1;
+
+    XCBClientTileCacheFree(pPriv);
+
+    if (numTiles <= 0)
+        return;
+
+    if (pPriv->usingShm) {
+        xf86DrvMsg(pPriv->scrnIndex,
+                   X_INFO,
+                   "Tile cache not needed, using XShm.\n");
+        return;
+    }
+
+    if (numTiles > TILE_CACHE_MAX_SIZE)
+        numTiles = TILE_CACHE_MAX_SIZE;
+
+    while (numBuckets < numTiles)
+        numBuckets <<= 1;
+
+    cache->tileStride = TILE_SIZE * pPriv->img->bpp / 8;
+    cache->tiles = calloc(numTiles, sizeof(XCBClientTileRec));
+    cache->buckets = calloc(numBuckets, sizeof(XCBClientTilePtr));
+    cache->data = malloc((size_t)numTiles * TILE_SIZE * cache->tileStride);
+
+    if (!cache->tiles || !cache->buckets || !cache->data) {
+        xf86DrvMsg(pPriv->scrnIndex,
+                   X_WARNING,
+                   "Failed to allocate a tile cache of %d tiles.\n",
+                   numTiles);
+        XCBClientTileCacheFree(pPriv);
+        return;
+    }
+
+    cache->pixmap = xcb_generate_id(pPriv->conn);
+    xcb_create_pixmap(pPriv->conn,
+                      pPriv->img->depth,
+                      cache->pixmap,
+                      pPriv->rootWindow,
+                      TILE_CACHE_COLUMNS * TILE_SIZE,
+                      (numTiles + TILE_CACHE_COLUMNS - 1) / TILE_CACHE_COLUMNS * TILE_SIZE);
+
+    cache->size = numTiles;
+    cache->bucketMask = numBuckets - 1;
+
+    xf86DrvMsg(pPriv->scrnIndex,
+               X_INFO,
+               "Using a tile cache of %d %dx%d tiles.\n",
+               numTiles, TILE_SIZE, TILE_SIZE);
+}
+
+void
+NestedClientGetTileCacheStats(NestedClientPrivatePtr pPriv,
+                              unsigned long *hits,
+                              unsigned long *misses) {
+    *hits = pPriv->tileCache.hits;
+    *misses = pPriv->tileCache.misses;
+}
+
+void
+NestedClientGetLatencyStats(NestedClientPrivatePtr pPriv,
+                            unsigned long *frames,
+                            unsigned long *average,
+                            unsigned long *maximum) {
+    *frames = pPriv->latencyFrames;
+    *average = pPriv->latencyFrames ?
+               pPriv->latencyTotal / pPriv->latencyFrames : 0;
+    *maximum = pPriv->latencyMax;
+}
+
+void
+NestedClientGetStats(NestedClientPrivatePtr pPriv,
+                     NestedClientStatsPtr pStats) {
+    *pStats = pPriv->stats;
+}
+
+void
+NestedClientCopyArea(NestedClientPrivatePtr pPriv,
+                     int nBox, BoxPtr pBox,
+                     int dx, int dy) {
+    XCBClientViewPtr *order;
+    RegionRec boxes, dst, part;
+    BoxRec box;
+    int i, j;
+
+    if (nBox <= 0)
+        return;
+
+    order = malloc(pPriv->numViews * sizeof(XCBClientViewPtr));
+    if (!order)
+        return;
+
+    for (i = 0; i < pPriv->numViews; i++) {
+        for (j = i; j > 0 &&
+             XCBClientViewBefore(&pPriv->views[i], order[j - 1], dx, dy); j--)
+            order[j] = order[j - 1];
+        order[j] = &pPriv->views[i];
+    }
+
+    RegionInitBoxes(&boxes, pBox, nBox);
+
+    /* Each part of a view is copied from the view its source is on */
+    for (i = 0; i < pPriv->numViews; i++) {
+        XCBClientViewBox(order[i], 0, 0, &box);
+        RegionInit(&dst, &box, 1);
+        RegionIntersect(&dst, &dst, &boxes);
+
+        for (j = 0; j < pPriv->numViews && RegionNotEmpty(&dst); j++) {
+            XCBClientViewBox(order[j], dx, dy, &box);
+            RegionInit(&part, &box, 1);
+            RegionIntersect(&part, &part, &dst);
+
+            if (RegionNotEmpty(&part)) {
+                XCBClientCopyBetweenViews(pPriv, order[j], order[i],
+                                          &part, dx, dy);
+                RegionSubtract(&dst, &dst, &part);
+            }
+
+            RegionUninit(&part);
+        }
+
+        /* The source isn't shown on any output */
+        for (j = 0; j < RegionNumRects(&dst); j++)
+            XCBClientUpdateView(pPriv, order[i],
+                                RegionRects(&dst)[j].x1,
+                                RegionRects(&dst)[j].y1,
+                                RegionRects(&dst)[j].x2,
+                                RegionRects(&dst)[j].y2,
+                                TRUE);
+
+        RegionUninit(&dst);
+    }
+
+    RegionUninit(&boxes);
+    free(order);
+}
+
+void
+NestedClientFillRects(NestedClientPrivatePtr pPriv,
+                      int nBox, BoxPtr pBox,
+                      Pixel pixel) {
+    xcb_rectangle_t *rects;
+    uint32_t value = pixel;
+    int i, j, n;
+
+    if (nBox <= 0)
+        return;
+
+    rects = malloc(nBox * sizeof(xcb_rectangle_t));
+    if (!rects)
+        return;
+
+    xcb_change_gc(pPriv->conn, pPriv->fillGC, XCB_GC_FOREGROUND, &value);
+
+    for (i = 0; i < pPriv->numViews; i++) {
+        XCBClientViewPtr view = &pPriv->views[i];
+
+        for (j = 0, n = 0; j < nBox; j++) {
+            int x1 = max(pBox[j].x1, view->x);
+            int y1 = max(pBox[j].y1, view->y);
+            int x2 = min(pBox[j].x2, view->x + (int)view->width);
+            int y2 = min(pBox[j].y2, view->y + (int)view->height);
+
+            if (x1 >= x2 || y1 >= y2)
+                continue;
+
+            rects[n].x = x1 - view->x;
+            rects[n].y = y1 - view->y;
+            rects[n].width = x2 - x1;
+            rects[n].height = y2 - y1;
+            n++;
+        }
+
+        if (n > 0)
+            xcb_poly_fill_rectangle(pPriv->conn, view->window, pPriv->fillGC,
+                                    n, rects);
+    }
+
+    free(rects);
+}
+
+void
+NestedClientOutlineBoxes(NestedClientPrivatePtr pPriv,
+                         int nBox, BoxPtr pBox) {
+    xcb_rectangle_t *rects;
+    int i, j;
+
+    if (nBox <= 0)
+        return;
+
+    rects = malloc(nBox * sizeof(xcb_rectangle_t));
+    if (!rects)
+        return;
+
+    /* In the red of the upload GC; windows clip what isn't theirs */
+    for (i = 0; i < pPriv->numViews; i++) {
+        XCBClientViewPtr view = &pPriv->views[i];
+
+        for (j = 0; j < nBox; j++) {
+            rects[j].x = pBox[j].x1 - view->x;
+            rects[j].y = pBox[j].y1 - view->y;
+            rects[j].width = pBox[j].x2 - pBox[j].x1 - 1;
+            rects[j].height = pBox[j].y2 - pBox[j].y1 - 1;
+        }
+
+        xcb_poly_rectangle(pPriv->conn, view->window, pPriv->gc,
+                           nBox, rects);
+    }
+
+    free(rects);
+}
+
+/* Opens the font debugging text is drawn with, white on black */
+static Bool
+XCBClientTextInit(NestedClientPrivatePtr pPriv) {
+    static const char name[] = "fixed";
+    xcb_screen_t *screen = xcb_aux_get_screen(pPriv->conn,
+                                              pPriv->screenNumber);
+    xcb_query_font_reply_t *reply;
+    xcb_font_t font;
+    uint32_t values[3];
+
+    font = xcb_generate_id(pPriv->conn);
+    xcb_open_font(pPriv->conn, font, strlen(name), name);
+
+    reply = xcb_query_font_reply(pPriv->conn,
+                                 xcb_query_font(pPriv->conn, font), NULL);
+    if (!reply) {
+        xcb_close_font(pPriv->conn, font);
+        return FALSE;
+    }
+
+    pPriv->textAscent = reply->font_ascent;
+    pPriv->textHeight = reply->font_ascent + reply->font_descent;
+    pPriv->textWidth = reply->max_bounds.character_width;
+    free(reply);
+
+    values[0] = screen->white_pixel;
+    values[1] = screen->black_pixel;
+    values[2] = font;
+    pPriv->textGC = xcb_generate_id(pPriv->conn);
+    xcb_create_gc(pPriv->conn, pPriv->textGC, pPriv->rootWindow,
+                  XCB_GC_FOREGROUND | XCB_GC_BACKGROUND | XCB_GC_FONT,
+                  values);
+    xcb_close_font(pPriv->conn, font);
+    return TRUE;
+}
+
+Bool
+NestedClientDrawText(NestedClientPrivatePtr pPriv, const char *text,
+                     BoxPtr pBox) {
+    XCBClientViewPtr view;
+    int length = min((int)strlen(text), 255);
+
+    if (pPriv->numViews == 0 || pPriv->rootless)
+        return FALSE;
+
+    if (pPriv->textGC == XCB_NONE && !XCBClientTextInit(pPriv))
+        return FALSE;
+
+    view = &pPriv->views[0];
+    xcb_image_text_8(pPriv->conn, length, view->window, pPriv->textGC,
+                     TEXT_MARGIN, TEXT_MARGIN + pPriv->textAscent, text);
+
+    pBox->x1 = view->x + TEXT_MARGIN;
+    pBox->y1 = view->y + TEXT_MARGIN;
+    pBox->x2 = pBox->x1 + length * pPriv->textWidth;
+    pBox->y2 = pBox->y1 + pPriv->textHeight;
+    return TRUE;
+}
+
+Bool
+NestedClientPutSharedImage(NestedClientPrivatePtr pPriv,
+                           int shmid,
+                           uint32_t offset,
+                           int stride,
+                           int16_t x,
+                           int16_t y,
+                           uint16_t width,
+                           uint16_t height) {
+    int pad = pPriv->img->scanline_pad;
+    XCBClientSharedSegPtr seg;
+    int i;
+
+    /* Only a host on this machine can see the segment, and it has to lay
+     * the rows out the same way */
+    if (!pPriv->usingShm || pPriv->isMirror ||
+        stride != (width * pPriv->img->bpp + pad - 1) / pad * pad / 8)
+        return FALSE;
+
+    seg = XCBClientSharedSegGet(pPriv, shmid);
+    if (!seg)
+        return FALSE;
+
+    for (i = 0; i < pPriv->numViews; i++) {
+        XCBClientViewPtr view = &pPriv->views[i];
+        int16_t vx1 = max(x, view->x);
+        int16_t vy1 = max(y, view->y);
+        int16_t vx2 = min(x + width, view->x + (int)view->width);
+        int16_t vy2 = min(y + height, view->y + (int)view->height);
+
+        if (vx1 >= vx2 || vy1 >= vy2)
+            continue;
+
+        xcb_shm_put_image(pPriv->conn, view->window, pPriv->gc,
+                          width, height,
+                          vx1 - x, vy1 - y, vx2 - vx1, vy2 - vy1,
+                          vx1 - view->x, vy1 - view->y,
+                          pPriv->img->depth, XCB_IMAGE_FORMAT_Z_PIXMAP,
+                          FALSE, seg->shmseg, offset);
+        pPriv->stats.shmRects++;
+        pPriv->stats.shmBytes += (vx2 - vx1) * (vy2 - vy1) *
+                                 pPriv->img->bpp / 8;
+    }
+
+    xcb_flush(pPriv->conn);
+    return TRUE;
+}
+
+void
+NestedClientSync(NestedClientPrivatePtr pPriv) {
+    free(xcb_get_input_focus_reply(pPriv->conn,
+                                   xcb_get_input_focus(pPriv->conn),
+                                   NULL));
+}
+
+Bool
+NestedClientRenderInit(NestedClientPrivatePtr pPriv) {
+    XCBClientRenderRec *render = &pPriv->render;
+    xcb_render_query_version_cookie_t cookie;
+    xcb_render_query_version_reply_t *reply;
+    const xcb_render_query_pict_formats_reply_t *formats;
+    xcb_render_pictvisual_t *visualFormat;
+    xcb_render_pictforminfo_t *a8;
+
+    if (render->enabled)
+        return TRUE;
+
+    /* XXX: glyphs are only drawn to a single window */
+    if (pPriv->rootless || pPriv->numViews > 1 ||
+        !XCBClientCheckExtension(pPriv->conn, &xcb_render_id))
+        return FALSE;
+
+    /* Solid fill pictures need Render 0.10 */
+    cookie = xcb_render_query_version(pPriv->conn, 0, 10);
+    reply = xcb_render_query_version_reply(pPriv->conn, cookie, NULL);
+
+    if (!reply)
+        return FALSE;
+    else if (reply->major_version == 0 && reply->minor_version < 10) {
+        free(reply);
+        return FALSE;
+    }
+
+    free(reply);
+
+    formats = xcb_render_util_query_formats(pPriv->conn);
+    if (!formats)
+        return FALSE;
+
+    visualFormat = xcb_render_util_find_visual_format(formats,
+                                                      pPriv->visual->visual_id);
+    a8 = xcb_render_util_find_standard_format(formats, XCB_PICT_STANDARD_A_8);
+
+    if (!visualFormat || !a8)
+        return FALSE;
+
+    render->a8 = a8->id;
+
+    render->picture = xcb_generate_id(pPriv->conn);
+    xcb_render_create_picture(pPriv->conn, render->picture, pPriv->window,
+                              visualFormat->format, 0, NULL);
+
+    render->glyphset = xcb_generate_id(pPriv->conn);
+    xcb_render_create_glyph_set(pPriv->conn, render->glyphset, render->a8);
+
+    render->enabled = TRUE;
+    return TRUE;
+}
+
+Bool
+NestedClientCoarseInit(NestedClientPrivatePtr pPriv) {
+    XCBClientCoarseRec *coarse = &pPriv->coarse;
+    xcb_render_query_version_cookie_t cookie;
+    xcb_render_query_version_reply_t *reply;
+    const xcb_render_query_pict_formats_reply_t *formats;
+    xcb_render_pictvisual_t *visualFormat;
+    xcb_render_transform_t transform = {
+        0x10000 / COARSE_SCALE, 0, 0,
+        0, 0x10000 / COARSE_SCALE, 0,
+        0, 0, 0x10000
+    };
+    uint32_t repeat = XCB_RENDER_REPEAT_PAD;
+    static const char filter[] = "bilinear";
+
+    if (coarse->enabled)
+        return TRUE;
+
+    /* Over MIT-SHM, full uploads are cheap enough. The downscaled pixels
+     * are sent as they are, so the host must use our byte order. */
+    if (pPriv->usingShm || pPriv->rootless || pPriv->numViews > 1 ||
+        pPriv->img->bpp != 32 ||
+        (xcb_get_setup(pPriv->conn)->image_byte_order ==
+         XCB_IMAGE_ORDER_LSB_FIRST) != (X_BYTE_ORDER == X_LITTLE_ENDIAN) ||
+        !XCBClientCheckExtension(pPriv->conn, &xcb_render_id))
+        return FALSE;
+
+    /* RepeatPad needs Render 0.10 */
+    cookie = xcb_render_query_version(pPriv->conn, 0, 10);
+    reply = xcb_render_query_version_reply(pPriv->conn, cookie, NULL);
+
+    if (!reply)
+        return FALSE;
+    else if (reply->major_version == 0 && reply->minor_version < 10) {
+        free(reply);
+        return FALSE;
+    }
+
+    free(reply);
+
+    formats = xcb_render_util_query_formats(pPriv->conn);
+    if (!formats)
+        return FALSE;
+
+    visualFormat = xcb_render_util_find_visual_format(formats,
+                                                      pPriv->visual->visual_id);
+    if (!visualFormat)
+        return FALSE;
+
+    coarse->width = (pPriv->width + COARSE_SCALE - 1) / COARSE_SCALE + 1;
+    coarse->height = (pPriv->height + COARSE_SCALE - 1) / COARSE_SCALE + 1;
+    coarse->data = malloc((size_t)coarse->width * coarse->height *
+                          sizeof(uint32_t));
+    if (!coarse->data)
+        return FALSE;
+
+    coarse->pixmap = xcb_generate_id(pPriv->conn);
+    xcb_create_pixmap(pPriv->conn, pPriv->img->depth, coarse->pixmap,
+                      pPriv->rootWindow, coarse->width, coarse->height);
+
+    coarse->source = xcb_generate_id(pPriv->conn);
+    xcb_render_create_picture(pPriv->conn, coarse->source, coarse->pixmap,
+                              visualFormat->format,
+                              XCB_RENDER_CP_REPEAT, &repeat);
+    xcb_render_set_picture_transform(pPriv->conn, coarse->source, transform);
+    xcb_render_set_picture_filter(pPriv->conn, coarse->source,
+                                  strlen(filter), filter, 0, NULL);
+
+    coarse->picture = xcb_generate_id(pPriv->conn);
+    xcb_render_create_picture(pPriv->conn, coarse->picture, pPriv->window,
+                              visualFormat->format, 0, NULL);
+
+    coarse->enabled = TRUE;
+    pPriv->paced = TRUE;
+    return TRUE;
+}
+
+void
+NestedClientUpdateScreenCoarse(NestedClientPrivatePtr pPriv,
+                               int16_t x1, int16_t y1,
+                               int16_t x2, int16_t y2) {
+    XCBClientCoarseRec *coarse = &pPriv->coarse;
+    XCBClientViewPtr view = &pPriv->views[0];
+    int width = (x2 - x1 + COARSE_SCALE - 1) / COARSE_SCALE;
+    int height = (y2 - y1 + COARSE_SCALE - 1) / COARSE_SCALE;
+
+    if (!coarse->enabled || x1 >= x2 || y1 >= y2)
+        return;
+
+    XCBClientCoarseDownscale(pPriv, x1, y1, x2, y2, width, height);
+
+    xcb_put_image(pPriv->conn, XCB_IMAGE_FORMAT_Z_PIXMAP,
+                  coarse->pixmap, pPriv->gc,
+                  width + 1, height + 1, 0, 0, 0, pPriv->img->depth,
+                  (width + 1) * (height + 1) * sizeof(uint32_t),
+                  (const uint8_t *)coarse->data);
+    pPriv->stats.putRects++;
+    pPriv->stats.putBytes += (width + 1) * (height + 1) * sizeof(uint32_t);
+
+    xcb_render_composite(pPriv->conn, XCB_RENDER_PICT_OP_SRC,
+                         coarse->source, XCB_NONE, coarse->picture,
+                         0, 0, 0, 0,
+                         x1 - view->x, y1 - view->y,
+                         x2 - x1, y2 - y1);
+}
+
+uint32_t
+NestedClientAddGlyph(NestedClientPrivatePtr pPriv,
+                     uint16_t width,
+                     uint16_t height,
+                     int16_t x,
+                     int16_t y,
+                     int16_t xOff,
+                     int16_t yOff,
+                     const uint8_t *data,
+                     int stride) {
+    XCBClientRenderRec *render = &pPriv->render;
+    xcb_render_glyphinfo_t info;
+    int hostStride = (width + 3) & ~3;
+    size_t size = (size_t)hostStride * height;
+    uint8_t *hostData = NULL;
+    uint32_t id;
+    int i;
+
+    if (!render->enabled)
+        return 0;
+
+    /* Leave room for the request header */
+    if (size + 64 > xcb_get_maximum_request_length(pPriv->conn) * 4)
+        return 0;
+
+    if (size > 0) {
+        hostData = malloc(size);
+        if (!hostData)
+            return 0;
+
+        for (i = 0; i < height; i++)
+            memcpy(hostData + i * hostStride, data + i * stride, width);
+    }
+
+    /* Ids are never reused, so that commands still queued keep drawing
+     * the right glyphs */
+    if (++render->lastGlyph == 0)
+        ++render->lastGlyph;
+    id = render->lastGlyph;
+
+    info.width = width;
+    info.height = height;
+    info.x = x;
+    info.y = y;
+    info.x_off = xOff;
+    info.y_off = yOff;
+
+    xcb_render_add_glyphs(pPriv->conn, render->glyphset,
+                          1, &id, &info, size, hostData);
+    free(hostData);
+    return id;
+}
+
+void
+NestedClientFreeGlyph(NestedClientPrivatePtr pPriv, uint32_t id) {
+    XCBClientRenderRec *render = &pPriv->render;
+
+    if (!render->enabled)
+        return;
+
+    if (render->numFreedGlyphs == render->sizeFreedGlyphs) {
+        int size = render->sizeFreedGlyphs ? render->sizeFreedGlyphs * 2 : 64;
+        uint32_t *glyphs = realloc(render->freedGlyphs,
+                                   size * sizeof(uint32_t));
+
+        /* Leaking a host glyph is better than freeing it too early */
+        if (!glyphs)
+            return;
+
+        render->freedGlyphs = glyphs;
+        render->sizeFreedGlyphs = size;
+    }
+
+    render->freedGlyphs[render->numFreedGlyphs++] = id;
+}
+
+void
+NestedClientReleaseGlyphs(NestedClientPrivatePtr pPriv) {
+    XCBClientRenderFlushFreedGlyphs(pPriv);
+}
+
+void
+NestedClientCompositeGlyphs(NestedClientPrivatePtr pPriv,
+                            int nBox,
+                            BoxPtr pBox,
+                            uint16_t red,
+                            uint16_t green,
+                            uint16_t blue,
+                            uint16_t alpha,
+                            Bool useMask,
+                            int nGlyphs,
+                            NestedGlyphPtr pGlyphs) {
+    XCBClientRenderRec *render = &pPriv->render;
+    xcb_render_color_t color = { red, green, blue, alpha };
+    xcb_render_picture_t src;
+    xcb_rectangle_t *rects;
+    uint8_t *cmds, *elt = NULL, *p;
+    int i;
+
+    if (!render->enabled || nBox <= 0 || nGlyphs <= 0)
+        return;
+
+    rects = malloc(nBox * sizeof(xcb_rectangle_t));
+    /* Worst case, each glyph gets its own element header */
+    cmds = malloc(nGlyphs * (8 + sizeof(uint32_t)));
+
+    if (!rects || !cmds) {
+        free(rects);
+        free(cmds);
+        return;
+    }
+
+    for (i = 0; i < nBox; i++) {
+        rects[i].x = pBox[i].x1;
+        rects[i].y = pBox[i].y1;
+        rects[i].width = pBox[i].x2 - pBox[i].x1;
+        rects[i].height = pBox[i].y2 - pBox[i].y1;
+    }
+
+    /* Each element is a glyph count, 3 bytes of padding, a 16 bit delta
+     * from the current position and then the glyph ids */
+    p = cmds;
+    for (i = 0; i < nGlyphs; i++) {
+        if (!elt || elt[0] == GLYPHS_PER_ELT ||
+            pGlyphs[i].dx || pGlyphs[i].dy) {
+            elt = p;
+            memset(elt, 0, 4);
+            memcpy(elt + 4, &pGlyphs[i].dx, sizeof(int16_t));
+            memcpy(elt + 6, &pGlyphs[i].dy, sizeof(int16_t));
+            p += 8;
+        }
+
+        memcpy(p, &pGlyphs[i].id, sizeof(uint32_t));
+        p += sizeof(uint32_t);
+        elt[0]++;
+    }
+
+    src = xcb_generate_id(pPriv->conn);
+    xcb_render_create_solid_fill(pPriv->conn, src, color);
+    xcb_render_set_picture_clip_rectangles(pPriv->conn, render->picture,
+                                           0, 0, nBox, rects);
+    xcb_render_composite_glyphs_32(pPriv->conn,
+                                   XCB_RENDER_PICT_OP_OVER,
+                                   src, render->picture,
+                                   useMask ? render->a8 : XCB_NONE,
+                                   render->glyphset,
+                                   0, 0,
+                                   p - cmds, cmds);
+    xcb_render_free_picture(pPriv->conn, src);
+
+    free(rects);
+    free(cmds);
+}
+
+Bool
+NestedClientVideoInit(NestedClientPrivatePtr pPriv) {
+    XCBClientVideoRec *video = &pPriv->video;
+    xcb_xv_query_adaptors_cookie_t cookie;
+    xcb_xv_query_adaptors_reply_t *reply;
+    xcb_xv_adaptor_info_iterator_t it;
+    int i;
+
+    if (video->enabled)
+        return TRUE;
+
+    /* XXX: video is only shown in a single window */
+    if (pPriv->rootless || pPriv->numViews > 1 ||
+        !XCBClientCheckExtension(pPriv->conn, &xcb_xv_id))
+        return FALSE;
+
+    cookie = xcb_xv_query_adaptors(pPriv->conn, pPriv->window);
+    reply = xcb_xv_query_adaptors_reply(pPriv->conn, cookie, NULL);
+
+    if (!reply)
+        return FALSE;
+
+    for (it = xcb_xv_query_adaptors_info_iterator(reply);
+         it.rem && !video->enabled;
+         xcb_xv_adaptor_info_next(&it)) {
+        const uint8_t mask = XCB_XV_TYPE_INPUT_MASK | XCB_XV_TYPE_IMAGE_MASK;
+
+        if ((it.data->type & mask) != mask)
+            continue;
+
+        /* All ports of an adaptor have the same formats */
+        video->numFormats = XCBClientVideoGetFormats(pPriv, it.data->base_id,
+                                                     video->formats);
+        if (video->numFormats == 0)
+            continue;
+
+        for (i = 0; i < it.data->num_ports; i++) {
+            if (XCBClientVideoGrabPort(pPriv, it.data->base_id + i)) {
+                video->port = it.data->base_id + i;
+                video->enabled = TRUE;
+                break;
+            }
+        }
+    }
+
+    free(reply);
+
+    if (!video->enabled)
+        return FALSE;
+
+    video->gc = xcb_generate_id(pPriv->conn);
+    xcb_create_gc(pPriv->conn, video->gc, pPriv->window, 0, NULL);
+    XCBClientVideoSetAutopaint(pPriv);
+
+    xf86DrvMsg(pPriv->scrnIndex,
+               X_INFO,
+               "Using host Xv port %u with %d of our formats.\n",
+               video->port, video->numFormats);
+    return TRUE;
+}
+
+Bool
+NestedClientVideoHasFormat(NestedClientPrivatePtr pPriv, int id) {
+    int i;
+
+    for (i = 0; i < pPriv->video.numFormats; i++)
+        if (pPriv->video.formats[i] == id)
+            return TRUE;
+
+    return FALSE;
+}
+
+Bool
+NestedClientVideoPutFrame(NestedClientPrivatePtr pPriv,
+                          int id,
+                          int width,
+                          int height,
+                          const uint8_t **planes,
+                          const int *pitches) {
+    XCBClientVideoRec *video = &pPriv->video;
+    int i, row, rows, bytes;
+
+    if (!video->enabled || !XCBClientVideoAllocFrame(pPriv, id, width, height))
+        return FALSE;
+
+    for (i = 0; i < video->numPlanes; i++) {
+        if (id == FOURCC_YUY2) {
+            rows = height;
+            bytes = width * 2;
+        } else {
+            rows = i ? (height + 1) / 2 : height;
+            bytes = i ? (width + 1) / 2 : width;
+        }
+
+        if (bytes > video->pitches[i])
+            bytes = video->pitches[i];
+
+        for (row = 0; row < rows; row++)
+            memcpy(video->data + video->offsets[i] + row * video->pitches[i],
+                   planes[i] + row * pitches[i],
+                   bytes);
+    }
+
+    return TRUE;
+}
+
+void
+NestedClientVideoShow(NestedClientPrivatePtr pPriv,
+                      int nBox,
+                      BoxPtr pBox,
+                      int16_t srcX,
+                      int16_t srcY,
+                      uint16_t srcWidth,
+                      uint16_t srcHeight,
+                      int16_t dstX,
+                      int16_t dstY,
+                      uint16_t dstWidth,
+                      uint16_t dstHeight) {
+    XCBClientVideoRec *video = &pPriv->video;
+    xcb_rectangle_t *rects;
+    int i;
+
+    if (!video->enabled || !video->data || nBox <= 0)
+        return;
+
+    rects = malloc(nBox * sizeof(xcb_rectangle_t));
+    if (!rects)
+        return;
+
+    for (i = 0; i < nBox; i++) {
+        rects[i].x = pBox[i].x1;
+        rects[i].y = pBox[i].y1;
+        rects[i].width = pBox[i].x2 - pBox[i].x1;
+        rects[i].height = pBox[i].y2 - pBox[i].y1;
+    }
+
+    xcb_set_clip_rectangles(pPriv->conn,
+                            XCB_CLIP_ORDERING_UNSORTED,
+                            video->gc,
+                            0, 0,
+                            nBox, rects);
+
+    if (video->usingShm)
+        xcb_xv_shm_put_image(pPriv->conn, video->port, pPriv->window,
+                             video->gc, video->shminfo.shmseg,
+                             video->id, 0,
+                             srcX, srcY, srcWidth, srcHeight,
+                             dstX, dstY, dstWidth, dstHeight,
+                             video->width, video->height, FALSE);
+    else
+        xcb_xv_put_image(pPriv->conn, video->port, pPriv->window,
+                         video->gc, video->id,
+                         srcX, srcY, srcWidth, srcHeight,
+                         dstX, dstY, dstWidth, dstHeight,
+                         video->width, video->height,
+                         video->size, video->data);
+
+    free(rects);
+}
+
+void
+NestedClientVideoStop(NestedClientPrivatePtr pPriv) {
+    if (pPriv->video.enabled)
+        xcb_xv_stop_video(pPriv->conn, pPriv->video.port, pPriv->window);
+}
+
+void
+NestedClientFlush(NestedClientPrivatePtr pPriv) {
+    CARD64 start;
+
+    /* The reply tells when the host has gone through everything before */
+    if (pPriv->paced && !pPriv->fencePending && !pPriv->lost) {
+        pPriv->fence = xcb_get_input_focus(pPriv->conn).sequence;
+        pPriv->fenceTime = GetTimeInMicros();
+        pPriv->fencePending = TRUE;
+    }
+
+    start = GetTimeInMicros();
+    xcb_flush(pPriv->conn);
+    pPriv->stats.flushes++;
+    pPriv->stats.flushTime += GetTimeInMicros() - start;
+}
+
+void
+NestedClientCheckEvents(NestedClientPrivatePtr pPriv) {
+    XCBClientPoll(pPriv);
+
+    /* Timed as soon as the reply is there */
+    if (pPriv->fencePending)
+        NestedClientIsReady(pPriv);
+}
+
+void
+NestedClientCloseScreen(NestedClientPrivatePtr pPriv) {
+    XCBClientTileCacheFree(pPriv);
+    XCBClientCoarseFree(pPriv);
+    XCBClientRenderFree(pPriv);
+    XCBClientVideoFree(pPriv);
+    XCBClientSharedSegFree(pPriv);
+    free(pPriv->occluders);
+    free(pPriv->views);
+
+    if (pPriv->usingShm) {
+        xcb_shm_detach(pPriv->conn, pPriv->shminfo.shmseg);
+
+        /* A mirror's segment is the primary's */
+        if (!pPriv->isMirror)
+            shmdt(pPriv->shminfo.shmaddr);
     }
 
     xcb_image_destroy(pPriv->img);
@@ -31,11 +31,13 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <sys/ipc.h>
 #include <sys/shm.h>
 
 #include <X11/Xlib.h>
+#include <X11/Xatom.h>
 #include <X11/Xutil.h>
 #include <X11/XKBlib.h>
 #include <X11/extensions/XShm.h>
@@ -48,6 +50,7 @@
 #endif
 
 #include "client.h"
+#include "probes.h"
 
 struct NestedClientPrivate {
     Display *display;
@@ -57,12 +60,20 @@ struct NestedClientPrivate {
     Window window;
     XImage *img;
     GC gc;
+    GC copyGC;
+    GC fillGC;
     Bool usingShm;
     XShmSegmentInfo shminfo;
     int scrnIndex; /* stored only for xf86DrvMsg usage */
     Cursor mycursor; /* Test cursor */
     Pixmap bitmapNoData;
     XColor color1;
+    Bool mapped;
+    Bool obscured;
+    Bool hidden;
+    Atom atomWMState;
+    Atom atomWMStateHidden;
+    NestedClientStats stats;
 
     struct {
         int op;
@@ -157,10 +168,12 @@ NestedClientTryXShm(NestedClientPrivatePtr pPriv, int scrnIndex, int width, int
 NestedClientPrivatePtr
 NestedClientCreateScreen(int scrnIndex,
                          Bool wantFullscreenHint,
+                         Bool rootless,
+                         Bool lowLatency,
                          int width,
                          int height,
-                         int originX,
-                         int originY,
+                         int numOutputs,
+                         const Output *outputs,
                          int depth,
                          int bitsPerPixel,
                          Pixel *retRedMask,
@@ -173,6 +186,23 @@ NestedClientCreateScreen(int scrnIndex,
 
     pPriv = malloc(sizeof(struct NestedClientPrivate));
     pPriv->scrnIndex = scrnIndex;
+    memset(&pPriv->stats, 0, sizeof(NestedClientStats));
+
+    /* XXX: rootless mode is only implemented by the XCB client */
+    if (rootless)
+        xf86DrvMsg(scrnIndex, X_WARNING,
+                   "Rootless mode not supported, showing the whole screen.\n");
+
+    /* XXX: low-latency mode is only implemented by the XCB client */
+    if (lowLatency)
+        xf86DrvMsg(scrnIndex, X_WARNING,
+                   "Low-latency mode not supported.\n");
+
+    /* XXX: spanning several outputs is only implemented by the XCB client */
+    if (numOutputs > 1)
+        xf86DrvMsg(scrnIndex, X_WARNING,
+                   "Only showing the screen on output %s.\n",
+                   outputs[0].name);
 
     pPriv->display = XOpenDisplay(NULL);
     if (!pPriv->display)
@@ -192,7 +222,7 @@ NestedClientCreateScreen(int scrnIndex,
     pPriv->gc = DefaultGC(pPriv->display, pPriv->screenNumber);
 
     pPriv->window = XCreateSimpleWindow(pPriv->display, pPriv->rootWindow,
-    originX, originY, width, height, 0, 0, 0);
+    outputs[0].x, outputs[0].y, width, height, 0, 0, 0);
 
     sizeHints.flags = PPosition | PSize | PMinSize | PMaxSize;
     sizeHints.min_width = width;
@@ -204,10 +234,24 @@ NestedClientCreateScreen(int scrnIndex,
     snprintf(windowTitle, sizeof(windowTitle), "Screen %d", scrnIndex);
 
     XStoreName(pPriv->display, pPriv->window, windowTitle);
-    
+
+    /* Selected before mapping, so that MapNotify isn't missed */
+    pPriv->mapped = FALSE;
+    pPriv->obscured = FALSE;
+    pPriv->hidden = FALSE;
+    pPriv->atomWMState = XInternAtom(pPriv->display, "_NET_WM_STATE", False);
+    pPriv->atomWMStateHidden = XInternAtom(pPriv->display,
+                                           "_NET_WM_STATE_HIDDEN", False);
+    XSelectInput(pPriv->display, pPriv->window,
+                 ExposureMask | StructureNotifyMask |
+                 VisibilityChangeMask | PropertyChangeMask);
+
     XMapWindow(pPriv->display, pPriv->window);
 
-    XSelectInput(pPriv->display, pPriv->window, ExposureMask);
+    /* Host-side copies get their clip set on each use, and rely on
+     * GraphicsExpose to learn about sources that were obscured */
+    pPriv->copyGC = XCreateGC(pPriv->display, pPriv->window, 0, NULL);
+    pPriv->fillGC = XCreateGC(pPriv->display, pPriv->window, 0, NULL);
 
     if (!NestedClientTryXShm(pPriv, scrnIndex, width, height, depth)) {
         pPriv->img = XCreateImage(pPriv->display,
@@ -282,25 +326,345 @@ NestedClientGetFrameBuffer(NestedClientPrivatePtr pPriv) {
 void
 NestedClientUpdateScreen(NestedClientPrivatePtr pPriv, int16_t x1,
                           int16_t y1, int16_t x2, int16_t y2) {
+    unsigned long bytes = (x2 - x1) * (y2 - y1) *
+                          pPriv->img->bits_per_pixel / 8;
+
     if (pPriv->usingShm) {
         XShmPutImage(pPriv->display, pPriv->window, pPriv->gc, pPriv->img,
                      x1, y1, x1, y1, x2 - x1, y2 - y1, FALSE);
+        pPriv->stats.shmRects++;
+        pPriv->stats.shmBytes += bytes;
+        NESTED_PROBE6(put, x1, y1, x2 - x1, y2 - y1, bytes, NESTED_PROBE_SHM);
+    } else {
+        XPutImage(pPriv->display, pPriv->window, pPriv->gc, pPriv->img,
+                  x1, y1, x1, y1, x2 - x1, y2 - y1);
+        pPriv->stats.putRects++;
+        pPriv->stats.putBytes += bytes;
+        NESTED_PROBE6(put, x1, y1, x2 - x1, y2 - y1, bytes, NESTED_PROBE_PUT);
+    }
+}
+
+void
+NestedClientUpdateScreenUncached(NestedClientPrivatePtr pPriv, int16_t x1,
+                                 int16_t y1, int16_t x2, int16_t y2) {
+    NestedClientUpdateScreen(pPriv, x1, y1, x2, y2);
+}
+
+Bool
+NestedClientCoarseInit(NestedClientPrivatePtr pPriv) {
+    /* XXX: implement! */
+    return FALSE;
+}
+
+void
+NestedClientUpdateScreenCoarse(NestedClientPrivatePtr pPriv, int16_t x1,
+                               int16_t y1, int16_t x2, int16_t y2) {
+}
+
+void
+NestedClientCopyArea(NestedClientPrivatePtr pPriv, int nBox, BoxPtr pBox,
+                     int dx, int dy) {
+    XRectangle *rects;
+    BoxRec extents = *pBox;
+    int i;
+
+    if (nBox <= 0)
+        return;
+
+    rects = malloc(nBox * sizeof(XRectangle));
+    if (!rects)
+        return;
+
+    /* Clip a single copy to the boxes, so the host takes care of ordering
+     * overlapping source and destination */
+    for (i = 0; i < nBox; i++) {
+        rects[i].x = pBox[i].x1;
+        rects[i].y = pBox[i].y1;
+        rects[i].width = pBox[i].x2 - pBox[i].x1;
+        rects[i].height = pBox[i].y2 - pBox[i].y1;
+
+        if (pBox[i].x1 < extents.x1)
+            extents.x1 = pBox[i].x1;
+        if (pBox[i].y1 < extents.y1)
+            extents.y1 = pBox[i].y1;
+        if (pBox[i].x2 > extents.x2)
+            extents.x2 = pBox[i].x2;
+        if (pBox[i].y2 > extents.y2)
+            extents.y2 = pBox[i].y2;
+    }
+
+    XSetClipRectangles(pPriv->display, pPriv->copyGC, 0, 0,
+                       rects, nBox, Unsorted);
+    XCopyArea(pPriv->display, pPriv->window, pPriv->window, pPriv->copyGC,
+              extents.x1 + dx, extents.y1 + dy,
+              extents.x2 - extents.x1, extents.y2 - extents.y1,
+              extents.x1, extents.y1);
+    free(rects);
+}
+
+void
+NestedClientFillRects(NestedClientPrivatePtr pPriv, int nBox, BoxPtr pBox,
+                      Pixel pixel) {
+    XRectangle *rects;
+    int i;
+
+    if (nBox <= 0)
+        return;
+
+    rects = malloc(nBox * sizeof(XRectangle));
+    if (!rects)
+        return;
+
+    for (i = 0; i < nBox; i++) {
+        rects[i].x = pBox[i].x1;
+        rects[i].y = pBox[i].y1;
+        rects[i].width = pBox[i].x2 - pBox[i].x1;
+        rects[i].height = pBox[i].y2 - pBox[i].y1;
+    }
+
+    XSetForeground(pPriv->display, pPriv->fillGC, pixel);
+    XFillRectangles(pPriv->display, pPriv->window, pPriv->fillGC,
+                    rects, nBox);
+    free(rects);
+}
+
+void
+NestedClientSetTileCacheSize(NestedClientPrivatePtr pPriv, int numTiles) {
+    /* XXX: implement! */
+    if (numTiles > 0 && !pPriv->usingShm)
+        xf86DrvMsg(pPriv->scrnIndex, X_INFO,
+                   "Tile cache not supported by the Xlib backend.\n");
+}
+
+void
+NestedClientGetTileCacheStats(NestedClientPrivatePtr pPriv,
+                              unsigned long *hits, unsigned long *misses) {
+    *hits = 0;
+    *misses = 0;
+}
+
+void
+NestedClientGetStats(NestedClientPrivatePtr pPriv,
+                     NestedClientStatsPtr pStats) {
+    *pStats = pPriv->stats;
+}
+
+void
+NestedClientGetLatencyStats(NestedClientPrivatePtr pPriv,
+                            unsigned long *frames, unsigned long *average,
+                            unsigned long *maximum) {
+    *frames = 0;
+    *average = 0;
+    *maximum = 0;
+}
+
+Bool
+NestedClientPutSharedImage(NestedClientPrivatePtr pPriv,
+                           int shmid,
+                           uint32_t offset,
+                           int stride,
+                           int16_t x,
+                           int16_t y,
+                           uint16_t width,
+                           uint16_t height) {
+    /* XXX: implement! */
+    return FALSE;
+}
+
+void
+NestedClientSync(NestedClientPrivatePtr pPriv) {
+    XSync(pPriv->display, FALSE);
+}
+
+Bool
+NestedClientRenderInit(NestedClientPrivatePtr pPriv) {
+    /* XXX: implement! */
+    return FALSE;
+}
+
+uint32_t
+NestedClientAddGlyph(NestedClientPrivatePtr pPriv, uint16_t width,
+                     uint16_t height, int16_t x, int16_t y,
+                     int16_t xOff, int16_t yOff,
+                     const uint8_t *data, int stride) {
+    return 0;
+}
+
+void
+NestedClientFreeGlyph(NestedClientPrivatePtr pPriv, uint32_t id) {
+}
+
+void
+NestedClientReleaseGlyphs(NestedClientPrivatePtr pPriv) {
+}
+
+void
+NestedClientCompositeGlyphs(NestedClientPrivatePtr pPriv, int nBox,
+                            BoxPtr pBox, uint16_t red, uint16_t green,
+                            uint16_t blue, uint16_t alpha, Bool useMask,
+                            int nGlyphs, NestedGlyphPtr pGlyphs) {
+}
+
+Bool
+NestedClientVideoInit(NestedClientPrivatePtr pPriv) {
+    /* XXX: implement! */
+    return FALSE;
+}
+
+Bool
+NestedClientVideoHasFormat(NestedClientPrivatePtr pPriv, int id) {
+    return FALSE;
+}
+
+Bool
+NestedClientVideoPutFrame(NestedClientPrivatePtr pPriv, int id, int width,
+                          int height, const uint8_t **planes,
+                          const int *pitches) {
+    return FALSE;
+}
+
+void
+NestedClientVideoShow(NestedClientPrivatePtr pPriv, int nBox, BoxPtr pBox,
+                      int16_t srcX, int16_t srcY,
+                      uint16_t srcWidth, uint16_t srcHeight,
+                      int16_t dstX, int16_t dstY,
+                      uint16_t dstWidth, uint16_t dstHeight) {
+}
+
+void
+NestedClientVideoStop(NestedClientPrivatePtr pPriv) {
+}
+
+void
+NestedClientFlush(NestedClientPrivatePtr pPriv) {
+    CARD64 start = GetTimeInMicros();
+
+    if (pPriv->usingShm) {
         /* Without this sync we get some freezes, probably due to some lock
          * in the shm usage */
         XSync(pPriv->display, FALSE);
     } else {
-        XPutImage(pPriv->display, pPriv->window, pPriv->gc, pPriv->img,
-                  x1, y1, x1, y1, x2 - x1, y2 - y1);
+        XFlush(pPriv->display);
     }
+
+    pPriv->stats.flushes++;
+    pPriv->stats.flushTime += GetTimeInMicros() - start;
+}
+
+static Bool
+NestedClientGetHidden(NestedClientPrivatePtr pPriv) {
+    Atom type, *atoms = NULL;
+    int format;
+    unsigned long nItems, bytesAfter, i;
+    Bool hidden = FALSE;
+
+    if (XGetWindowProperty(pPriv->display, pPriv->window, pPriv->atomWMState,
+                           0, 32, False, XA_ATOM, &type, &format, &nItems,
+                           &bytesAfter, (unsigned char **)&atoms) != Success)
+        return FALSE;
+
+    if (type == XA_ATOM && format == 32)
+        for (i = 0; i < nItems; i++)
+            if (atoms[i] == pPriv->atomWMStateHidden)
+                hidden = TRUE;
+
+    if (atoms)
+        XFree(atoms);
+
+    return hidden;
+}
+
+NestedClientPrivatePtr
+NestedClientCreateMirror(NestedClientPrivatePtr primary,
+                         const char *displayName,
+                         Bool wantFullscreenHint) {
+    /* XXX: implement! Only the XCB client mirrors the screen. */
+    return NULL;
+}
+
+void
+NestedClientOutlineBoxes(NestedClientPrivatePtr pPriv, int nBox,
+                         BoxPtr pBox) {
+    /* XXX: implement! */
+}
+
+Bool
+NestedClientDrawText(NestedClientPrivatePtr pPriv, const char *text,
+                     BoxPtr pBox) {
+    /* XXX: implement! */
+    return FALSE;
+}
+
+unsigned int
+NestedClientFence(NestedClientPrivatePtr pPriv) {
+    /* XXX: implement! */
+    return 0;
+}
+
+Bool
+NestedClientFenceDone(NestedClientPrivatePtr pPriv, unsigned int fence) {
+    return TRUE;
+}
+
+void
+NestedClientSetPaced(NestedClientPrivatePtr pPriv) {
+    /* XXX: implement! */
+}
+
+Bool
+NestedClientIsReady(NestedClientPrivatePtr pPriv) {
+    return TRUE;
+}
+
+uint32_t
+NestedClientAddWindow(NestedClientPrivatePtr pPriv,
+                      int x, int y,
+                      int width, int height) {
+    return 0;
+}
+
+void
+NestedClientConfigureWindow(NestedClientPrivatePtr pPriv,
+                            uint32_t id,
+                            int x, int y,
+                            int width, int height) {
+}
+
+void
+NestedClientRestackWindow(NestedClientPrivatePtr pPriv,
+                          uint32_t id,
+                          uint32_t above) {
+}
+
+void
+NestedClientRemoveWindow(NestedClientPrivatePtr pPriv, uint32_t id) {
+}
+
+Bool
+NestedClientIsVisible(NestedClientPrivatePtr pPriv) {
+    return pPriv->mapped && !pPriv->obscured && !pPriv->hidden;
+}
+
+Bool
+NestedClientGetOcclusion(NestedClientPrivatePtr pPriv, int *nBox,
+                         BoxPtr *ppBox) {
+    /* XXX: implement! The whole window is considered visible. */
+    return FALSE;
 }
 
 void
 NestedClientCheckEvents(NestedClientPrivatePtr pPriv) {
     XEvent ev;
+    Bool updated = FALSE;
+
+    /* XCheckMaskEvent() never returns GraphicsExpose, so go through the
+     * whole queue */
+    while (XPending(pPriv->display)) {
+        XNextEvent(pPriv->display, &ev);
 
-    while(XCheckMaskEvent(pPriv->display, ~0, &ev)) {
         switch (ev.type) {
         case Expose:
+            pPriv->stats.exposes++;
             NestedClientUpdateScreen(pPriv,
                                      ((XExposeEvent*)&ev)->x,
                                      ((XExposeEvent*)&ev)->y,
@@ -308,9 +672,39 @@ NestedClientCheckEvents(NestedClientPrivatePtr pPriv) {
                                      ((XExposeEvent*)&ev)->width,
                                      ((XExposeEvent*)&ev)->y + 
                                      ((XExposeEvent*)&ev)->height);
+            updated = TRUE;
+            break;
+        case GraphicsExpose:
+            /* The source of a host-side copy wasn't available, so upload
+             * what it should have produced from the framebuffer instead */
+            NestedClientUpdateScreen(pPriv,
+                                     ((XGraphicsExposeEvent*)&ev)->x,
+                                     ((XGraphicsExposeEvent*)&ev)->y,
+                                     ((XGraphicsExposeEvent*)&ev)->x +
+                                     ((XGraphicsExposeEvent*)&ev)->width,
+                                     ((XGraphicsExposeEvent*)&ev)->y +
+                                     ((XGraphicsExposeEvent*)&ev)->height);
+            updated = TRUE;
+            break;
+        case MapNotify:
+            pPriv->mapped = TRUE;
+            break;
+        case UnmapNotify:
+            pPriv->mapped = FALSE;
+            break;
+        case VisibilityNotify:
+            pPriv->obscured = ((XVisibilityEvent*)&ev)->state ==
+                              VisibilityFullyObscured;
+            break;
+        case PropertyNotify:
+            if (((XPropertyEvent*)&ev)->atom == pPriv->atomWMState)
+                pPriv->hidden = NestedClientGetHidden(pPriv);
             break;
         }
     }
+
+    if (updated)
+        NestedClientFlush(pPriv);
 }
 
 void
@@ -320,6 +714,8 @@ NestedClientCloseScreen(NestedClientPrivatePtr pPriv) {
         shmdt(pPriv->shminfo.shmaddr);
     }
 
+    XFreeGC(pPriv->display, pPriv->copyGC);
+    XFreeGC(pPriv->display, pPriv->fillGC);
     XDestroyImage(pPriv->img);
     XCloseDisplay(pPriv->display);
 }
@@ -0,0 +1,424 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * XVideo adaptor.
+ *
+ * When the host has an Xv port for the image format, frames are handed to
+ * the client as they are, and shown on the host by a command of the
+ * acceleration layer (see accel.c), so the host does the color conversion
+ * and scaling. Like with a hardware overlay, the framebuffer only gets a
+ * color key where the video is. Otherwise, frames are converted and scaled
+ * into the framebuffer, and uploaded as usual.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+
+#include <xorg-server.h>
+#include <pixmapstr.h>
+#include <regionstr.h>
+#include <scrnintstr.h>
+#include <windowstr.h>
+#include <xf86.h>
+
+#ifdef XV
+#include <X11/extensions/Xv.h>
+#include <fourcc.h>
+#include <xf86xv.h>
+#endif
+
+#include "compat-api.h"
+
+#include "driver.h"
+
+#ifdef XV
+#define NESTED_XV_MAX_WIDTH  2048
+#define NESTED_XV_MAX_HEIGHT 2048
+
+typedef struct NestedXvPort {
+    Bool      host;    /* a host port can show the video */
+    Bool      convert; /* we can convert it into the framebuffer */
+    RegionRec clip;    /* where the color key has been painted */
+} NestedXvPortRec, *NestedXvPortPtr;
+
+static XF86VideoEncodingRec NestedXvEncodings[] = {
+    { 0, "XV_IMAGE", NESTED_XV_MAX_WIDTH, NESTED_XV_MAX_HEIGHT, { 1, 1 } }
+};
+
+static XF86VideoFormatRec NestedXvFormats[] = {
+    { 24, TrueColor }
+};
+
+static XF86ImageRec NestedXvImages[] = {
+    XVIMAGE_YV12,
+    XVIMAGE_I420,
+    XVIMAGE_YUY2
+};
+
+static inline CARD8
+NestedXvClamp(int v) {
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+/* BT.601, studio swing */
+static inline CARD32
+NestedXvYUVToRGB(ScrnInfoPtr pScrn, int y, int u, int v) {
+    int c = 298 * (y - 16) + 128;
+    int d = u - 128;
+    int e = v - 128;
+
+    return (NestedXvClamp((c + 409 * e) >> 8) << pScrn->offset.red) |
+           (NestedXvClamp((c - 100 * d - 208 * e) >> 8) << pScrn->offset.green) |
+           (NestedXvClamp((c + 516 * d) >> 8) << pScrn->offset.blue);
+}
+
+/* Converts and scales the frame into the drawable, clipped to pClip. Rows
+ * and columns are mapped with 16.16 fixed point steps, so the inner loop
+ * has no division. */
+static void
+NestedXvConvert(ScrnInfoPtr pScrn, DrawablePtr pDraw, int id,
+                const uint8_t **planes, const int *pitches,
+                short src_x, short src_y, short src_w, short src_h,
+                short drw_x, short drw_y, short drw_w, short drw_h,
+                RegionPtr pClip) {
+    ScreenPtr pScreen = pDraw->pScreen;
+    PixmapPtr pPixmap;
+    const uint8_t *pU = planes[id == FOURCC_YV12 ? 2 : 1];
+    const uint8_t *pV = planes[id == FOURCC_YV12 ? 1 : 2];
+    int xStep = ((int)src_w << 16) / drw_w;
+    int yStep = ((int)src_h << 16) / drw_h;
+    int xOff = 0, yOff = 0;
+    BoxPtr pBox = RegionRects(pClip);
+    int nBox = RegionNumRects(pClip);
+    int x, y, sx, sy;
+    CARD32 *dst;
+
+    if (pDraw->type == DRAWABLE_WINDOW)
+        pPixmap = (*pScreen->GetWindowPixmap)((WindowPtr)pDraw);
+    else
+        pPixmap = (PixmapPtr)pDraw;
+
+#ifdef COMPOSITE
+    xOff = -pPixmap->screen_x;
+    yOff = -pPixmap->screen_y;
+#endif
+
+    for (; nBox--; pBox++) {
+        for (y = pBox->y1; y < pBox->y2; y++) {
+            sy = src_y + (int)(((int64_t)(y - drw_y) * yStep) >> 16);
+            dst = (CARD32 *)((char *)pPixmap->devPrivate.ptr +
+                             (y + yOff) * pPixmap->devKind) + xOff;
+
+            if (id == FOURCC_YUY2) {
+                const uint8_t *row = planes[0] + sy * pitches[0];
+
+                for (x = pBox->x1; x < pBox->x2; x++) {
+                    sx = src_x + (int)(((int64_t)(x - drw_x) * xStep) >> 16);
+                    dst[x] = NestedXvYUVToRGB(pScrn, row[sx * 2],
+                                              row[(sx & ~1) * 2 + 1],
+                                              row[(sx & ~1) * 2 + 3]);
+                }
+            } else {
+                const uint8_t *rowY = planes[0] + sy * pitches[0];
+                const uint8_t *rowU = pU + (sy >> 1) * pitches[1];
+                const uint8_t *rowV = pV + (sy >> 1) * pitches[2];
+
+                for (x = pBox->x1; x < pBox->x2; x++) {
+                    sx = src_x + (int)(((int64_t)(x - drw_x) * xStep) >> 16);
+                    dst[x] = NestedXvYUVToRGB(pScrn, rowY[sx],
+                                              rowU[sx >> 1], rowV[sx >> 1]);
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Adaptor functions
+ */
+
+static void
+NestedXvStopVideo(ScrnInfoPtr pScrn, pointer data, Bool shutdown) {
+    NestedXvPortPtr pPort = data;
+
+    RegionEmpty(&pPort->clip);
+
+    if (pPort->host)
+        NestedClientVideoStop(PCLIENTDATA(pScrn));
+}
+
+static int
+NestedXvSetPortAttribute(ScrnInfoPtr pScrn, Atom attribute, INT32 value,
+                         pointer data) {
+    return BadMatch;
+}
+
+static int
+NestedXvGetPortAttribute(ScrnInfoPtr pScrn, Atom attribute, INT32 *value,
+                         pointer data) {
+    return BadMatch;
+}
+
+static void
+NestedXvQueryBestSize(ScrnInfoPtr pScrn, Bool motion,
+                      short vid_w, short vid_h, short drw_w, short drw_h,
+                      unsigned int *p_w, unsigned int *p_h, pointer data) {
+    /* Any scaling will do */
+    *p_w = drw_w;
+    *p_h = drw_h;
+}
+
+static int
+NestedXvQueryImageAttributes(ScrnInfoPtr pScrn, int id,
+                             unsigned short *w, unsigned short *h,
+                             int *pitches, int *offsets) {
+    int size, tmp;
+
+    if (*w > NESTED_XV_MAX_WIDTH)
+        *w = NESTED_XV_MAX_WIDTH;
+    if (*h > NESTED_XV_MAX_HEIGHT)
+        *h = NESTED_XV_MAX_HEIGHT;
+
+    *w = (*w + 1) & ~1;
+    if (offsets)
+        offsets[0] = 0;
+
+    switch (id) {
+    case FOURCC_YV12:
+    case FOURCC_I420:
+        *h = (*h + 1) & ~1;
+        size = (*w + 3) & ~3;
+        if (pitches)
+            pitches[0] = size;
+        size *= *h;
+        if (offsets)
+            offsets[1] = size;
+        tmp = ((*w >> 1) + 3) & ~3;
+        if (pitches)
+            pitches[1] = pitches[2] = tmp;
+        tmp *= (*h >> 1);
+        size += tmp;
+        if (offsets)
+            offsets[2] = size;
+        size += tmp;
+        break;
+    case FOURCC_YUY2:
+    default:
+        size = *w << 1;
+        if (pitches)
+            pitches[0] = size;
+        size *= *h;
+        break;
+    }
+
+    return size;
+}
+
+static int
+NestedXvPutImage(ScrnInfoPtr pScrn,
+                 short src_x, short src_y, short drw_x, short drw_y,
+                 short src_w, short src_h, short drw_w, short drw_h,
+                 int id, unsigned char *buf, short width, short height,
+                 Bool sync, RegionPtr clipBoxes, pointer data,
+                 DrawablePtr pDraw) {
+    ScreenPtr pScreen = xf86ScrnToScreen(pScrn);
+    NestedXvPortPtr pPort = data;
+    unsigned short w = width, h = height;
+    int pitches[3] = { 0, 0, 0 };
+    int offsets[3] = { 0, 0, 0 };
+    const uint8_t *planes[3];
+    NestedCmdPtr pCmd;
+    int i;
+
+    if (src_w <= 0 || src_h <= 0 || drw_w <= 0 || drw_h <= 0)
+        return Success;
+
+    /* The pitches are those of the largest image we take */
+    if (width > NESTED_XV_MAX_WIDTH || height > NESTED_XV_MAX_HEIGHT)
+        return BadValue;
+
+    /* Neither Xv nor the server check it, and the image is read from it */
+    if (src_x < 0 || src_y < 0 ||
+        (int)src_x + src_w > width || (int)src_y + src_h > height)
+        return BadValue;
+
+    NestedXvQueryImageAttributes(pScrn, id, &w, &h, pitches, offsets);
+    for (i = 0; i < 3; i++)
+        planes[i] = buf + offsets[i];
+
+    if (pPort->host &&
+        NestedAccelOnScreen(pDraw) &&
+        NestedClientVideoHasFormat(PCLIENTDATA(pScrn), id) &&
+        NestedClientVideoPutFrame(PCLIENTDATA(pScrn), id, width, height,
+                                  planes, pitches)) {
+        if (!RegionEqual(&pPort->clip, clipBoxes)) {
+            RegionCopy(&pPort->clip, clipBoxes);
+            xf86XVFillKeyHelperDrawable(pDraw, pScreen->blackPixel, clipBoxes);
+        }
+
+        /* Nothing changed in the framebuffer, but the update has to run
+         * for the command to be replayed */
+        DamageDamageRegion(pDraw, clipBoxes);
+
+        pCmd = NestedAccelRecord(pScreen, NESTED_CMD_VIDEO, clipBoxes);
+        if (pCmd) {
+            pCmd->videoSrc.x = src_x;
+            pCmd->videoSrc.y = src_y;
+            pCmd->videoSrc.width = src_w;
+            pCmd->videoSrc.height = src_h;
+            pCmd->videoDst.x = drw_x;
+            pCmd->videoDst.y = drw_y;
+            pCmd->videoDst.width = drw_w;
+            pCmd->videoDst.height = drw_h;
+            return Success;
+        }
+    }
+
+    /* The color key has to be painted again once back on the host */
+    RegionEmpty(&pPort->clip);
+
+    if (!pPort->convert)
+        return BadMatch;
+
+    NestedXvConvert(pScrn, pDraw, id, planes, pitches,
+                    src_x, src_y, src_w, src_h,
+                    drw_x, drw_y, drw_w, drw_h, clipBoxes);
+    DamageDamageRegion(pDraw, clipBoxes);
+    return Success;
+}
+
+#endif /* XV */
+
+/*
+ * Public functions
+ */
+
+/* Called from NestedScreenInit, after wrapping CloseScreen, so that Xv stops
+ * the port while the client is still there */
+Bool
+NestedXvInit(ScreenPtr pScreen) {
+#ifdef XV
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    XF86VideoAdaptorPtr pAdaptor;
+    NestedXvPortPtr pPort;
+    DevUnion *pPortPrivates;
+    Bool host, convert;
+
+    pNested->xvPort = NULL;
+
+    if (!pNested->xv)
+        return TRUE;
+
+    /* Host frames need the command replay of the acceleration layer, and
+     * mirrors would only get the color key */
+    host = pNested->accel && pNested->numMirrors == 0 &&
+           NestedClientVideoInit(pNested->clientData);
+    convert = pScrn->bitsPerPixel == 32 && pScrn->depth == 24;
+
+    if (!host && !convert) {
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+                   "No host Xv port and no software conversion at depth %d, XVideo disabled.\n",
+                   pScrn->depth);
+        return TRUE;
+    }
+
+    pAdaptor = xf86XVAllocateVideoAdaptorRec(pScrn);
+    pPort = calloc(1, sizeof(NestedXvPortRec));
+    pPortPrivates = calloc(1, sizeof(DevUnion));
+
+    if (!pAdaptor || !pPort || !pPortPrivates) {
+        if (pAdaptor)
+            xf86XVFreeVideoAdaptorRec(pAdaptor);
+        free(pPort);
+        free(pPortPrivates);
+        return FALSE;
+    }
+
+    pPort->host = host;
+    pPort->convert = convert;
+    RegionNull(&pPort->clip);
+    pPortPrivates[0].ptr = pPort;
+
+    NestedXvFormats[0].depth = pScrn->depth;
+
+    pAdaptor->type = XvWindowMask | XvInputMask | XvImageMask;
+    pAdaptor->flags = VIDEO_OVERLAID_IMAGES | VIDEO_CLIP_TO_VIEWPORT;
+    pAdaptor->name = "Nested Video";
+    pAdaptor->nEncodings = ARRAY_SIZE(NestedXvEncodings);
+    pAdaptor->pEncodings = NestedXvEncodings;
+    pAdaptor->nFormats = ARRAY_SIZE(NestedXvFormats);
+    pAdaptor->pFormats = NestedXvFormats;
+    pAdaptor->nPorts = 1;
+    pAdaptor->pPortPrivates = pPortPrivates;
+    pAdaptor->nAttributes = 0;
+    pAdaptor->pAttributes = NULL;
+    pAdaptor->nImages = ARRAY_SIZE(NestedXvImages);
+    pAdaptor->pImages = NestedXvImages;
+    pAdaptor->PutVideo = NULL;
+    pAdaptor->PutStill = NULL;
+    pAdaptor->GetVideo = NULL;
+    pAdaptor->GetStill = NULL;
+    pAdaptor->StopVideo = NestedXvStopVideo;
+    pAdaptor->SetPortAttribute = NestedXvSetPortAttribute;
+    pAdaptor->GetPortAttribute = NestedXvGetPortAttribute;
+    pAdaptor->QueryBestSize = NestedXvQueryBestSize;
+    pAdaptor->PutImage = NestedXvPutImage;
+    pAdaptor->QueryImageAttributes = NestedXvQueryImageAttributes;
+
+    /* The adaptor is copied, but the port privates are ours */
+    if (!xf86XVScreenInit(pScreen, &pAdaptor, 1)) {
+        xf86XVFreeVideoAdaptorRec(pAdaptor);
+        free(pPortPrivates);
+        free(pPort);
+        return FALSE;
+    }
+
+    xf86XVFreeVideoAdaptorRec(pAdaptor);
+    free(pPortPrivates);
+    pNested->xvPort = pPort;
+
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO, "XVideo adaptor using %s\n",
+               host ? "the host Xv port" : "software conversion");
+    return TRUE;
+#else
+    PNESTED(xf86ScreenToScrn(pScreen))->xvPort = NULL;
+    return TRUE;
+#endif
+}
+
+void
+NestedXvClose(ScreenPtr pScreen) {
+#ifdef XV
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
+    NestedXvPortPtr pPort = pNested->xvPort;
+
+    if (pPort) {
+        RegionUninit(&pPort->clip);
+        free(pPort);
+        pNested->xvPort = NULL;
+    }
+#endif
+}